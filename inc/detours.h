@@ -311,6 +311,7 @@ extern "C" {
 
 extern const GUID DETOUR_EXE_RESTORE_GUID;
 extern const GUID DETOUR_EXE_HELPER_GUID;
+extern const GUID DETOUR_PAYLOAD_INDEX_GUID;
 
 #define DETOUR_TRAMPOLINE_SIGNATURE             0x21727444  // Dtr!
 typedef struct _DETOUR_TRAMPOLINE DETOUR_TRAMPOLINE, *PDETOUR_TRAMPOLINE;
@@ -352,6 +353,23 @@ typedef struct _DETOUR_SECTION_RECORD
     GUID        guid;
 } DETOUR_SECTION_RECORD, *PDETOUR_SECTION_RECORD;
 
+// Optional first payload record, tagged with DETOUR_PAYLOAD_INDEX_GUID.
+// Readers that predate it see one more payload and walk the records.
+typedef struct _DETOUR_SECTION_INDEX
+{
+    DWORD       cbData;         // Bytes of payload data indexed, this record included.
+    DWORD       cEntries;
+
+    // Followed by cEntries DETOUR_SECTION_INDEX_ENTRYs, sorted by guid bytes.
+} DETOUR_SECTION_INDEX, *PDETOUR_SECTION_INDEX;
+
+typedef struct _DETOUR_SECTION_INDEX_ENTRY
+{
+    GUID        guid;
+    DWORD       nOffset;        // From the start of the payload data.
+    DWORD       cbBytes;        // Copy of the record's cbBytes.
+} DETOUR_SECTION_INDEX_ENTRY, *PDETOUR_SECTION_INDEX_ENTRY;
+
 typedef struct _DETOUR_CLR_HEADER
 {
     // Header versioning
@@ -486,6 +504,21 @@ typedef BOOL (DETOURS_CALLBACK *PF_DETOUR_IMPORT_FUNC_CALLBACK_EX)(_In_opt_ PVOI
 typedef VOID * PDETOUR_BINARY;
 typedef VOID * PDETOUR_LOADED_BINARY;
 
+// Counters for the most recently committed or aborted transaction.
+typedef struct _DETOUR_TRANSACTION_STATISTICS
+{
+    DWORD       cb;                     // sizeof(DETOUR_TRANSACTION_STATISTICS)
+    DWORD       nOperations;            // Attach and detach operations.
+    DWORD       nProtectCalls;          // Page protection changes issued.
+    DWORD       nFlushCalls;            // Instruction cache flushes issued.
+    DWORD       nArenaAllocations;      // Operation and thread records handed out.
+    DWORD       nHeapAllocations;       // Arena blocks taken from the heap or pool.
+    DWORD       nThreads;               // Threads suspended by the transaction.
+    DWORD       nSuspendedMicroseconds; // First suspend to last resume.
+    DWORD       nDecodeCacheHits;       // Prologues taken from the decode cache.
+    DWORD       nDecodeCacheMisses;     // Prologues decoded with the cache enabled.
+} DETOUR_TRANSACTION_STATISTICS, *PDETOUR_TRANSACTION_STATISTICS;
+
 //////////////////////////////////////////////////////////// Transaction APIs.
 //
 LONG DETOURS_API DetourTransactionBegin(VOID);
@@ -494,6 +527,7 @@ LONG DETOURS_API DetourTransactionCommit(VOID);
 LONG DETOURS_API DetourTransactionCommitEx(_Out_opt_ PVOID **pppFailedPointer);
 
 LONG DETOURS_API DetourUpdateThread(_In_ HANDLE hThread);
+LONG DETOURS_API DetourUpdateAllThreads(VOID);
 
 LONG DETOURS_API DetourAttach(_Inout_ PVOID *ppPointer,
                          _In_ PVOID pDetour);
@@ -509,8 +543,10 @@ LONG DETOURS_API DetourDetach(_Inout_ PVOID *ppPointer,
 
 BOOL DETOURS_API DetourSetIgnoreTooSmall(_In_ BOOL fIgnore);
 BOOL DETOURS_API DetourSetRetainRegions(_In_ BOOL fRetain);
+BOOL DETOURS_API DetourSetDecodeCache(_In_ BOOL fEnable);
 PVOID DETOURS_API DetourSetSystemRegionLowerBound(_In_ PVOID pSystemRegionLowerBound);
 PVOID DETOURS_API DetourSetSystemRegionUpperBound(_In_ PVOID pSystemRegionUpperBound);
+BOOL DETOURS_API DetourGetTransactionStatistics(_Out_ PDETOUR_TRANSACTION_STATISTICS pStatistics);
 
 ////////////////////////////////////////////////////////////// Code Functions.
 //
@@ -532,11 +568,19 @@ BOOL DETOURS_API DetourSetCodeModule(_In_ HMODULE hModule,
 
 HMODULE DETOURS_API DetourGetContainingModule(_In_ PVOID pvAddr);
 HMODULE DETOURS_API DetourEnumerateModules(_In_opt_ HMODULE hModuleLast);
+// Enabling the cache registers a loader callback in the module that links
+// detours.lib.  Call DetourSetModuleMapCache(FALSE) before that module
+// unloads (for example in DLL_PROCESS_DETACH), or the loader will call into
+// unmapped code.
+BOOL DETOURS_API DetourSetModuleMapCache(_In_ BOOL fEnable);
+VOID DETOURS_API DetourInvalidateModuleMap(VOID);
 PVOID DETOURS_API DetourGetEntryPoint(_In_opt_ HMODULE hModule);
 ULONG DETOURS_API DetourGetModuleSize(_In_opt_ HMODULE hModule);
 BOOL DETOURS_API DetourEnumerateExports(_In_ HMODULE hModule,
                                    _In_opt_ PVOID pContext,
                                    _In_ PF_DETOUR_ENUMERATE_EXPORT_CALLBACK pfExport);
+PVOID DETOURS_API DetourFindExport(_In_opt_ HMODULE hModule,
+                              _In_ LPCSTR pszName);
 BOOL DETOURS_API DetourEnumerateImports(_In_opt_ HMODULE hModule,
                                    _In_opt_ PVOID pContext,
                                    _In_opt_ PF_DETOUR_IMPORT_FILE_CALLBACK pfImportFile,
@@ -599,6 +643,7 @@ BOOL DETOURS_API DetourBinaryEditImports(_In_ PDETOUR_BINARY pBinary,
                                     _In_opt_ PF_DETOUR_BINARY_SYMBOL_CALLBACK pfSymbol,
                                     _In_opt_ PF_DETOUR_BINARY_COMMIT_CALLBACK pfCommit);
 BOOL DETOURS_API DetourBinaryWrite(_In_ PDETOUR_BINARY pBinary, _In_ HANDLE hFile);
+DWORD DETOURS_API DetourBinaryGetImportBytesReused(_In_ PDETOUR_BINARY pBinary);
 BOOL DETOURS_API DetourBinaryClose(_In_ PDETOUR_BINARY pBinary);
 
 #endif // DetoursUserMode
@@ -0,0 +1,1093 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Detours Test Program (hookscan.cpp of hookscan.exe)
+//
+//  Microsoft Research Detours Package
+//
+//  Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//  Decides, for every exported or .pdata-listed function in a set of PE
+//  files, whether DetourAttach could hook it.  Each file is scanned with
+//  the offline disassembler for its own machine type, so X86, X64, ARM and
+//  ARM64 images can be scanned on any host.  On non-Windows hosts, build
+//  with Makefile.host against the libdisol.a from src/Makefile.host.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+
+#ifdef DETOURS_OFFLINE_HOST
+#include <disolhost.h>
+#else
+#include <windows.h>
+#include <detours.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  The per-machine limits mirror _DETOUR_TRAMPOLINE and SIZE_OF_JMP in
+//  detours.cpp.
+//
+#define HOOKSCAN_MACHINE_I386       0x014c
+#define HOOKSCAN_MACHINE_ARMNT      0x01c4
+#define HOOKSCAN_MACHINE_AMD64      0x8664
+#define HOOKSCAN_MACHINE_ARM64      0xaa64
+
+#define HOOKSCAN_ALIGN_MAX          8       // ARRAYSIZE(_DETOUR_TRAMPOLINE::rAlign)
+#define HOOKSCAN_SCRATCH            256     // > largest rbCode + one instruction.
+#define HOOKSCAN_SLOP               64      // Zeros past the image for the decoders.
+
+enum {
+    HOOKSCAN_STATUS_OK          = 0,        // Hookable.
+    HOOKSCAN_STATUS_TOO_SMALL   = 1,        // Function ends before SIZE_OF_JMP.
+    HOOKSCAN_STATUS_TOO_LARGE   = 2,        // Moved code won't fit in rbCode.
+    HOOKSCAN_STATUS_BRANCH_INTO = 3,        // Prologue branches into moved code.
+    HOOKSCAN_STATUS_BAD_CODE    = 4,        // Undecodable, or runs off the image.
+    HOOKSCAN_STATUS_NOT_CODE    = 5,        // Not in an executable section.
+};
+
+enum {
+    HOOKSCAN_SOURCE_EXPORT      = 0x01,
+    HOOKSCAN_SOURCE_PDATA       = 0x02,
+};
+
+static const char * s_rpszStatus[] = {
+    "ok",
+    "too-small",
+    "too-large",
+    "branch-into",
+    "bad-code",
+    "not-code",
+};
+
+typedef PVOID (DETOURS_API *PF_HOOKSCAN_COPY)(PVOID pDst,
+                                              PVOID *ppDstPool,
+                                              PVOID pSrc,
+                                              PVOID *ppTarget,
+                                              LONG *plExtra);
+
+struct HOOKSCAN_MACHINE
+{
+    USHORT              wMachine;
+    const char *        pszName;
+    ULONG               cbJump;         // SIZE_OF_JMP
+    ULONG               cbCode;         // sizeof(_DETOUR_TRAMPOLINE::rbCode)
+    BOOL                fThumb;         // Function addresses carry the Thumb bit.
+    PF_HOOKSCAN_COPY    pfCopy;
+    BOOL                (*pfSetRange)(PBYTE pbImage, ULONG cbImage);
+    BOOL                (*pfDoesCodeEndFunction)(PBYTE pbCode);
+    ULONG               (*pfIsCodeFiller)(PBYTE pbCode);
+};
+
+struct HOOKSCAN_FUNCTION
+{
+    ULONG               nRva;
+    ULONG               nOrdinal;
+    const char *        pszName;        // Points into the mapped image.
+    BYTE                bSource;
+    BYTE                bStatus;
+    BYTE                cbTarget;       // Bytes of the target moved to the trampoline.
+    BYTE                cbCode;         // Bytes of rbCode they need there.
+};
+
+struct HOOKSCAN_SECTION
+{
+    ULONG               nBeg;
+    ULONG               nEnd;
+    BOOL                fCode;
+};
+
+struct HOOKSCAN_IMAGE
+{
+    const char *                pszPath;
+    USHORT                      wMachine;
+    const HOOKSCAN_MACHINE *    pMachine;
+    PBYTE                       pbImage;    // Sections at their RVAs.
+    ULONG                       cbImage;
+    HOOKSCAN_SECTION *          pSections;
+    ULONG                       nSections;
+    HOOKSCAN_FUNCTION *         pFunctions;
+    ULONG                       nFunctions;
+    std::atomic<ULONG>          nNextFunction;
+};
+
+////////////////////////////////////////////////////// Compact Binary Report.
+//
+//  A HOOKSCAN_BIN_HEADER, then for each file a HOOKSCAN_BIN_FILE, the path
+//  (cchPath bytes, not terminated), and nFunctions HOOKSCAN_BIN_RECORDs.
+//  All fields are little-endian.
+//
+#define HOOKSCAN_BIN_SIGNATURE      0x4353484b      // "HKSC"
+#define HOOKSCAN_BIN_VERSION        1
+
+struct HOOKSCAN_BIN_HEADER
+{
+    ULONG               nSignature;
+    ULONG               nVersion;
+};
+
+struct HOOKSCAN_BIN_FILE
+{
+    USHORT              wMachine;
+    USHORT              cchPath;
+    ULONG               nFunctions;
+};
+
+struct HOOKSCAN_BIN_RECORD
+{
+    ULONG               nRva;
+    BYTE                bSource;
+    BYTE                bStatus;
+    BYTE                cbTarget;
+    BYTE                cbCode;
+};
+
+C_ASSERT(sizeof(HOOKSCAN_BIN_HEADER) == 8);
+C_ASSERT(sizeof(HOOKSCAN_BIN_FILE) == 8);
+C_ASSERT(sizeof(HOOKSCAN_BIN_RECORD) == 8);
+
+//////////////////////////////////////////////////////////////////////////////
+//
+static BOOL         s_fVerbose = FALSE;
+static ULONG        s_nThreads = 0;
+static FILE *       s_pCsv = nullptr;
+static FILE *       s_pBin = nullptr;
+
+static ULONG        s_nFiles = 0;
+static ULONG        s_nFilesFailed = 0;
+static ULONG        s_rnStatus[ARRAYSIZE(s_rpszStatus)];
+
+//////////////////////////////////////////////////// X86 and X64 Prologues.
+//
+//  Copies of detour_does_code_end_function and detour_is_code_filler from
+//  detours.cpp, which only exist there for the native architecture.
+//
+static BOOL DoesCodeEndFunctionX86(PBYTE pbCode)
+{
+    if (pbCode[0] == 0xeb ||    // jmp +imm8
+        pbCode[0] == 0xe9 ||    // jmp +imm32
+        pbCode[0] == 0xe0 ||    // jmp eax
+        pbCode[0] == 0xc2 ||    // ret +imm8
+        pbCode[0] == 0xc3 ||    // ret
+        pbCode[0] == 0xcc) {    // brk
+        return TRUE;
+    }
+    else if (pbCode[0] == 0xf3 && pbCode[1] == 0xc3) {  // rep ret
+        return TRUE;
+    }
+    else if (pbCode[0] == 0xff && pbCode[1] == 0x25) {  // jmp [+imm32]
+        return TRUE;
+    }
+    else if ((pbCode[0] == 0x26 ||      // jmp es:
+              pbCode[0] == 0x2e ||      // jmp cs:
+              pbCode[0] == 0x36 ||      // jmp ss:
+              pbCode[0] == 0x3e ||      // jmp ds:
+              pbCode[0] == 0x64 ||      // jmp fs:
+              pbCode[0] == 0x65) &&     // jmp gs:
+             pbCode[1] == 0xff &&       // jmp [+imm32]
+             pbCode[2] == 0x25) {
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static ULONG IsCodeFillerX86(PBYTE pbCode)
+{
+    static const BYTE s_rbNops[][12] = {
+        // Length, then the bytes of each recommended multi-byte NOP.
+        { 1, 0x90 },
+        { 2, 0x66, 0x90 },
+        { 3, 0x0F, 0x1F, 0x00 },
+        { 4, 0x0F, 0x1F, 0x40, 0x00 },
+        { 5, 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+        { 6, 0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+        { 7, 0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00 },
+        { 8, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+        { 9, 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+        { 10, 0x66, 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+        { 11, 0x66, 0x66, 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+        { 1, 0xcc },                                                // int 3.
+    };
+
+    for (ULONG n = 0; n < ARRAYSIZE(s_rbNops); n++) {
+        if (memcmp(pbCode, &s_rbNops[n][1], s_rbNops[n][0]) == 0) {
+            return s_rbNops[n][0];
+        }
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////// ARM Prologues.
+//
+static ULONG FetchThumbOpcode(PBYTE pbCode)
+{
+    ULONG Opcode = pbCode[0] | ((ULONG)pbCode[1] << 8);
+    if (Opcode >= 0xe800) {
+        Opcode = (Opcode << 16) | pbCode[2] | ((ULONG)pbCode[3] << 8);
+    }
+    return Opcode;
+}
+
+static BOOL DoesCodeEndFunctionARM(PBYTE pbCode)
+{
+    ULONG Opcode = FetchThumbOpcode(pbCode);
+    if ((Opcode & 0xffffff87) == 0x4700 ||          // bx <reg>
+        (Opcode & 0xf800d000) == 0xf0009000) {      // b <imm20>
+        return TRUE;
+    }
+    if ((Opcode & 0xffff8000) == 0xe8bd8000) {      // pop {...,pc}
+        return TRUE;
+    }
+    if ((Opcode & 0xffffff00) == 0x0000bd00) {      // pop {...,pc}
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static ULONG IsCodeFillerARM(PBYTE pbCode)
+{
+    if (pbCode[0] == 0x00 && pbCode[1] == 0xbf) { // nop.
+        return 2;
+    }
+    if (pbCode[0] == 0x00 && pbCode[1] == 0x00) { // zero-filled padding.
+        return 2;
+    }
+    return 0;
+}
+
+//////////////////////////////////////////////////////////// ARM64 Prologues.
+//
+static ULONG FetchOpcodeARM64(PBYTE pbCode)
+{
+    return pbCode[0] | ((ULONG)pbCode[1] << 8) |
+        ((ULONG)pbCode[2] << 16) | ((ULONG)pbCode[3] << 24);
+}
+
+static BOOL DoesCodeEndFunctionARM64(PBYTE pbCode)
+{
+    ULONG Opcode = FetchOpcodeARM64(pbCode);
+    if ((Opcode & 0xfffffc1f) == 0xd65f0000 ||      // br <reg>
+        (Opcode & 0xfc000000) == 0x14000000) {      // b <imm26>
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static ULONG IsCodeFillerARM64(PBYTE pbCode)
+{
+    ULONG Opcode = FetchOpcodeARM64(pbCode);
+    if (Opcode == 0xd503201f) {     // nop.
+        return 4;
+    }
+    if (Opcode == 0x00000000) {     // zero-filled padding.
+        return 4;
+    }
+    return 0;
+}
+
+//////////////////////////////////////////////////////////// Machine Table.
+//
+//  The x86 and x64 decoders only follow indirect jumps through memory
+//  inside the code range, which is global to each decoder.
+//
+#ifdef DETOURS_OFFLINE_HOST
+#define HOOKSCAN_SET_RANGE(x)                                           \
+static BOOL SetRange##x(PBYTE pbImage, ULONG cbImage)                   \
+{                                                                       \
+    return DetourSetCodeRange##x(pbImage, pbImage + cbImage, TRUE);     \
+}
+#else
+#define HOOKSCAN_SET_RANGE(x)                                           \
+static BOOL SetRange##x(PBYTE pbImage, ULONG cbImage)                   \
+{                                                                       \
+    (void)cbImage;                                                      \
+    return DetourSetCodeModule##x((HMODULE)pbImage, TRUE);              \
+}
+#endif
+
+HOOKSCAN_SET_RANGE(X86)
+HOOKSCAN_SET_RANGE(X64)
+HOOKSCAN_SET_RANGE(ARM)
+HOOKSCAN_SET_RANGE(ARM64)
+
+#undef HOOKSCAN_SET_RANGE
+
+static const HOOKSCAN_MACHINE s_rMachines[] = {
+    { HOOKSCAN_MACHINE_I386, "x86", 5, 30, FALSE,
+      DetourCopyInstructionX86, SetRangeX86,
+      DoesCodeEndFunctionX86, IsCodeFillerX86 },
+    { HOOKSCAN_MACHINE_AMD64, "x64", 5, 30, FALSE,
+      DetourCopyInstructionX64, SetRangeX64,
+      DoesCodeEndFunctionX86, IsCodeFillerX86 },
+    { HOOKSCAN_MACHINE_ARMNT, "arm", 8, 62, TRUE,
+      DetourCopyInstructionARM, SetRangeARM,
+      DoesCodeEndFunctionARM, IsCodeFillerARM },
+    { HOOKSCAN_MACHINE_ARM64, "arm64", 16, 128, FALSE,
+      DetourCopyInstructionARM64, SetRangeARM64,
+      DoesCodeEndFunctionARM64, IsCodeFillerARM64 },
+};
+
+static const HOOKSCAN_MACHINE * FindMachine(USHORT wMachine)
+{
+    for (ULONG n = 0; n < ARRAYSIZE(s_rMachines); n++) {
+        if (s_rMachines[n].wMachine == wMachine) {
+            return &s_rMachines[n];
+        }
+    }
+    return nullptr;
+}
+
+/////////////////////////////////////////////////////////////// Image Reader.
+//
+static inline USHORT Read16(const BYTE *pb)
+{
+    return (USHORT)(pb[0] | (pb[1] << 8));
+}
+
+static inline ULONG Read32(const BYTE *pb)
+{
+    return pb[0] | ((ULONG)pb[1] << 8) | ((ULONG)pb[2] << 16) | ((ULONG)pb[3] << 24);
+}
+
+// Reads a ULONG from the file, or returns 0 if it would run past the end.
+static inline ULONG ReadFile32(const BYTE *pbFile, ULONG cbFile, ULONG nOffset)
+{
+    if (nOffset > cbFile || cbFile - nOffset < 4) {
+        return 0;
+    }
+    return Read32(pbFile + nOffset);
+}
+
+static FILE * OpenFile(const char *pszPath, const char *pszMode)
+{
+#ifdef _MSC_VER
+    FILE *pFile = nullptr;
+    if (fopen_s(&pFile, pszPath, pszMode) != 0) {
+        return nullptr;
+    }
+    return pFile;
+#else
+    return fopen(pszPath, pszMode);
+#endif
+}
+
+static PBYTE ReadWholeFile(const char *pszPath, ULONG *pcbFile)
+{
+    FILE *pFile = OpenFile(pszPath, "rb");
+    if (pFile == nullptr) {
+        return nullptr;
+    }
+
+    PBYTE pbFile = nullptr;
+    long cbFile = 0;
+    if (fseek(pFile, 0, SEEK_END) == 0 &&
+        (cbFile = ftell(pFile)) > 0 &&
+        fseek(pFile, 0, SEEK_SET) == 0 &&
+        (pbFile = (PBYTE)malloc(cbFile)) != nullptr) {
+
+        if (fread(pbFile, 1, cbFile, pFile) != (size_t)cbFile) {
+            free(pbFile);
+            pbFile = nullptr;
+        }
+    }
+    fclose(pFile);
+
+    *pcbFile = (ULONG)cbFile;
+    return pbFile;
+}
+
+// Returns TRUE if [nRva, nRva + cb) lies within the mapped image.
+static inline BOOL InImage(const HOOKSCAN_IMAGE *pImage, ULONG nRva, ULONG cb)
+{
+    return nRva < pImage->cbImage && cb <= pImage->cbImage - nRva;
+}
+
+// Lays the headers and sections out at their RVAs, the way the loader would.
+static BOOL MapImage(HOOKSCAN_IMAGE *pImage, const BYTE *pbFile, ULONG cbFile)
+{
+    if (cbFile < 0x40 || Read16(pbFile) != 0x5a4d) {            // "MZ"
+        return FALSE;
+    }
+    ULONG nNtHeader = Read32(pbFile + 0x3c);
+    if (nNtHeader > cbFile || cbFile - nNtHeader < 24 ||
+        Read32(pbFile + nNtHeader) != 0x00004550) {             // "PE\0\0"
+        return FALSE;
+    }
+
+    const BYTE *pbFileHeader = pbFile + nNtHeader + 4;
+    USHORT wMachine = Read16(pbFileHeader + 0);
+    ULONG nSections = Read16(pbFileHeader + 2);
+    ULONG cbOptional = Read16(pbFileHeader + 16);
+    ULONG nOptional = nNtHeader + 24;
+    ULONG nSectionTable = nOptional + cbOptional;
+
+    if (cbOptional < 64 || nSectionTable > cbFile ||
+        (cbFile - nSectionTable) / 40 < nSections) {
+        return FALSE;
+    }
+
+    pImage->wMachine = wMachine;
+    pImage->pMachine = FindMachine(wMachine);
+    if (pImage->pMachine == nullptr) {
+        return FALSE;
+    }
+
+    ULONG cbImage = ReadFile32(pbFile, cbFile, nOptional + 56);
+    ULONG cbHeaders = ReadFile32(pbFile, cbFile, nOptional + 60);
+    if (cbImage == 0 || cbImage > 0x40000000) {
+        return FALSE;
+    }
+
+    pImage->cbImage = cbImage;
+    pImage->pbImage = (PBYTE)calloc(cbImage + HOOKSCAN_SLOP, 1);
+    pImage->pSections = (HOOKSCAN_SECTION *)calloc(nSections + 1, sizeof(HOOKSCAN_SECTION));
+    if (pImage->pbImage == nullptr || pImage->pSections == nullptr) {
+        return FALSE;
+    }
+
+    ULONG cbCopy = cbHeaders;
+    if (cbCopy > cbFile) {
+        cbCopy = cbFile;
+    }
+    if (cbCopy > cbImage) {
+        cbCopy = cbImage;
+    }
+    memcpy(pImage->pbImage, pbFile, cbCopy);
+
+    for (ULONG n = 0; n < nSections; n++) {
+        const BYTE *pbSection = pbFile + nSectionTable + n * 40;
+        ULONG cbVirtual = Read32(pbSection + 8);
+        ULONG nVirtual = Read32(pbSection + 12);
+        ULONG cbRaw = Read32(pbSection + 16);
+        ULONG nRaw = Read32(pbSection + 20);
+        ULONG nCharacteristics = Read32(pbSection + 36);
+
+        if (nVirtual >= cbImage) {
+            continue;
+        }
+        if (cbVirtual == 0 || cbVirtual > cbImage - nVirtual) {
+            cbVirtual = cbImage - nVirtual;
+        }
+
+        cbCopy = cbRaw < cbVirtual ? cbRaw : cbVirtual;
+        if (nRaw >= cbFile) {
+            cbCopy = 0;
+        }
+        else if (cbCopy > cbFile - nRaw) {
+            cbCopy = cbFile - nRaw;
+        }
+        memcpy(pImage->pbImage + nVirtual, pbFile + nRaw, cbCopy);
+
+        HOOKSCAN_SECTION *pSection = &pImage->pSections[pImage->nSections++];
+        pSection->nBeg = nVirtual;
+        pSection->nEnd = nVirtual + cbVirtual;
+        pSection->fCode = (nCharacteristics & (0x20000000 |    // MEM_EXECUTE
+                                               0x00000020)) != 0; // CNT_CODE
+    }
+
+    // Locate the data directories in either optional header layout.  An
+    // optional header too short to reach them has none.
+    USHORT wMagic = Read16(pbFile + nOptional);
+    ULONG cbFixed = (wMagic == 0x20b) ? 112 : 96;
+    ULONG nDirectories = nOptional + cbFixed;
+    ULONG cDirectories = 0;
+    if (cbOptional >= cbFixed) {
+        cDirectories = ReadFile32(pbFile, cbFile, nDirectories - 4);
+        if (cDirectories > (cbOptional - cbFixed) / 8) {
+            cDirectories = (cbOptional - cbFixed) / 8;
+        }
+    }
+    pImage->nFunctions = 0;
+    pImage->pFunctions = nullptr;
+
+    ULONG nExportRva = 0;
+    ULONG cbExport = 0;
+    ULONG nPdataRva = 0;
+    ULONG cbPdata = 0;
+    if (cDirectories > 0) {
+        nExportRva = ReadFile32(pbFile, cbFile, nDirectories + 0 * 8);
+        cbExport = ReadFile32(pbFile, cbFile, nDirectories + 0 * 8 + 4);
+    }
+    if (cDirectories > 3) {
+        nPdataRva = ReadFile32(pbFile, cbFile, nDirectories + 3 * 8);
+        cbPdata = ReadFile32(pbFile, cbFile, nDirectories + 3 * 8 + 4);
+    }
+
+    //////////////////////////////////////////////////// Collect Functions.
+    //
+    ULONG nFunctionsMax = 0;
+    ULONG nExports = 0;
+    ULONG cbPdataEntry = (wMachine == HOOKSCAN_MACHINE_AMD64) ? 12 : 8;
+    ULONG nPdata = 0;
+
+    if (nExportRva != 0 && InImage(pImage, nExportRva, 40)) {
+        nExports = Read32(pImage->pbImage + nExportRva + 20);
+        if (nExports > cbImage / 4 ||
+            !InImage(pImage, Read32(pImage->pbImage + nExportRva + 28), nExports * 4)) {
+            nExports = 0;
+        }
+        nFunctionsMax += nExports;
+    }
+    if (nPdataRva != 0 && wMachine != HOOKSCAN_MACHINE_I386 &&
+        InImage(pImage, nPdataRva, cbPdata)) {
+        nPdata = cbPdata / cbPdataEntry;
+        nFunctionsMax += nPdata;
+    }
+
+    pImage->pFunctions = (HOOKSCAN_FUNCTION *)calloc(nFunctionsMax + 1,
+                                                     sizeof(HOOKSCAN_FUNCTION));
+    if (pImage->pFunctions == nullptr) {
+        return FALSE;
+    }
+
+    if (nExports != 0) {
+        const BYTE *pbExport = pImage->pbImage + nExportRva;
+        ULONG nBase = Read32(pbExport + 16);
+        ULONG nNames = Read32(pbExport + 24);
+        ULONG nFunctionTable = Read32(pbExport + 28);
+        ULONG nNameTable = Read32(pbExport + 32);
+        ULONG nOrdinalTable = Read32(pbExport + 36);
+        HOOKSCAN_FUNCTION *pFirst = &pImage->pFunctions[pImage->nFunctions];
+
+        for (ULONG n = 0; n < nExports; n++) {
+            HOOKSCAN_FUNCTION *pFunction = &pFirst[n];
+            pFunction->nRva = Read32(pImage->pbImage + nFunctionTable + n * 4);
+            pFunction->nOrdinal = nBase + n;
+            pFunction->bSource = HOOKSCAN_SOURCE_EXPORT;
+        }
+
+        if (nNames <= cbImage / 4 &&
+            InImage(pImage, nNameTable, nNames * 4) &&
+            InImage(pImage, nOrdinalTable, nNames * 2)) {
+            for (ULONG n = 0; n < nNames; n++) {
+                ULONG nName = Read32(pImage->pbImage + nNameTable + n * 4);
+                USHORT nIndex = Read16(pImage->pbImage + nOrdinalTable + n * 2);
+                if (nIndex < nExports && nName < cbImage) {
+                    // HOOKSCAN_SLOP zeros terminate a name at the image end.
+                    pFirst[nIndex].pszName = (const char *)pImage->pbImage + nName;
+                }
+            }
+        }
+
+        // Keep only real code; drop unused slots and forwarders.
+        ULONG nKept = 0;
+        for (ULONG n = 0; n < nExports; n++) {
+            if (pFirst[n].nRva == 0 ||
+                (pFirst[n].nRva >= nExportRva && pFirst[n].nRva < nExportRva + cbExport)) {
+                continue;
+            }
+            pFirst[nKept++] = pFirst[n];
+        }
+        pImage->nFunctions += nKept;
+    }
+
+    for (ULONG n = 0; n < nPdata; n++) {
+        ULONG nBegin = Read32(pImage->pbImage + nPdataRva + n * cbPdataEntry);
+        if (nBegin != 0) {
+            HOOKSCAN_FUNCTION *pFunction = &pImage->pFunctions[pImage->nFunctions++];
+            pFunction->nRva = nBegin;
+            pFunction->bSource = HOOKSCAN_SOURCE_PDATA;
+        }
+    }
+    return TRUE;
+}
+
+static int CompareFunctions(const void *pvOne, const void *pvTwo)
+{
+    const HOOKSCAN_FUNCTION *pOne = (const HOOKSCAN_FUNCTION *)pvOne;
+    const HOOKSCAN_FUNCTION *pTwo = (const HOOKSCAN_FUNCTION *)pvTwo;
+
+    if (pOne->nRva != pTwo->nRva) {
+        return pOne->nRva < pTwo->nRva ? -1 : 1;
+    }
+    return (int)pTwo->bSource - (int)pOne->bSource;     // Exports first.
+}
+
+// Sorts by RVA and folds an export and its .pdata entry into one function.
+static void MergeFunctions(HOOKSCAN_IMAGE *pImage)
+{
+    if (pImage->pMachine->fThumb) {
+        for (ULONG n = 0; n < pImage->nFunctions; n++) {
+            pImage->pFunctions[n].nRva &= ~(ULONG)1;
+        }
+    }
+
+    qsort(pImage->pFunctions, pImage->nFunctions, sizeof(HOOKSCAN_FUNCTION),
+          CompareFunctions);
+
+    ULONG nKept = 0;
+    for (ULONG n = 0; n < pImage->nFunctions; n++) {
+        HOOKSCAN_FUNCTION *pFunction = &pImage->pFunctions[n];
+        if (nKept > 0 && pImage->pFunctions[nKept - 1].nRva == pFunction->nRva) {
+            HOOKSCAN_FUNCTION *pLast = &pImage->pFunctions[nKept - 1];
+            pLast->bSource |= pFunction->bSource;
+            if (pLast->pszName == nullptr) {
+                pLast->pszName = pFunction->pszName;
+                pLast->nOrdinal = pFunction->nOrdinal;
+            }
+            continue;
+        }
+        pImage->pFunctions[nKept++] = *pFunction;
+    }
+    pImage->nFunctions = nKept;
+}
+
+static void FreeImage(HOOKSCAN_IMAGE *pImage)
+{
+    free(pImage->pbImage);
+    free(pImage->pSections);
+    free(pImage->pFunctions);
+    pImage->pbImage = nullptr;
+    pImage->pSections = nullptr;
+    pImage->pFunctions = nullptr;
+}
+
+/////////////////////////////////////////////////////////// Prologue Analysis.
+//
+//  Follows the instruction-copy loop of DetourAttachEx: move whole
+//  instructions until SIZE_OF_JMP bytes are covered, stop at the end of the
+//  function or after rAlign fills, then consume trailing filler.
+//
+static BOOL IsCode(const HOOKSCAN_IMAGE *pImage, ULONG nRva)
+{
+    for (ULONG n = 0; n < pImage->nSections; n++) {
+        const HOOKSCAN_SECTION *pSection = &pImage->pSections[n];
+        if (nRva >= pSection->nBeg && nRva < pSection->nEnd) {
+            return pSection->fCode;
+        }
+    }
+    return FALSE;
+}
+
+static void AnalyzeFunction(const HOOKSCAN_IMAGE *pImage, HOOKSCAN_FUNCTION *pFunction)
+{
+    const HOOKSCAN_MACHINE *pMachine = pImage->pMachine;
+
+    if (!IsCode(pImage, pFunction->nRva)) {
+        pFunction->bStatus = HOOKSCAN_STATUS_NOT_CODE;
+        return;
+    }
+
+    BYTE rbCode[HOOKSCAN_SCRATCH];
+    PBYTE rpbTargets[HOOKSCAN_ALIGN_MAX];
+    ULONG nTargets = 0;
+
+    PBYTE pbLimit = pImage->pbImage + pImage->cbImage;
+    PBYTE pbTarget = pImage->pbImage + pFunction->nRva;
+    PBYTE pbSrc = pbTarget;
+    PBYTE pbTrampoline = rbCode;
+    PBYTE pbPool = rbCode + pMachine->cbCode;
+    ULONG cbTarget = 0;
+    ULONG nAlign = 0;
+    BYTE bStatus = HOOKSCAN_STATUS_OK;
+
+    while (cbTarget < pMachine->cbJump) {
+        PBYTE pbOp = pbSrc;
+        PVOID pvTarget = nullptr;
+        LONG lExtra = 0;
+
+        pbSrc = (PBYTE)(*pMachine->pfCopy)(pbTrampoline, (PVOID *)&pbPool,
+                                           pbSrc, &pvTarget, &lExtra);
+        if (pbSrc == nullptr || pbSrc <= pbOp || pbSrc > pbLimit) {
+            bStatus = HOOKSCAN_STATUS_BAD_CODE;
+            pbSrc = pbOp;
+            break;
+        }
+
+        pbTrampoline += (pbSrc - pbOp) + lExtra;
+        cbTarget = (ULONG)(pbSrc - pbTarget);
+        if (pvTarget != DETOUR_INSTRUCTION_TARGET_NONE &&
+            pvTarget != DETOUR_INSTRUCTION_TARGET_DYNAMIC) {
+            rpbTargets[nTargets++] = (PBYTE)pvTarget;
+        }
+        nAlign++;
+
+        if (pbTrampoline > pbPool) {
+            bStatus = HOOKSCAN_STATUS_TOO_LARGE;
+            break;
+        }
+        if (nAlign >= HOOKSCAN_ALIGN_MAX) {
+            break;
+        }
+        if ((*pMachine->pfDoesCodeEndFunction)(pbOp)) {
+            break;
+        }
+    }
+
+    // Consume, but don't count, padding if it is needed and available.
+    while (bStatus == HOOKSCAN_STATUS_OK && cbTarget < pMachine->cbJump &&
+           pbSrc < pbLimit) {
+        ULONG cFiller = (*pMachine->pfIsCodeFiller)(pbSrc);
+        if (cFiller == 0) {
+            break;
+        }
+        pbSrc += cFiller;
+        cbTarget = (ULONG)(pbSrc - pbTarget);
+    }
+
+    if (bStatus == HOOKSCAN_STATUS_OK) {
+        if (cbTarget < pMachine->cbJump || nAlign > HOOKSCAN_ALIGN_MAX) {
+            bStatus = HOOKSCAN_STATUS_TOO_SMALL;
+        }
+        else if (cbTarget > pMachine->cbCode - pMachine->cbJump) {
+            bStatus = HOOKSCAN_STATUS_TOO_LARGE;
+        }
+    }
+
+    // A branch back into the overwritten bytes would land in the jmp.
+    if (bStatus == HOOKSCAN_STATUS_OK) {
+        for (ULONG n = 0; n < nTargets; n++) {
+            PBYTE pbBranch = rpbTargets[n];
+            if (pMachine->fThumb) {
+                pbBranch = (PBYTE)((ULONG_PTR)pbBranch & ~(ULONG_PTR)1);
+            }
+            if (pbBranch >= pbTarget && pbBranch < pbTarget + cbTarget) {
+                bStatus = HOOKSCAN_STATUS_BRANCH_INTO;
+                break;
+            }
+        }
+    }
+
+    ULONG cbCode = (ULONG)(pbTrampoline - rbCode);
+    pFunction->bStatus = bStatus;
+    pFunction->cbTarget = (BYTE)(cbTarget < 0xff ? cbTarget : 0xff);
+    pFunction->cbCode = (BYTE)(cbCode < 0xff ? cbCode : 0xff);
+}
+
+static void WorkerThread(HOOKSCAN_IMAGE *pImage)
+{
+    for (;;) {
+        ULONG n = pImage->nNextFunction++;
+        if (n >= pImage->nFunctions) {
+            break;
+        }
+        AnalyzeFunction(pImage, &pImage->pFunctions[n]);
+    }
+}
+
+//////////////////////////////////////////////////////////////////// Reports.
+//
+static void ReportImage(const HOOKSCAN_IMAGE *pImage)
+{
+    const HOOKSCAN_MACHINE *pMachine = pImage->pMachine;
+
+    if (s_pCsv != nullptr) {
+        for (ULONG n = 0; n < pImage->nFunctions; n++) {
+            const HOOKSCAN_FUNCTION *pFunction = &pImage->pFunctions[n];
+            fprintf(s_pCsv, "%s,%s,0x%08x,%u,%s%s,%s,%u,%u,%s\n",
+                    pImage->pszPath,
+                    pMachine->pszName,
+                    (unsigned)pFunction->nRva,
+                    (unsigned)pFunction->nOrdinal,
+                    (pFunction->bSource & HOOKSCAN_SOURCE_EXPORT) ? "e" : "",
+                    (pFunction->bSource & HOOKSCAN_SOURCE_PDATA) ? "p" : "",
+                    s_rpszStatus[pFunction->bStatus],
+                    (unsigned)pFunction->cbTarget,
+                    (unsigned)pFunction->cbCode,
+                    pFunction->pszName ? pFunction->pszName : "");
+        }
+    }
+
+    if (s_pBin != nullptr) {
+        HOOKSCAN_BIN_FILE file;
+        size_t cchPath = strlen(pImage->pszPath);
+        file.wMachine = pMachine->wMachine;
+        file.cchPath = (USHORT)(cchPath < 0xffff ? cchPath : 0xffff);
+        file.nFunctions = pImage->nFunctions;
+        fwrite(&file, sizeof(file), 1, s_pBin);
+        fwrite(pImage->pszPath, 1, file.cchPath, s_pBin);
+
+        for (ULONG n = 0; n < pImage->nFunctions; n++) {
+            const HOOKSCAN_FUNCTION *pFunction = &pImage->pFunctions[n];
+            HOOKSCAN_BIN_RECORD record;
+            record.nRva = pFunction->nRva;
+            record.bSource = pFunction->bSource;
+            record.bStatus = pFunction->bStatus;
+            record.cbTarget = pFunction->cbTarget;
+            record.cbCode = pFunction->cbCode;
+            fwrite(&record, sizeof(record), 1, s_pBin);
+        }
+    }
+
+    ULONG rnStatus[ARRAYSIZE(s_rpszStatus)] = {};
+    for (ULONG n = 0; n < pImage->nFunctions; n++) {
+        rnStatus[pImage->pFunctions[n].bStatus]++;
+    }
+    for (ULONG n = 0; n < ARRAYSIZE(s_rpszStatus); n++) {
+        s_rnStatus[n] += rnStatus[n];
+    }
+
+    if (s_fVerbose) {
+        fprintf(stderr, "  %s: %s, %u functions, %u hookable\n",
+                pImage->pszPath, pMachine->pszName,
+                (unsigned)pImage->nFunctions,
+                (unsigned)rnStatus[HOOKSCAN_STATUS_OK]);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Each decoder keeps its code range in a global, so files are scanned one
+//  at a time and the functions of each file are spread across the workers.
+//
+static BOOL ScanFile(const char *pszPath)
+{
+    HOOKSCAN_IMAGE image;
+    ULONG cbFile = 0;
+    BOOL fGood = FALSE;
+
+    image.pszPath = pszPath;
+    image.wMachine = 0;
+    image.pMachine = nullptr;
+    image.pbImage = nullptr;
+    image.cbImage = 0;
+    image.pSections = nullptr;
+    image.nSections = 0;
+    image.pFunctions = nullptr;
+    image.nFunctions = 0;
+    image.nNextFunction = 0;
+
+    s_nFiles++;
+
+    PBYTE pbFile = ReadWholeFile(pszPath, &cbFile);
+    if (pbFile == nullptr) {
+        fprintf(stderr, "hookscan: %s: couldn't read file.\n", pszPath);
+        goto end;
+    }
+    if (!MapImage(&image, pbFile, cbFile)) {
+        if (image.wMachine != 0 && image.pMachine == nullptr) {
+            fprintf(stderr, "hookscan: %s: unsupported machine 0x%04x.\n",
+                    pszPath, image.wMachine);
+        }
+        else {
+            fprintf(stderr, "hookscan: %s: not a valid PE image.\n", pszPath);
+        }
+        goto end;
+    }
+    free(pbFile);
+    pbFile = nullptr;
+
+    MergeFunctions(&image);
+    (*image.pMachine->pfSetRange)(image.pbImage, image.cbImage);
+
+    {
+        ULONG nThreads = s_nThreads;
+        if (nThreads > image.nFunctions / 64) {
+            nThreads = image.nFunctions / 64;
+        }
+
+        std::thread *pThreads = nullptr;
+        if (nThreads > 1) {
+            pThreads = new std::thread [nThreads - 1];
+            for (ULONG n = 0; n < nThreads - 1; n++) {
+                pThreads[n] = std::thread(WorkerThread, &image);
+            }
+        }
+        WorkerThread(&image);
+        if (pThreads != nullptr) {
+            for (ULONG n = 0; n < nThreads - 1; n++) {
+                pThreads[n].join();
+            }
+            delete[] pThreads;
+        }
+    }
+
+    ReportImage(&image);
+    fGood = TRUE;
+
+  end:
+    if (!fGood) {
+        s_nFilesFailed++;
+    }
+    free(pbFile);
+    FreeImage(&image);
+    return fGood;
+}
+
+// Scans one file per non-blank line of a response file.
+static BOOL ScanFilesFromList(const char *pszList)
+{
+    FILE *pFile = OpenFile(pszList, "r");
+    if (pFile == nullptr) {
+        fprintf(stderr, "hookscan: Couldn't open file list: %s\n", pszList);
+        return FALSE;
+    }
+
+    char szLine[1024];
+    while (fgets(szLine, sizeof(szLine), pFile) != nullptr) {
+        size_t cch = strlen(szLine);
+        while (cch > 0 && (szLine[cch - 1] == '\n' || szLine[cch - 1] == '\r' ||
+                           szLine[cch - 1] == ' ' || szLine[cch - 1] == '\t')) {
+            szLine[--cch] = '\0';
+        }
+        if (cch > 0) {
+            ScanFile(szLine);
+        }
+    }
+    fclose(pFile);
+    return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Host paths start with '/', so only '-' introduces an option there.
+//
+static BOOL IsOption(const char *pszArg)
+{
+#ifdef DETOURS_OFFLINE_HOST
+    return pszArg[0] == '-';
+#else
+    return pszArg[0] == '-' || pszArg[0] == '/';
+#endif
+}
+
+void PrintUsage(void)
+{
+    printf("Usage:\n"
+           "    hookscan [options] binary_files | @file_list\n"
+           "Options:\n"
+           "    /o:file.csv  : Write the CSV report to file.csv (default: stdout)\n"
+           "    /b:file.bin  : Write the compact binary report to file.bin\n"
+           "    /t:threads   : Number of worker threads (default: one per processor)\n"
+           "    /v           : Summarize each file on stderr\n"
+           "    /?           : This help screen.\n"
+           "CSV columns:\n"
+           "    file,machine,rva,ordinal,source,status,target_bytes,code_bytes,name\n");
+}
+
+//////////////////////////////////////////////////////////////////////// main.
+//
+int main(int argc, char **argv)
+{
+    BOOL fNeedHelp = FALSE;
+    const char *pszCsv = nullptr;
+    const char *pszBin = nullptr;
+    int nFirstFile = 0;
+
+    int arg = 1;
+    for (; arg < argc; arg++) {
+        if (IsOption(argv[arg])) {
+            char *argn = argv[arg] + 1;
+            char *argp = argn;
+            while (*argp && *argp != ':' && *argp != '=')
+                argp++;
+            if (*argp == ':' || *argp == '=')
+                *argp++ = '\0';
+
+            switch (argn[0]) {
+
+              case 'b':                                 // Binary report
+              case 'B':
+                pszBin = argp;
+                break;
+
+              case 'o':                                 // CSV report
+              case 'O':
+                pszCsv = argp;
+                break;
+
+              case 't':                                 // Worker threads
+              case 'T':
+                s_nThreads = (ULONG)atol(argp);
+                break;
+
+              case 'v':                                 // Verbose
+              case 'V':
+                s_fVerbose = TRUE;
+                break;
+
+              case '?':                                 // Help
+                fNeedHelp = TRUE;
+                break;
+
+              default:
+                fNeedHelp = TRUE;
+                printf("Bad argument: %s:%s\n", argn, argp);
+                break;
+            }
+        }
+        else if (nFirstFile == 0) {
+            nFirstFile = arg;
+        }
+    }
+
+    if (nFirstFile == 0) {
+        fNeedHelp = TRUE;
+    }
+    if (fNeedHelp) {
+        PrintUsage();
+        return 1;
+    }
+
+    if (s_nThreads == 0) {
+        s_nThreads = std::thread::hardware_concurrency();
+        if (s_nThreads == 0) {
+            s_nThreads = 1;
+        }
+    }
+
+    if (pszCsv != nullptr) {
+        if ((s_pCsv = OpenFile(pszCsv, "w")) == nullptr) {
+            fprintf(stderr, "hookscan: Couldn't create %s\n", pszCsv);
+            return 2;
+        }
+    }
+    else if (pszBin == nullptr) {
+        s_pCsv = stdout;
+    }
+    if (pszBin != nullptr) {
+        if ((s_pBin = OpenFile(pszBin, "wb")) == nullptr) {
+            fprintf(stderr, "hookscan: Couldn't create %s\n", pszBin);
+            return 2;
+        }
+        HOOKSCAN_BIN_HEADER header;
+        header.nSignature = HOOKSCAN_BIN_SIGNATURE;
+        header.nVersion = HOOKSCAN_BIN_VERSION;
+        fwrite(&header, sizeof(header), 1, s_pBin);
+    }
+
+    if (s_pCsv != nullptr) {
+        fprintf(s_pCsv,
+                "file,machine,rva,ordinal,source,status,target_bytes,code_bytes,name\n");
+    }
+
+    for (arg = nFirstFile; arg < argc; arg++) {
+        if (IsOption(argv[arg])) {
+            continue;
+        }
+        if (argv[arg][0] == '@') {
+            if (!ScanFilesFromList(argv[arg] + 1)) {
+                return 3;
+            }
+        }
+        else {
+            ScanFile(argv[arg]);
+        }
+    }
+
+    if (s_pCsv != nullptr && s_pCsv != stdout) {
+        fclose(s_pCsv);
+    }
+    if (s_pBin != nullptr) {
+        fclose(s_pBin);
+    }
+
+    ULONG nFunctions = 0;
+    for (ULONG n = 0; n < ARRAYSIZE(s_rpszStatus); n++) {
+        nFunctions += s_rnStatus[n];
+    }
+    fprintf(stderr, "hookscan: %u files (%u failed), %u functions with %u threads:",
+            (unsigned)s_nFiles, (unsigned)s_nFilesFailed,
+            (unsigned)nFunctions, (unsigned)s_nThreads);
+    for (ULONG n = 0; n < ARRAYSIZE(s_rpszStatus); n++) {
+        fprintf(stderr, " %s=%u", s_rpszStatus[n], (unsigned)s_rnStatus[n]);
+    }
+    fprintf(stderr, "\n");
+
+    return s_nFilesFailed ? 4 : 0;
+}
+
+//
+///////////////////////////////////////////////////////////////// End of File.
@@ -191,6 +191,10 @@ BOOL SetFile(PCHAR pszPath)
             printf("DetourBinaryWrite failed: %d\n", GetLastError());
             bGood = FALSE;
         }
+        else if (DetourBinaryGetImportBytesReused(pBinary) != 0) {
+            printf("    (%u bytes of import tables reused)\n",
+                   DetourBinaryGetImportBytesReused(pBinary));
+        }
 
         DetourBinaryClose(pBinary);
         pBinary = NULL;
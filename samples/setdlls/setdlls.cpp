@@ -0,0 +1,554 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Detours Test Program (setdlls.cpp of setdlls.exe)
+//
+//  Microsoft Research Detours Package
+//
+//  Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//  Batch version of setdll.exe.  Adds (or removes) a byway DLL, and
+//  optionally stamps a payload, across many binaries using a pool of
+//  worker threads, then prints one report for the whole batch.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include <detours.h>
+#pragma warning(push)
+#if _MSC_VER > 1400
+#pragma warning(disable:6102 6103) // /analyze warnings
+#endif
+#include <strsafe.h>
+#pragma warning(pop)
+
+//////////////////////////////////////////////////////////////////////////////
+//
+struct SETDLLS_JOB
+{
+    PCHAR       pszPath;
+    BOOL        fGood;
+    PCSTR       pszFailed;      // Step that failed, if !fGood.
+    DWORD       dwError;
+    DWORD       cbIn;
+    DWORD       cbOut;
+};
+
+struct SETDLLS_WORKER
+{
+    HANDLE      hThread;
+    DWORD       nFiles;
+    CHAR        szNew[MAX_PATH];    // Reused for every file on this thread.
+    CHAR        szOld[MAX_PATH];
+};
+
+static BOOLEAN          s_fRemove = FALSE;
+static BOOLEAN          s_fVerbose = FALSE;
+static CHAR             s_szDllPath[MAX_PATH] = "";
+
+static BOOLEAN          s_fPayload = FALSE;
+static GUID             s_guidPayload;
+static PBYTE            s_pbPayload = NULL;     // Read once, shared by all workers.
+static DWORD            s_cbPayload = 0;
+
+static SETDLLS_JOB *    s_pJobs = NULL;
+static LONG             s_nJobs = 0;
+static LONG             s_nJobsMax = 0;
+static volatile LONG    s_nNextJob = -1;
+
+//////////////////////////////////////////////////////////////////////////////
+//
+static BOOL CALLBACK ExportCallback(_In_opt_ PVOID pContext,
+                                    _In_ ULONG nOrdinal,
+                                    _In_opt_ LPCSTR pszName,
+                                    _In_opt_ PVOID pCode)
+{
+    (void)pCode;
+    (void)pszName;
+
+    if (nOrdinal == 1) {
+        *((BOOL *)pContext) = TRUE;
+    }
+    return TRUE;
+}
+
+BOOL DoesDllExportOrdinal1(PCHAR pszDllPath)
+{
+    HMODULE hDll = LoadLibraryExA(pszDllPath, NULL, DONT_RESOLVE_DLL_REFERENCES);
+    if (hDll == NULL) {
+        printf("setdlls.exe: LoadLibraryEx(%s) failed with error %d.\n",
+               pszDllPath,
+               GetLastError());
+        return FALSE;
+    }
+
+    BOOL validFlag = FALSE;
+    DetourEnumerateExports(hDll, &validFlag, ExportCallback);
+    FreeLibrary(hDll);
+    return validFlag;
+}
+
+static BOOL CALLBACK AddBywayCallback(_In_opt_ PVOID pContext,
+                                      _In_opt_ LPCSTR pszFile,
+                                      _Outptr_result_maybenull_ LPCSTR *ppszOutFile)
+{
+    PBOOL pbAddedDll = (PBOOL)pContext;
+    if (!pszFile && !*pbAddedDll) {                     // Add new byway.
+        *pbAddedDll = TRUE;
+        *ppszOutFile = s_szDllPath;
+    }
+    return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+static BOOL Fail(SETDLLS_JOB *pJob, PCSTR pszStep)
+{
+    pJob->fGood = FALSE;
+    pJob->pszFailed = pszStep;
+    pJob->dwError = GetLastError();
+    return FALSE;
+}
+
+BOOL SetFile(SETDLLS_JOB *pJob, SETDLLS_WORKER *pWorker)
+{
+    HANDLE hOld = INVALID_HANDLE_VALUE;
+    HANDLE hNew = INVALID_HANDLE_VALUE;
+    PDETOUR_BINARY pBinary = NULL;
+    PCHAR pszOrg = pJob->pszPath;
+
+    pJob->fGood = TRUE;
+
+    StringCchCopyA(pWorker->szNew, sizeof(pWorker->szNew), pszOrg);
+    StringCchCatA(pWorker->szNew, sizeof(pWorker->szNew), "#");
+    StringCchCopyA(pWorker->szOld, sizeof(pWorker->szOld), pszOrg);
+    StringCchCatA(pWorker->szOld, sizeof(pWorker->szOld), "~");
+
+    hOld = CreateFileA(pszOrg,
+                       GENERIC_READ,
+                       FILE_SHARE_READ,
+                       NULL,
+                       OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL,
+                       NULL);
+    if (hOld == INVALID_HANDLE_VALUE) {
+        Fail(pJob, "open input");
+        goto end;
+    }
+    pJob->cbIn = GetFileSize(hOld, NULL);
+
+    hNew = CreateFileA(pWorker->szNew,
+                       GENERIC_WRITE | GENERIC_READ, 0, NULL, CREATE_ALWAYS,
+                       FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hNew == INVALID_HANDLE_VALUE) {
+        Fail(pJob, "open output");
+        goto end;
+    }
+
+    if ((pBinary = DetourBinaryOpen(hOld)) == NULL) {
+        Fail(pJob, "DetourBinaryOpen");
+        goto end;
+    }
+
+    CloseHandle(hOld);
+    hOld = INVALID_HANDLE_VALUE;
+
+    DetourBinaryResetImports(pBinary);
+
+    if (!s_fRemove) {
+        BOOL bAddedDll = FALSE;
+
+        if (!DetourBinaryEditImports(pBinary,
+                                     &bAddedDll,
+                                     AddBywayCallback, NULL, NULL, NULL)) {
+            Fail(pJob, "DetourBinaryEditImports");
+            goto end;
+        }
+    }
+
+    if (s_fPayload) {
+        if (s_fRemove) {
+            DetourBinaryDeletePayload(pBinary, s_guidPayload);
+        }
+        else if (DetourBinarySetPayload(pBinary, s_guidPayload,
+                                        s_pbPayload, s_cbPayload) == NULL) {
+            Fail(pJob, "DetourBinarySetPayload");
+            goto end;
+        }
+    }
+
+    if (!DetourBinaryWrite(pBinary, hNew)) {
+        Fail(pJob, "DetourBinaryWrite");
+        goto end;
+    }
+    pJob->cbOut = GetFileSize(hNew, NULL);
+
+    DetourBinaryClose(pBinary);
+    pBinary = NULL;
+    CloseHandle(hNew);
+    hNew = INVALID_HANDLE_VALUE;
+
+    if (!DeleteFileA(pWorker->szOld)) {
+        if (GetLastError() != ERROR_FILE_NOT_FOUND) {
+            Fail(pJob, "delete backup");
+            goto end;
+        }
+    }
+    if (!MoveFileA(pszOrg, pWorker->szOld)) {
+        Fail(pJob, "back up original");
+        goto end;
+    }
+    if (!MoveFileA(pWorker->szNew, pszOrg)) {
+        Fail(pJob, "install output");
+        goto end;
+    }
+
+  end:
+    if (pBinary) {
+        DetourBinaryClose(pBinary);
+        pBinary = NULL;
+    }
+    if (hNew != INVALID_HANDLE_VALUE) {
+        CloseHandle(hNew);
+        hNew = INVALID_HANDLE_VALUE;
+    }
+    if (hOld != INVALID_HANDLE_VALUE) {
+        CloseHandle(hOld);
+        hOld = INVALID_HANDLE_VALUE;
+    }
+    DeleteFileA(pWorker->szNew);
+
+    if (s_fVerbose) {
+        if (pJob->fGood) {
+            printf("  %s: %d -> %d bytes\n", pszOrg, pJob->cbIn, pJob->cbOut);
+        }
+        else {
+            printf("  %s: %s failed: %d\n", pszOrg, pJob->pszFailed, pJob->dwError);
+        }
+    }
+    return pJob->fGood;
+}
+
+static DWORD WINAPI WorkerThread(_In_ PVOID pvWorker)
+{
+    SETDLLS_WORKER *pWorker = (SETDLLS_WORKER *)pvWorker;
+
+    for (;;) {
+        LONG n = InterlockedIncrement(&s_nNextJob);
+        if (n >= s_nJobs) {
+            break;
+        }
+        SetFile(&s_pJobs[n], pWorker);
+        pWorker->nFiles++;
+    }
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+static BOOL AddJob(PCSTR pszPath)
+{
+    if (s_nJobs == s_nJobsMax) {
+        LONG nJobsMax = s_nJobsMax ? s_nJobsMax * 2 : 256;
+        SETDLLS_JOB *pJobs = (SETDLLS_JOB *)realloc(s_pJobs, nJobsMax * sizeof(SETDLLS_JOB));
+        if (pJobs == NULL) {
+            printf("setdlls.exe: Out of memory.\n");
+            return FALSE;
+        }
+        s_pJobs = pJobs;
+        s_nJobsMax = nJobsMax;
+    }
+
+    SETDLLS_JOB *pJob = &s_pJobs[s_nJobs];
+    ZeroMemory(pJob, sizeof(*pJob));
+    pJob->pszPath = _strdup(pszPath);
+    if (pJob->pszPath == NULL) {
+        printf("setdlls.exe: Out of memory.\n");
+        return FALSE;
+    }
+    s_nJobs++;
+    return TRUE;
+}
+
+// Adds one job per non-blank line of a response file.
+static BOOL AddJobsFromFile(PCSTR pszList)
+{
+    FILE *pFile = NULL;
+    if (fopen_s(&pFile, pszList, "r") != 0 || pFile == NULL) {
+        printf("setdlls.exe: Couldn't open file list: %s\n", pszList);
+        return FALSE;
+    }
+
+    CHAR szLine[MAX_PATH + 2];
+    BOOL fGood = TRUE;
+    while (fGood && fgets(szLine, sizeof(szLine), pFile) != NULL) {
+        size_t cch = strlen(szLine);
+        while (cch > 0 && (szLine[cch - 1] == '\n' || szLine[cch - 1] == '\r' ||
+                           szLine[cch - 1] == ' ' || szLine[cch - 1] == '\t')) {
+            szLine[--cch] = '\0';
+        }
+        if (cch > 0) {
+            fGood = AddJob(szLine);
+        }
+    }
+    fclose(pFile);
+    return fGood;
+}
+
+static BOOL ReadPayload(PCSTR pszFile)
+{
+    HANDLE hFile = CreateFileA(pszFile, GENERIC_READ, FILE_SHARE_READ, NULL,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        printf("setdlls.exe: Couldn't open payload %s: %d\n", pszFile, GetLastError());
+        return FALSE;
+    }
+
+    BOOL fGood = FALSE;
+    DWORD cbDone = 0;
+    s_cbPayload = GetFileSize(hFile, NULL);
+    s_pbPayload = (PBYTE)malloc(s_cbPayload ? s_cbPayload : 1);
+    if (s_pbPayload == NULL) {
+        printf("setdlls.exe: Out of memory.\n");
+    }
+    else if (!ReadFile(hFile, s_pbPayload, s_cbPayload, &cbDone, NULL) ||
+             cbDone != s_cbPayload) {
+        printf("setdlls.exe: Couldn't read payload %s: %d\n", pszFile, GetLastError());
+    }
+    else {
+        fGood = TRUE;
+    }
+    CloseHandle(hFile);
+    return fGood;
+}
+
+static BOOL ParseGuid(PCSTR psz, GUID *pGuid)
+{
+    unsigned int r[11];
+
+    if (*psz == '{') {
+        psz++;
+    }
+    if (sscanf_s(psz, "%8x-%4x-%4x-%2x%2x-%2x%2x%2x%2x%2x%2x",
+                 &r[0], &r[1], &r[2], &r[3], &r[4],
+                 &r[5], &r[6], &r[7], &r[8], &r[9], &r[10]) != 11) {
+        return FALSE;
+    }
+
+    pGuid->Data1 = r[0];
+    pGuid->Data2 = (USHORT)r[1];
+    pGuid->Data3 = (USHORT)r[2];
+    for (int i = 0; i < 8; i++) {
+        pGuid->Data4[i] = (BYTE)r[3 + i];
+    }
+    return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+void PrintUsage(void)
+{
+    printf("Usage:\n"
+           "    setdlls [options] binary_files | @file_list\n"
+           "Options:\n"
+           "    /d:file.dll  : Add file.dll to binary files\n"
+           "    /r           : Remove extra DLLs (and the /g payload) from binary files\n"
+           "    /g:guid      : Payload GUID, as xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx\n"
+           "    /p:file      : Stamp the contents of file as the /g payload\n"
+           "    /t:threads   : Number of worker threads (default: one per processor)\n"
+           "    /v           : Report each file as it completes\n"
+           "    /?           : This help screen.\n");
+}
+
+//////////////////////////////////////////////////////////////////////// main.
+//
+int CDECL main(int argc, char **argv)
+{
+    BOOL fNeedHelp = FALSE;
+    BOOL fHaveGuid = FALSE;
+    PCHAR pszPayload = NULL;
+    PCHAR pszFilePart = NULL;
+    LONG nThreads = 0;
+
+    int arg = 1;
+    for (; arg < argc; arg++) {
+        if (argv[arg][0] == '-' || argv[arg][0] == '/') {
+            CHAR *argn = argv[arg] + 1;
+            CHAR *argp = argn;
+            while (*argp && *argp != ':' && *argp != '=')
+                argp++;
+            if (*argp == ':' || *argp == '=')
+                *argp++ = '\0';
+
+            switch (argn[0]) {
+
+              case 'd':                                 // Set DLL
+              case 'D':
+                if ((strchr(argp, ':') != NULL || strchr(argp, '\\') != NULL) &&
+                    GetFullPathNameA(argp, sizeof(s_szDllPath), s_szDllPath, &pszFilePart)) {
+                }
+                else {
+                    StringCchPrintfA(s_szDllPath, sizeof(s_szDllPath), "%s", argp);
+                }
+                break;
+
+              case 'g':                                 // Payload GUID
+              case 'G':
+                if (!ParseGuid(argp, &s_guidPayload)) {
+                    fNeedHelp = TRUE;
+                    printf("Bad GUID: %s\n", argp);
+                }
+                fHaveGuid = TRUE;
+                break;
+
+              case 'p':                                 // Payload file
+              case 'P':
+                pszPayload = argp;
+                break;
+
+              case 'r':                                 // Remove extra set DLLs.
+              case 'R':
+                s_fRemove = TRUE;
+                break;
+
+              case 't':                                 // Worker threads
+              case 'T':
+                nThreads = atol(argp);
+                break;
+
+              case 'v':                                 // Verbose
+              case 'V':
+                s_fVerbose = TRUE;
+                break;
+
+              case '?':                                 // Help
+                fNeedHelp = TRUE;
+                break;
+
+              default:
+                fNeedHelp = TRUE;
+                printf("Bad argument: %s:%s\n", argn, argp);
+                break;
+            }
+        }
+        else if (argv[arg][0] == '@') {
+            if (!AddJobsFromFile(argv[arg] + 1)) {
+                return 3;
+            }
+        }
+        else {
+            if (!AddJob(argv[arg])) {
+                return 3;
+            }
+        }
+    }
+    if (s_nJobs == 0) {
+        fNeedHelp = TRUE;
+    }
+    if (!s_fRemove && s_szDllPath[0] == 0) {
+        fNeedHelp = TRUE;
+    }
+    if (pszPayload != NULL && !fHaveGuid) {
+        fNeedHelp = TRUE;
+    }
+    if (fNeedHelp) {
+        PrintUsage();
+        return 1;
+    }
+
+    if (s_fRemove) {
+        printf("Removing extra DLLs from %d binary files.\n", s_nJobs);
+        s_fPayload = fHaveGuid;
+    }
+    else {
+        if (!DoesDllExportOrdinal1(s_szDllPath)) {
+            printf("Error: %hs does not export function with ordinal #1.\n",
+                   s_szDllPath);
+            return 2;
+        }
+        printf("Adding %hs to %d binary files.\n", s_szDllPath, s_nJobs);
+
+        if (pszPayload != NULL) {
+            if (!ReadPayload(pszPayload)) {
+                return 2;
+            }
+            s_fPayload = TRUE;
+        }
+    }
+
+    if (nThreads <= 0) {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        nThreads = si.dwNumberOfProcessors;
+    }
+    if (nThreads > s_nJobs) {
+        nThreads = s_nJobs;
+    }
+
+    SETDLLS_WORKER *pWorkers = (SETDLLS_WORKER *)calloc(nThreads, sizeof(SETDLLS_WORKER));
+    if (pWorkers == NULL) {
+        printf("setdlls.exe: Out of memory.\n");
+        return 3;
+    }
+
+    DWORD dwStart = GetTickCount();
+
+    LONG nStarted = 0;
+    for (; nStarted < nThreads; nStarted++) {
+        pWorkers[nStarted].hThread = CreateThread(NULL, 0, WorkerThread,
+                                                  &pWorkers[nStarted], 0, NULL);
+        if (pWorkers[nStarted].hThread == NULL) {
+            printf("setdlls.exe: CreateThread failed: %d\n", GetLastError());
+            break;
+        }
+    }
+    if (nStarted == 0) {
+        WorkerThread(&pWorkers[0]);
+    }
+    for (LONG n = 0; n < nStarted; n++) {
+        WaitForSingleObject(pWorkers[n].hThread, INFINITE);
+        CloseHandle(pWorkers[n].hThread);
+    }
+
+    DWORD dwElapsed = GetTickCount() - dwStart;
+
+    ////////////////////////////////////////////////////////////////// Report.
+    //
+    LONG nGood = 0;
+    ULONGLONG cbIn = 0;
+    ULONGLONG cbOut = 0;
+    for (LONG n = 0; n < s_nJobs; n++) {
+        if (s_pJobs[n].fGood) {
+            nGood++;
+            cbIn += s_pJobs[n].cbIn;
+            cbOut += s_pJobs[n].cbOut;
+        }
+    }
+
+    if (nGood != s_nJobs) {
+        printf("Failed:\n");
+        for (LONG n = 0; n < s_nJobs; n++) {
+            if (!s_pJobs[n].fGood) {
+                printf("  %s: %s failed: %d\n",
+                       s_pJobs[n].pszPath, s_pJobs[n].pszFailed, s_pJobs[n].dwError);
+            }
+        }
+    }
+
+    printf("%d of %d files updated (%I64u -> %I64u bytes) in %d.%03d seconds"
+           " on %d threads.\n",
+           nGood, s_nJobs, cbIn, cbOut,
+           dwElapsed / 1000, dwElapsed % 1000,
+           nStarted ? nStarted : 1);
+
+    for (LONG n = 0; n < s_nJobs; n++) {
+        free(s_pJobs[n].pszPath);
+    }
+    free(s_pJobs);
+    free(pWorkers);
+    free(s_pbPayload);
+
+    return (nGood == s_nJobs) ? 0 : 4;
+}
+
+// End of File
@@ -76,10 +76,83 @@ extern "C" {
         = LeaveCriticalSection;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+//
+// Benchmark: /t:threads threads each log /n:count messages as fast as they can.
+// The message mimics a traceapi.dll call record; /d defers its formatting.
+//
+static LONG     s_nMessages = 1000;
+static HANDLE   s_hStart = NULL;
+
+static DWORD WINAPI BenchThread(LPVOID pvThread)
+{
+    LONG nThread = (LONG)(LONG_PTR)pvThread;
+
+    WaitForSingleObject(s_hStart, INFINITE);
+    for (LONG n = 0; n < s_nMessages; n++) {
+        Syelog(SYELOG_SEVERITY_DEBUG, "%03d +CreateFileW(%ls,%x,%x,%p,%x,%x,%p) #%d",
+               nThread, L"C:\\Windows\\System32\\kernel32.dll",
+               GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+               FILE_ATTRIBUTE_NORMAL, NULL, n);
+    }
+    return 0;
+}
+
+static BOOL Bench(LONG nThreads)
+{
+    HANDLE rhThreads[MAXIMUM_WAIT_OBJECTS];
+    LARGE_INTEGER liFrequency;
+    LARGE_INTEGER liBeg;
+    LARGE_INTEGER liEnd;
+    LONG nCreated = 0;
+
+    s_hStart = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (s_hStart == NULL) {
+        printf("SLTEST: CreateEvent failed: %ld\n", GetLastError());
+        return FALSE;
+    }
+
+    for (; nCreated < nThreads; nCreated++) {
+        rhThreads[nCreated] = CreateThread(NULL, 0, BenchThread,
+                                           (LPVOID)(LONG_PTR)nCreated, 0, NULL);
+        if (rhThreads[nCreated] == NULL) {
+            printf("SLTEST: CreateThread failed: %ld\n", GetLastError());
+            break;
+        }
+    }
+
+    QueryPerformanceFrequency(&liFrequency);
+    QueryPerformanceCounter(&liBeg);
+    SetEvent(s_hStart);
+    if (nCreated > 0) {
+        WaitForMultipleObjects(nCreated, rhThreads, TRUE, INFINITE);
+    }
+    QueryPerformanceCounter(&liEnd);
+
+    for (LONG n = 0; n < nCreated; n++) {
+        CloseHandle(rhThreads[n]);
+    }
+    CloseHandle(s_hStart);
+    s_hStart = NULL;
+
+    double flSeconds = (double)(liEnd.QuadPart - liBeg.QuadPart) /
+        (double)liFrequency.QuadPart;
+    double flTotal = (double)nCreated * (double)s_nMessages;
+
+    printf("SLTEST: %ld threads x %ld messages in %.3f seconds (%.0f messages/sec).\n",
+           nCreated, s_nMessages, flSeconds,
+           flSeconds > 0 ? flTotal / flSeconds : 0.0);
+    printf("SLTEST: %.0f ns per message per thread.\n",
+           flTotal > 0 ? flSeconds * 1e9 * nCreated / flTotal : 0.0);
+    return nCreated == nThreads;
+}
+
 int main(int argc, char **argv)
 {
     BOOL fNeedHelp = FALSE;
     BOOL fRequestExitOnClose = FALSE;
+    BOOL fDeferFormatting = FALSE;
+    LONG nThreads = 0;
 
     int arg = 1;
     for (; arg < argc && (argv[arg][0] == '-' || argv[arg][0] == '/'); arg++) {
@@ -94,6 +167,28 @@ int main(int argc, char **argv)
 
         switch (argn[0]) {
 
+          case 'd':                                 // Defer formatting to syelogd.
+          case 'D':
+            fDeferFormatting = TRUE;
+            break;
+
+          case 'n':                                 // Messages per thread.
+          case 'N':
+            s_nMessages = atol(argp);
+            if (s_nMessages <= 0) {
+                fNeedHelp = TRUE;
+            }
+            break;
+
+          case 't':                                 // Benchmark threads.
+          case 'T':
+            nThreads = atol(argp);
+            if (nThreads <= 0 || nThreads > MAXIMUM_WAIT_OBJECTS) {
+                printf("SLTEST: Thread count must be 1 to %d.\n", MAXIMUM_WAIT_OBJECTS);
+                fNeedHelp = TRUE;
+            }
+            break;
+
           case 'x':                                 // Request exit on close.
           case 'X':
             fRequestExitOnClose = TRUE;
@@ -114,6 +209,9 @@ int main(int argc, char **argv)
         printf("Usage:\n"
                "    sltest.exe [options] message\n"
                "Options:\n"
+               "    /d         Send deferred messages; syelogd.exe formats them.\n"
+               "    /t:threads Benchmark: log from this many threads (1 to 64).\n"
+               "    /n:count   Benchmark: messages per thread (default 1000).\n"
                "    /x         Ask syelogd.exe to terminate when this connect closes.\n"
                "    /?         Display this help message.\n"
                "\n");
@@ -121,7 +219,11 @@ int main(int argc, char **argv)
     }
 
     SyelogOpen("sltest", SYELOG_FACILITY_APPLICATION);
-    if (arg >= argc) {
+    SyelogDeferFormatting(fDeferFormatting);
+    if (nThreads > 0) {
+        Bench(nThreads);
+    }
+    else if (arg >= argc) {
         Syelog(SYELOG_SEVERITY_INFORMATION, "Hello World! [1 of 4]");
         Syelog(SYELOG_SEVERITY_INFORMATION, "Hello World! [2 of 4]");
         Syelog(SYELOG_SEVERITY_INFORMATION, "Hello World! [3 of 4]");
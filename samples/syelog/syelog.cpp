@@ -272,12 +272,113 @@ static PCHAR do_ewstr(PCHAR pszOut, PCHAR pszEnd, PCWSTR pszIn)
     return pszOut;
 }
 
+// The formatter takes its arguments either from the caller's va_list or,
+// for SYELOG_FORMAT_DEFERRED messages, from the words packed after the
+// format string (see syelog.h).
+//
+typedef struct _SYELOG_ARGS
+{
+    va_list     args;                   // Caller's arguments, if pbNext is NULL.
+    PBYTE       pbNext;                 // Next packed argument.
+    PBYTE       pbEnd;
+} SYELOG_ARGS, *PSYELOG_ARGS;
+
+static UINT64 syelogNextWord(PSYELOG_ARGS pArgs)
+{
+    UINT64 nValue = 0;
+
+    if (pArgs->pbEnd - pArgs->pbNext >= (LONG_PTR)sizeof(nValue)) {
+        CopyMemory(&nValue, pArgs->pbNext, sizeof(nValue));
+        pArgs->pbNext += sizeof(nValue);
+    }
+    else {
+        pArgs->pbNext = pArgs->pbEnd;
+    }
+    return nValue;
+}
+
+static INT syelogNextInt(PSYELOG_ARGS pArgs)
+{
+    if (pArgs->pbNext == NULL) {
+        return va_arg(pArgs->args, INT);
+    }
+    return (INT)syelogNextWord(pArgs);
+}
+
+static UINT64 syelogNextNumber(PSYELOG_ARGS pArgs, BOOL f64Bit)
+{
+    if (pArgs->pbNext == NULL) {
+        if (f64Bit) {
+            return va_arg(pArgs->args, UINT64);
+        }
+        return va_arg(pArgs->args, UINT);
+    }
+    return syelogNextWord(pArgs);
+}
+
+static ULONG_PTR syelogNextPointer(PSYELOG_ARGS pArgs)
+{
+    if (pArgs->pbNext == NULL) {
+        return va_arg(pArgs->args, ULONG_PTR);
+    }
+    return (ULONG_PTR)syelogNextWord(pArgs);
+}
+
+// Returns the string to print and its original address in *pnValue.  For a
+// packed string, returns NULL if the address is below 0x10000 or the copy
+// is missing or faulted.
+//
+static PVOID syelogNextString(PSYELOG_ARGS pArgs, BOOL fLarge, UINT64 *pnValue)
+{
+    if (pArgs->pbNext == NULL) {
+        PVOID pvData = va_arg(pArgs->args, PVOID);
+        *pnValue = (UINT64)(ULONG_PTR)pvData;
+        return pvData;
+    }
+
+    *pnValue = syelogNextWord(pArgs);
+    if (*pnValue < 0x10000) {
+        return NULL;
+    }
+
+    DWORD cbData = 0;
+    if (pArgs->pbEnd - pArgs->pbNext < (LONG_PTR)sizeof(cbData)) {
+        pArgs->pbNext = pArgs->pbEnd;
+        return NULL;
+    }
+    CopyMemory(&cbData, pArgs->pbNext, sizeof(cbData));
+    pArgs->pbNext += sizeof(cbData);
+
+    if (cbData == SYELOG_STRING_FAULTED) {
+        return NULL;
+    }
+    if (cbData > (DWORD)(pArgs->pbEnd - pArgs->pbNext)) {
+        pArgs->pbNext = pArgs->pbEnd;
+        return NULL;
+    }
+
+    PBYTE pbData = pArgs->pbNext;
+    pArgs->pbNext += cbData;
+
+    // Only trust a copy that ends with its terminator.
+    if (fLarge) {
+        if (cbData < sizeof(WCHAR) || (cbData % sizeof(WCHAR)) != 0 ||
+            pbData[cbData - 1] != 0 || pbData[cbData - 2] != 0) {
+            return NULL;
+        }
+    }
+    else if (cbData < sizeof(CHAR) || pbData[cbData - 1] != 0) {
+        return NULL;
+    }
+    return pbData;
+}
+
 #if _MSC_VER >= 1900
 #pragma warning(push)
 #pragma warning(disable:4456) // declaration hides previous local declaration
 #endif
 
-VOID VSafePrintf(PCSTR pszMsg, va_list args, PCHAR pszBuffer, LONG cbBuffer)
+static VOID syelogFormat(PCSTR pszMsg, PSYELOG_ARGS pArgs, PCHAR pszBuffer, LONG cbBuffer)
 {
     PCHAR pszOut = pszBuffer;
     PCHAR pszEnd = pszBuffer + cbBuffer - 1;
@@ -318,7 +419,7 @@ VOID VSafePrintf(PCSTR pszMsg, va_list args, PCHAR pszBuffer, LONG cbBuffer)
                 }
 
                 if (*pszMsg == '*') {
-                    nWidth = va_arg(args, INT);
+                    nWidth = syelogNextInt(pArgs);
                     pszMsg++;
                 }
                 else {
@@ -330,7 +431,7 @@ VOID VSafePrintf(PCSTR pszMsg, va_list args, PCHAR pszBuffer, LONG cbBuffer)
                     pszMsg++;
                     fDigit = TRUE;
                     if (*pszMsg == '*') {
-                        nPrecision = va_arg(args, INT);
+                        nPrecision = syelogNextInt(pArgs);
                         pszMsg++;
                     }
                     else {
@@ -358,24 +459,32 @@ VOID VSafePrintf(PCSTR pszMsg, va_list args, PCHAR pszBuffer, LONG cbBuffer)
                     // to avoid using a temporary buffer.
 
                     if (*pszMsg == 's') { // [GalenH] need to not use temp.
-                        PVOID pvData = va_arg(args, PVOID);
-
                         pszMsg++;
 
                         if (fSmall) {
                             fLarge = FALSE;
                         }
 
+                        UINT64 nValue = 0;
+                        PVOID pvData = syelogNextString(pArgs, fLarge, &nValue);
+
                         __try {
-                            if (pvData == NULL) {
+                            if (nValue == 0) {
                                 pszOut = do_str(pszOut, pszEnd, "<NULL>");
                             }
-                            else if (pvData < (PVOID)0x10000) {
+                            else if (nValue < 0x10000) {
                                 pszOut = do_str(pszOut, pszEnd, "#");
-                                pszOut = do_base(pszOut, (UINT64)pvData, 16,
+                                pszOut = do_base(pszOut, nValue, 16,
                                              "0123456789ABCDEF");
                                 pszOut = do_str(pszOut, pszEnd, "#");
                             }
+                            else if (pvData == NULL) {
+                                // Faulted when the message was packed.
+                                pszOut = do_str(pszOut, pszEnd, "-");
+                                pszOut = do_base(pszOut, nValue, 16,
+                                             "0123456789ABCDEF");
+                                pszOut = do_str(pszOut, pszEnd, "-");
+                            }
                             else if (fLarge) {
                                 pszOut = do_wstr(pszOut, pszEnd, (PWCHAR)pvData);
                             }
@@ -384,30 +493,38 @@ VOID VSafePrintf(PCSTR pszMsg, va_list args, PCHAR pszBuffer, LONG cbBuffer)
                             }
                         } __except(EXCEPTION_EXECUTE_HANDLER) {
                             pszOut = do_str(pszOut, pszEnd, "-");
-                            pszOut = do_base(pszOut, (UINT64)pvData, 16,
+                            pszOut = do_base(pszOut, nValue, 16,
                                              "0123456789ABCDEF");
                             pszOut = do_str(pszOut, pszEnd, "-");
                         }
                     }
                     else if (*pszMsg == 'e')    {   // Escape the string.
-                        PVOID pvData = va_arg(args, PVOID);
-
                         pszMsg++;
 
                         if (fSmall) {
                             fLarge = FALSE;
                         }
 
+                        UINT64 nValue = 0;
+                        PVOID pvData = syelogNextString(pArgs, fLarge, &nValue);
+
                         __try {
-                            if (pvData == NULL) {
+                            if (nValue == 0) {
                                 pszOut = do_str(pszOut, pszEnd, "<NULL>");
                             }
-                            else if (pvData < (PVOID)0x10000) {
+                            else if (nValue < 0x10000) {
                                 pszOut = do_str(pszOut, pszEnd, ">");
-                                pszOut = do_base(pszOut, (UINT64)pvData, 16,
+                                pszOut = do_base(pszOut, nValue, 16,
                                              "0123456789ABCDEF");
                                 pszOut = do_str(pszOut, pszEnd, ">");
                             }
+                            else if (pvData == NULL) {
+                                // Faulted when the message was packed.
+                                pszOut = do_str(pszOut, pszEnd, "-");
+                                pszOut = do_base(pszOut, nValue, 16,
+                                             "0123456789ABCDEF");
+                                pszOut = do_str(pszOut, pszEnd, "-");
+                            }
                             else if (fLarge) {
                                 pszOut = do_ewstr(pszOut, pszEnd, (PWCHAR)pvData);
                             }
@@ -416,7 +533,7 @@ VOID VSafePrintf(PCSTR pszMsg, va_list args, PCHAR pszBuffer, LONG cbBuffer)
                             }
                         } __except(EXCEPTION_EXECUTE_HANDLER) {
                             pszOut = do_str(pszOut, pszEnd, "-");
-                            pszOut = do_base(pszOut, (UINT64)pvData, 16,
+                            pszOut = do_base(pszOut, nValue, 16,
                                              "0123456789ABCDEF");
                             pszOut = do_str(pszOut, pszEnd, "-");
                         }
@@ -425,7 +542,7 @@ VOID VSafePrintf(PCSTR pszMsg, va_list args, PCHAR pszBuffer, LONG cbBuffer)
                         CHAR szTemp[2];
                         pszMsg++;
 
-                        szTemp[0] = (CHAR)va_arg(args, INT);
+                        szTemp[0] = (CHAR)syelogNextInt(pArgs);
                         szTemp[1] = '\0';
                         pszOut = do_str(pszOut, pszEnd, szTemp);
                     }
@@ -435,12 +552,7 @@ VOID VSafePrintf(PCSTR pszMsg, va_list args, PCHAR pszBuffer, LONG cbBuffer)
                          *pszMsg == 'u') {
                     CHAR szTemp[128];
                     UINT64 value;
-                    if (f64Bit) {
-                        value = va_arg(args, UINT64);
-                    }
-                    else {
-                        value = va_arg(args, UINT);
-                    }
+                    value = syelogNextNumber(pArgs, f64Bit);
 
                     if (*pszMsg == 'x') {
                         pszMsg++;
@@ -559,7 +671,7 @@ VOID VSafePrintf(PCSTR pszMsg, va_list args, PCHAR pszBuffer, LONG cbBuffer)
                 else if (*pszMsg == 'p') {
                     CHAR szTemp[64];
                     ULONG_PTR value;
-                    value = va_arg(args, ULONG_PTR);
+                    value = syelogNextPointer(pArgs);
 
                     if ((INT64)value == (INT64)-1 ||
                         (INT64)value == (INT64)-2) {
@@ -603,7 +715,9 @@ VOID VSafePrintf(PCSTR pszMsg, va_list args, PCHAR pszBuffer, LONG cbBuffer)
                     pszOut = do_str(pszOut, pszEnd, szTemp);
                 }
                 else {
-                    pszMsg++;
+                    if (*pszMsg) {
+                        pszMsg++;
+                    }
                     while (pszArg < pszMsg && pszOut < pszEnd) {
                         *pszOut++ = *pszArg++;
                     }
@@ -630,6 +744,17 @@ VOID VSafePrintf(PCSTR pszMsg, va_list args, PCHAR pszBuffer, LONG cbBuffer)
 #pragma warning(pop)
 #endif
 
+VOID VSafePrintf(PCSTR pszMsg, va_list args, PCHAR pszBuffer, LONG cbBuffer)
+{
+    SYELOG_ARGS Args;
+
+    va_copy(Args.args, args);
+    Args.pbNext = NULL;
+    Args.pbEnd = NULL;
+    syelogFormat(pszMsg, &Args, pszBuffer, cbBuffer);
+    va_end(Args.args);
+}
+
 PCHAR SafePrintf(PCHAR pszBuffer, LONG cbBuffer, PCSTR pszMsg, ...)
 {
     va_list args;
@@ -643,15 +768,253 @@ PCHAR SafePrintf(PCHAR pszBuffer, LONG cbBuffer, PCSTR pszMsg, ...)
     return pszBuffer;
 }
 
+//////////////////////////////////////////////////////// Deferred Formatting.
+//
+// Packs the arguments of a SYELOG_FORMAT_DEFERRED message (see syelog.h)
+// so that the formatting happens in the reader, not the logging thread.
+// Each function returns pszEnd once the message is full.
+//
+static PCHAR syelogDeferWord(PCHAR pszOut, PCHAR pszEnd, UINT64 nValue)
+{
+    if (pszEnd - pszOut < (LONG_PTR)sizeof(nValue)) {
+        return pszEnd;
+    }
+    CopyMemory(pszOut, &nValue, sizeof(nValue));
+    return pszOut + sizeof(nValue);
+}
+
+static PCHAR syelogDeferString(PCHAR pszOut, PCHAR pszEnd, PVOID pvData, BOOL fLarge)
+{
+    pszOut = syelogDeferWord(pszOut, pszEnd, (UINT64)(ULONG_PTR)pvData);
+    if (pvData < (PVOID)0x10000) {
+        return pszOut;
+    }
+    if (pszEnd - pszOut < (LONG_PTR)(sizeof(DWORD) + sizeof(WCHAR))) {
+        return pszEnd;
+    }
+
+    PCHAR pszCount = pszOut;
+    PCHAR pszData = pszOut + sizeof(DWORD);
+    DWORD cbData;
+
+    pszOut = pszData;
+    __try {
+        if (fLarge) {
+            PCWSTR pwzIn = (PCWSTR)pvData;
+            while (*pwzIn && pszEnd - pszOut >= (LONG_PTR)(2 * sizeof(WCHAR))) {
+                CopyMemory(pszOut, pwzIn++, sizeof(WCHAR));
+                pszOut += sizeof(WCHAR);
+            }
+            *pszOut++ = '\0';
+            *pszOut++ = '\0';
+        }
+        else {
+            PCSTR pszIn = (PCSTR)pvData;
+            while (*pszIn && pszOut < pszEnd - 1) {
+                *pszOut++ = *pszIn++;
+            }
+            *pszOut++ = '\0';
+        }
+        cbData = (DWORD)(pszOut - pszData);
+    } __except(EXCEPTION_EXECUTE_HANDLER) {
+        cbData = SYELOG_STRING_FAULTED;
+        pszOut = pszData;
+    }
+    CopyMemory(pszCount, &cbData, sizeof(cbData));
+    return pszOut;
+}
+
+// Walks the format the way syelogFormat does, packing each argument it
+// would consume.
+//
+static PCHAR syelogDefer(PCSTR pszIdent, PCSTR pszMsg, va_list args,
+                         PCHAR pszOut, PCHAR pszEnd)
+{
+    do {
+        if (pszOut >= pszEnd) {
+            return pszEnd;
+        }
+    } while ((*pszOut++ = *pszIdent++) != '\0');
+
+    PCSTR pszFormat = pszMsg;
+    do {
+        if (pszOut >= pszEnd) {
+            return pszEnd;
+        }
+    } while ((*pszOut++ = *pszFormat++) != '\0');
+
+    while (*pszMsg && pszOut < pszEnd) {
+        if (*pszMsg++ != '%') {
+            continue;
+        }
+
+        BOOL fSmall = FALSE;
+        BOOL fLarge = FALSE;
+        BOOL f64Bit = FALSE;
+
+        while (*pszMsg == '-' || *pszMsg == '+' || *pszMsg == '#' ||
+               *pszMsg == ' ' || *pszMsg == '0') {
+            pszMsg++;
+        }
+        if (*pszMsg == '*') {
+            pszOut = syelogDeferWord(pszOut, pszEnd, (UINT64)(INT64)va_arg(args, INT));
+            pszMsg++;
+        }
+        else {
+            while (*pszMsg >= '0' && *pszMsg <= '9') {
+                pszMsg++;
+            }
+        }
+        if (*pszMsg == '.') {
+            pszMsg++;
+            if (*pszMsg == '*') {
+                pszOut = syelogDeferWord(pszOut, pszEnd, (UINT64)(INT64)va_arg(args, INT));
+                pszMsg++;
+            }
+            else {
+                while (*pszMsg >= '0' && *pszMsg <= '9') {
+                    pszMsg++;
+                }
+            }
+        }
+
+        if (*pszMsg == 'h') {
+            fSmall = TRUE;
+            pszMsg++;
+        }
+        else if (*pszMsg == 'l') {
+            fLarge = TRUE;
+            pszMsg++;
+        }
+        else if (*pszMsg == 'I' && pszMsg[1] == '6' && pszMsg[2] == '4') {
+            f64Bit = TRUE;
+            pszMsg += 3;
+        }
+
+        switch (*pszMsg) {
+          case 's':
+          case 'e':
+            pszOut = syelogDeferString(pszOut, pszEnd, va_arg(args, PVOID),
+                                       fLarge && !fSmall);
+            break;
+
+          case 'c':
+            pszOut = syelogDeferWord(pszOut, pszEnd, (UINT64)(INT64)va_arg(args, INT));
+            break;
+
+          case 'd': case 'i': case 'o': case 'x': case 'X': case 'b': case 'u':
+            if (f64Bit) {
+                pszOut = syelogDeferWord(pszOut, pszEnd, va_arg(args, UINT64));
+            }
+            else {
+                pszOut = syelogDeferWord(pszOut, pszEnd, va_arg(args, UINT));
+            }
+            break;
+
+          case 'p':
+            pszOut = syelogDeferWord(pszOut, pszEnd, va_arg(args, ULONG_PTR));
+            break;
+
+          case '\0':
+            return pszOut;
+        }
+        pszMsg++;
+    }
+    return pszOut;
+}
+
+BOOL SyelogFormatMessage(PSYELOG_MESSAGE pMessage, DWORD nBytes, PSYELOG_MESSAGE pText)
+{
+    if (nBytes > pMessage->nBytes) {
+        nBytes = pMessage->nBytes;
+    }
+    if (nBytes > sizeof(*pMessage)) {
+        nBytes = sizeof(*pMessage);
+    }
+    if (nBytes <= offsetof(SYELOG_MESSAGE, szMessage) ||
+        pMessage->nFormat != SYELOG_FORMAT_DEFERRED) {
+        return FALSE;
+    }
+
+    PBYTE pbEnd = (PBYTE)pMessage + nBytes;
+    PCSTR pszIdent = pMessage->szMessage;
+    PCSTR pszFormat = pszIdent;
+
+    for (; (PBYTE)pszFormat < pbEnd && *pszFormat; pszFormat++) {
+        // Find the end of the identifier.
+    }
+    if ((PBYTE)++pszFormat >= pbEnd) {
+        return FALSE;
+    }
+    PCSTR pszArgs = pszFormat;
+    for (; (PBYTE)pszArgs < pbEnd && *pszArgs; pszArgs++) {
+        // Find the end of the format.
+    }
+    if ((PBYTE)pszArgs++ >= pbEnd) {
+        return FALSE;
+    }
+
+    SYELOG_ARGS Args;
+    ZeroMemory(&Args, sizeof(Args));
+    Args.pbNext = (PBYTE)pszArgs;
+    Args.pbEnd = pbEnd;
+
+    pText->nFacility = pMessage->nFacility;
+    pText->nSeverity = pMessage->nSeverity;
+    pText->nProcessId = pMessage->nProcessId;
+    pText->ftOccurance = pMessage->ftOccurance;
+    pText->fTerminate = pMessage->fTerminate;
+    pText->nFormat = SYELOG_FORMAT_TEXT;
+    pText->nReserved = 0;
+
+    PCHAR pszOut = pText->szMessage;
+    PCHAR pszEnd = pText->szMessage + ARRAYSIZE(pText->szMessage) - 1;
+    pszOut = do_str(pszOut, pszEnd, pszIdent);
+    syelogFormat(pszFormat, &Args, pszOut, (LONG)(pszEnd - pszOut + 1));
+
+    for (; *pszOut; pszOut++) {
+        // no internal contents.
+    }
+    pText->nBytes = (USHORT)(pszOut + 1 - ((PCSTR)pText));
+    return TRUE;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
-static CRITICAL_SECTION s_csPipe;                       // Guards access to hPipe.
+// Messages queue in a fixed ring of slots, a bounded multi-producer queue in
+// which each slot's sequence number says whose turn it is.  A caller formats
+// its message on the stack, claims a slot with a compare-exchange on
+// s_nEnqueue, copies the message in, and publishes it by bumping the
+// sequence.  The caller that then finds s_fFlushing clear becomes the
+// flusher: it packs every published message into one batch and writes it to
+// the pipe.  Everyone else returns at once, so only the flusher ever waits
+// on the pipe.
+//
+// s_csFlush guards the pipe, the batch, and s_nDequeue; s_fFlushing just
+// lets callers skip it when another thread is already flushing.
+//
+#define SYELOG_RING_SLOTS       64                      // Power of two.
+
+struct SYELOG_SLOT
+{
+    volatile LONG   nSequence;
+    SYELOG_MESSAGE  Message;
+};
+
+static SYELOG_SLOT      s_rSlots[SYELOG_RING_SLOTS];
+static volatile LONG    s_nEnqueue = 0;                 // Next slot to claim.
+static volatile LONG    s_nDequeue = 0;                 // Next slot to flush.
+static volatile LONG    s_fFlushing = FALSE;            // Someone is flushing.
+static CRITICAL_SECTION s_csFlush;                      // Guards hPipe and the batch.
+static BYTE             s_rbBatch[SYELOG_MAXIMUM_BATCH];
+
 static HANDLE           s_hPipe = INVALID_HANDLE_VALUE;
 static DWORD            s_nPipeError = 0;
 static FILETIME         s_ftRetry = {0,0};
 static BYTE             s_nFacility = SYELOG_FACILITY_APPLICATION;
 static CHAR             s_szIdent[256] = "";
 static DWORD            s_nProcessId = 0;
+static BOOL             s_fDeferred = FALSE;
 
 static inline INT syelogCompareTimes(CONST PFILETIME pft1, CONST PFILETIME pft2)
 {
@@ -723,9 +1086,153 @@ static BOOL syelogIsOpen(PFILETIME pftLog)
     return FALSE;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+//
+static VOID syelogWrite(PVOID pvBatch, DWORD cbBatch, PFILETIME pftLog)
+{
+    DWORD cbWritten = 0;
+
+    if (syelogIsOpen(pftLog)) {
+        if (!Real_WriteFile(s_hPipe, pvBatch, cbBatch, &cbWritten, NULL)) {
+            s_nPipeError = GetLastError();
+            if (s_nPipeError == ERROR_BAD_IMPERSONATION_LEVEL) {
+                // Don't close the file just for a temporary impersonation level.
+            }
+            else {
+                if (s_hPipe != INVALID_HANDLE_VALUE) {
+                    Real_CloseHandle(s_hPipe);
+                    s_hPipe = INVALID_HANDLE_VALUE;
+                }
+                if (syelogIsOpen(pftLog)) {
+                    Real_WriteFile(s_hPipe, pvBatch, cbBatch, &cbWritten, NULL);
+                }
+            }
+        }
+    }
+}
+
+static inline BOOL syelogIsPublished(LONG nPosition)
+{
+    return s_rSlots[nPosition & (SYELOG_RING_SLOTS - 1)].nSequence == nPosition + 1;
+}
+
+// Writes every published message in order.  Caller holds s_csFlush.
+//
+static VOID syelogDrain()
+{
+    FILETIME ftFirst = {0,0};
+    DWORD cbBatch = 0;
+
+    for (;;) {
+        LONG nPosition = s_nDequeue;
+        SYELOG_SLOT *pSlot = &s_rSlots[nPosition & (SYELOG_RING_SLOTS - 1)];
+
+        if (!syelogIsPublished(nPosition)) {
+            break;
+        }
+        MemoryBarrier();                                // Read the slot after its sequence.
+        if (cbBatch + pSlot->Message.nBytes > sizeof(s_rbBatch)) {
+            syelogWrite(s_rbBatch, cbBatch, &ftFirst);
+            cbBatch = 0;
+        }
+        if (cbBatch == 0) {
+            ftFirst = pSlot->Message.ftOccurance;
+        }
+
+        CopyMemory(s_rbBatch + cbBatch, &pSlot->Message, pSlot->Message.nBytes);
+        cbBatch += pSlot->Message.nBytes;
+
+        s_nDequeue = nPosition + 1;
+        InterlockedExchange(&pSlot->nSequence, nPosition + SYELOG_RING_SLOTS);
+    }
+
+    if (cbBatch > 0) {
+        syelogWrite(s_rbBatch, cbBatch, &ftFirst);
+    }
+}
+
+// Drains the ring, unless another thread is already doing so.  That thread
+// rechecks the ring after it lets go, so nothing is stranded.
+//
+static VOID syelogFlush()
+{
+    for (;;) {
+        if (InterlockedCompareExchange(&s_fFlushing, TRUE, FALSE) != FALSE) {
+            return;
+        }
+
+        Real_EnterCriticalSection(&s_csFlush);
+        syelogDrain();
+        Real_LeaveCriticalSection(&s_csFlush);
+
+        InterlockedExchange(&s_fFlushing, FALSE);
+
+        if (!syelogIsPublished(s_nDequeue)) {
+            return;
+        }
+    }
+}
+
+// Claims the next free slot, or returns NULL if the ring is full.
+//
+static SYELOG_SLOT * syelogTryClaim(PLONG pnPosition)
+{
+    for (;;) {
+        LONG nPosition = s_nEnqueue;
+        SYELOG_SLOT *pSlot = &s_rSlots[nPosition & (SYELOG_RING_SLOTS - 1)];
+        LONG nDiff = pSlot->nSequence - nPosition;
+
+        if (nDiff < 0) {
+            return NULL;
+        }
+        if (nDiff == 0 &&
+            InterlockedCompareExchange(&s_nEnqueue,
+                                       nPosition + 1, nPosition) == nPosition) {
+            *pnPosition = nPosition;
+            return pSlot;
+        }
+    }
+}
+
+// Only the copy into the ring happens between claiming and publishing a
+// slot.  If the ring is full, wait for the pipe and drain it.  Should a
+// thread preempted in that window still hold the head of the ring, write
+// the message directly rather than spin behind it.
+//
+static VOID syelogEnqueue(PSYELOG_MESSAGE pMessage)
+{
+    LONG nPosition = 0;
+    SYELOG_SLOT *pSlot = syelogTryClaim(&nPosition);
+
+    if (pSlot == NULL) {
+        Real_EnterCriticalSection(&s_csFlush);
+        syelogDrain();
+        pSlot = syelogTryClaim(&nPosition);
+        if (pSlot == NULL) {
+            syelogWrite(pMessage, pMessage->nBytes, &pMessage->ftOccurance);
+        }
+        Real_LeaveCriticalSection(&s_csFlush);
+
+        if (pSlot == NULL) {
+            return;
+        }
+    }
+
+    CopyMemory(&pSlot->Message, pMessage, pMessage->nBytes);
+    InterlockedExchange(&pSlot->nSequence, nPosition + 1);
+
+    syelogFlush();
+}
+
 VOID SyelogOpen(PCSTR pszIdentifier, BYTE nFacility)
 {
-    Real_InitializeCriticalSection(&s_csPipe);
+    Real_InitializeCriticalSection(&s_csFlush);
+
+    s_nEnqueue = 0;
+    s_nDequeue = 0;
+    for (LONG n = 0; n < SYELOG_RING_SLOTS; n++) {
+        s_rSlots[n].nSequence = n;
+    }
 
     if (pszIdentifier) {
         PCHAR pszOut = s_szIdent;
@@ -742,16 +1249,36 @@ VOID SyelogOpen(PCSTR pszIdentifier, BYTE nFacility)
     s_nProcessId = Real_GetCurrentProcessId();
 }
 
+// Leaves formatting to the reader.  Arguments are packed by value, so a
+// deferred message costs a copy of the format and its strings rather than
+// a pass through the formatter.
+//
+VOID SyelogDeferFormatting(BOOL fDefer)
+{
+    s_fDeferred = fDefer;
+}
+
 VOID SyelogExV(BOOL fTerminate, BYTE nSeverity, PCSTR pszMsgf, va_list args)
 {
     SYELOG_MESSAGE Message;
-    DWORD cbWritten = 0;
 
     Real_GetSystemTimeAsFileTime(&Message.ftOccurance);
-    Message.fTerminate = fTerminate;
+    Message.fTerminate = (BYTE)fTerminate;
     Message.nFacility = s_nFacility;
     Message.nSeverity = nSeverity;
     Message.nProcessId = s_nProcessId;
+    Message.nReserved = 0;
+
+    if (s_fDeferred) {
+        Message.nFormat = SYELOG_FORMAT_DEFERRED;
+        PCHAR pszEnd = syelogDefer(s_szIdent, pszMsgf, args, Message.szMessage,
+                                   Message.szMessage + sizeof(Message.szMessage));
+        Message.nBytes = (USHORT)(pszEnd - ((PCSTR)&Message));
+        syelogEnqueue(&Message);
+        return;
+    }
+
+    Message.nFormat = SYELOG_FORMAT_TEXT;
     PCHAR pszBuf = Message.szMessage;
     PCHAR pszEnd = Message.szMessage + ARRAYSIZE(Message.szMessage) - 1;
     if (s_szIdent[0]) {
@@ -783,27 +1310,7 @@ VOID SyelogExV(BOOL fTerminate, BYTE nSeverity, PCSTR pszMsgf, va_list args)
     }
     Message.nBytes = (USHORT)(pszEnd - ((PCSTR)&Message));
 
-    Real_EnterCriticalSection(&s_csPipe);
-
-    if (syelogIsOpen(&Message.ftOccurance)) {
-        if (!Real_WriteFile(s_hPipe, &Message, Message.nBytes, &cbWritten, NULL)) {
-            s_nPipeError = GetLastError();
-            if (s_nPipeError == ERROR_BAD_IMPERSONATION_LEVEL) {
-                // Don't close the file just for a temporary impersonation level.
-            }
-            else {
-                if (s_hPipe != INVALID_HANDLE_VALUE) {
-                    Real_CloseHandle(s_hPipe);
-                    s_hPipe = INVALID_HANDLE_VALUE;
-                }
-                if (syelogIsOpen(&Message.ftOccurance)) {
-                    Real_WriteFile(s_hPipe, &Message, Message.nBytes, &cbWritten, NULL);
-                }
-            }
-        }
-    }
-
-    Real_LeaveCriticalSection(&s_csPipe);
+    syelogEnqueue(&Message);
 }
 
 VOID SyelogV(BYTE nSeverity, PCSTR pszMsgf, va_list args)
@@ -833,7 +1340,17 @@ VOID SyelogClose(BOOL fTerminate)
         SyelogEx(TRUE, SYELOG_SEVERITY_NOTICE, "Requesting exit on close.\n");
     }
 
-    Real_EnterCriticalSection(&s_csPipe);
+    // Drain whatever other threads have published.  During process detach a
+    // thread may have died between claiming and publishing a slot, or while
+    // it held s_fFlushing, so ignore the flag and give up on any slot that
+    // stays unpublished after a bounded wait.
+    Real_EnterCriticalSection(&s_csFlush);
+
+    syelogDrain();
+    for (DWORD nSpins = 0; s_nDequeue != s_nEnqueue && nSpins < 4096; nSpins++) {
+        YieldProcessor();
+        syelogDrain();
+    }
 
     if (s_hPipe != INVALID_HANDLE_VALUE) {
         Real_FlushFileBuffers(s_hPipe);
@@ -841,7 +1358,7 @@ VOID SyelogClose(BOOL fTerminate)
         s_hPipe = INVALID_HANDLE_VALUE;
     }
 
-    Real_LeaveCriticalSection(&s_csPipe);
+    Real_LeaveCriticalSection(&s_csFlush);
 }
 //
 ///////////////////////////////////////////////////////////////// End of File.
@@ -37,10 +37,32 @@ typedef struct _SYELOG_MESSAGE
     BYTE        nSeverity;
     DWORD       nProcessId;
     FILETIME    ftOccurance;
-    BOOL        fTerminate;
+    BYTE        fTerminate;
+    BYTE        nFormat;                // SYELOG_FORMAT_*
+    USHORT      nReserved;
     CHAR        szMessage[SYELOG_MAXIMUM_MESSAGE];
 } SYELOG_MESSAGE, *PSYELOG_MESSAGE;
 
+// Message Formats.
+//
+// A deferred message is left for the reader to format.  Its szMessage holds
+// the identifier and the format string, each zero terminated, followed by
+// the arguments the format consumes.  Integers, characters, and pointers
+// are 8-byte values.  A string is its 8-byte address; an address of 0x10000
+// or more is followed by a DWORD byte count and a copy of the string,
+// terminator included.  A count of SYELOG_STRING_FAULTED marks a string
+// that could not be read.
+//
+#define SYELOG_FORMAT_TEXT              0x00            // szMessage is text.
+#define SYELOG_FORMAT_DEFERRED          0x01            // Format and arguments.
+
+#define SYELOG_STRING_FAULTED           0xffffffff
+
+// Clients pack consecutive messages into one pipe write of at most this many
+// bytes; each message's nBytes gives the offset of the next.
+//
+#define SYELOG_MAXIMUM_BATCH    65536
+
 
 // Facility Codes.
 //
@@ -80,6 +102,11 @@ VOID SyelogOpen(PCSTR pszIdentifier, BYTE nFacility);
 VOID Syelog(BYTE nSeverity, PCSTR pszMsgf, ...);
 VOID SyelogV(BYTE nSeverity, PCSTR pszMsgf, va_list args);
 VOID SyelogClose(BOOL fTerminate);
+VOID SyelogDeferFormatting(BOOL fDefer);
+
+// Turns a deferred message into text; used by syelogd.exe.
+//
+BOOL SyelogFormatMessage(PSYELOG_MESSAGE pMessage, DWORD nBytes, PSYELOG_MESSAGE pText);
 
 #pragma warning(pop)
 #pragma pack(pop)
@@ -18,6 +18,46 @@
 #pragma warning(pop)
 #include "syelog.h"
 
+// syelog.lib supplies the formatter for deferred messages.
+//
+extern "C" {
+    HANDLE ( WINAPI * Real_CreateFileW)(LPCWSTR a0,
+                                        DWORD a1,
+                                        DWORD a2,
+                                        LPSECURITY_ATTRIBUTES a3,
+                                        DWORD a4,
+                                        DWORD a5,
+                                        HANDLE a6)
+        = CreateFileW;
+    BOOL ( WINAPI * Real_WriteFile)(HANDLE hFile,
+                                    LPCVOID lpBuffer,
+                                    DWORD nNumberOfBytesToWrite,
+                                    LPDWORD lpNumberOfBytesWritten,
+                                    LPOVERLAPPED lpOverlapped)
+        = WriteFile;
+    BOOL ( WINAPI * Real_FlushFileBuffers)(HANDLE hFile)
+        = FlushFileBuffers;
+    BOOL ( WINAPI * Real_CloseHandle)(HANDLE hObject)
+        = CloseHandle;
+    BOOL ( WINAPI * Real_WaitNamedPipeW)(LPCWSTR lpNamedPipeName, DWORD nTimeOut)
+        = WaitNamedPipeW;
+    BOOL ( WINAPI * Real_SetNamedPipeHandleState)(HANDLE hNamedPipe,
+                                                  LPDWORD lpMode,
+                                                  LPDWORD lpMaxCollectionCount,
+                                                  LPDWORD lpCollectDataTimeout)
+        = SetNamedPipeHandleState;
+    DWORD ( WINAPI * Real_GetCurrentProcessId)(VOID)
+        = GetCurrentProcessId;
+    VOID ( WINAPI * Real_GetSystemTimeAsFileTime)(LPFILETIME lpSystemTimeAsFileTime)
+        = GetSystemTimeAsFileTime;
+    VOID ( WINAPI * Real_InitializeCriticalSection)(LPCRITICAL_SECTION lpSection)
+        = InitializeCriticalSection;
+    VOID ( WINAPI * Real_EnterCriticalSection)(LPCRITICAL_SECTION lpSection)
+        = EnterCriticalSection;
+    VOID ( WINAPI * Real_LeaveCriticalSection)(LPCRITICAL_SECTION lpSection)
+        = LeaveCriticalSection;
+}
+
 #if (_MSC_VER < 1299)
 typedef ULONG * PULONG_PTR;
 typedef ULONG ULONG_PTR;
@@ -35,9 +75,45 @@ typedef struct _CLIENT : OVERLAPPED
     HANDLE          hPipe;
     BOOL            fAwaitingAccept;
     PVOID           Zero;
-    SYELOG_MESSAGE  Message;
+    struct _CLIENT *pNextFree;                      // In s_pFreeClients.
+    LONG            nClient;                        // Ties in the output order.
+    LONG            nSequence;                      // ... and within a client.
+    BYTE            rbBatch[SYELOG_MAXIMUM_BATCH];  // One or more SYELOG_MESSAGEs.
+    BYTE            bTerminator;                    // Always zero.
 } CLIENT, *PCLIENT;
 
+//////////////////////////////////////////////////////////////////////////////
+//
+// Worker threads queue each record in the fill buffer.  The writer thread
+// takes the buffer when it fills, or every OUTPUT_FLUSH_INTERVAL ms, sorts
+// its records by time so that concurrent clients interleave in order, and
+// writes them out in large chunks.  While the writer has one buffer the
+// workers fill the other; if that fills too, they wait for the writer.
+//
+#define OUTPUT_BUFFER_SIZE      (1024 * 1024)
+#define OUTPUT_CHUNK_SIZE       (256 * 1024)
+#define OUTPUT_FLUSH_INTERVAL   50
+
+typedef struct _RECORD
+{
+    ULONGLONG       llOccurance;
+    LONG            nClient;                        // 0 for syelogd's own records.
+    LONG            nSequence;
+    DWORD           nProcessId;
+    BYTE            nFacility;
+    BYTE            nSeverity;
+    USHORT          cchText;
+    CHAR            szText[1];
+} RECORD, *PRECORD;
+
+typedef struct _RECORD_BUFFER
+{
+    DWORD           cbUsed;
+    DWORD           nRecords;
+    PRECORD         rpRecords[OUTPUT_BUFFER_SIZE / sizeof(RECORD)];
+    BYTE            rbData[OUTPUT_BUFFER_SIZE];
+} RECORD_BUFFER, *PRECORD_BUFFER;
+
 //////////////////////////////////////////////////////////////////////////////
 //
 BOOL        s_fLogToScreen  = TRUE;     // Log output to screen.
@@ -49,6 +125,22 @@ LONG        s_nActiveClients = 0;
 LONGLONG    s_llStartTime = 0;
 LONGLONG    s_llLastTime = 0;
 
+CRITICAL_SECTION    s_csClients;            // Guards s_pFreeClients.
+PCLIENT             s_pFreeClients = NULL;
+LONG                s_nClients = 0;
+LONG                s_nSequence = 0;        // Sequence for syelogd's own records.
+
+CRITICAL_SECTION    s_csQueue;              // Guards the buffer pointers below.
+RECORD_BUFFER       s_rBuffers[2];
+PRECORD_BUFFER      s_pFill = &s_rBuffers[0];   // Being filled by workers.
+PRECORD_BUFFER      s_pFree = &s_rBuffers[1];   // Idle, or NULL if ...
+PRECORD_BUFFER      s_pFull = NULL;             // ... the writer has it.
+HANDLE              s_hWake = NULL;         // Wakes the writer.
+HANDLE              s_hFreed = NULL;        // Set while s_pFree is non-NULL.
+CHAR                s_szOutput[OUTPUT_CHUNK_SIZE];
+
+VOID FlushOutput();
+
 BOOL LogMessageV(BYTE nSeverity, PCHAR pszMsg, ...);
 
 //////////////////////////////////////////////////////////////////////////////
@@ -58,6 +150,7 @@ VOID MyErrExit(PCSTR pszMsg)
     DWORD error = GetLastError();
 
     LogMessageV(SYELOG_SEVERITY_FATAL, "Error %d in %s.", error, pszMsg);
+    FlushOutput();
     fprintf(stderr, "SYELOGD: Error %d in %s.\n", error, pszMsg);
     fflush(stderr);
     exit(1);
@@ -134,11 +227,17 @@ BOOL CloseConnection(PCLIENT pClient)
             CloseHandle(pClient->hPipe);
             pClient->hPipe = INVALID_HANDLE_VALUE;
         }
-        GlobalFree(pClient);
+
+        // Keep the client, and its batch buffer, for the next connection.
+        EnterCriticalSection(&s_csClients);
+        pClient->pNextFree = s_pFreeClients;
+        s_pFreeClients = pClient;
+        LeaveCriticalSection(&s_csClients);
         pClient = NULL;
     }
 
     if (s_fExitAfterOne) {
+        FlushOutput();
         ExitProcess(0);
     }
     return TRUE;
@@ -163,16 +262,27 @@ PCLIENT CreatePipeConnection(HANDLE hCompletionPort)
         MyErrExit("CreatePipe");
     }
 
-    // Allocate the client data structure.
+    // Reuse a closed client's data structure, or allocate a new one.
     //
-    PCLIENT pClient = (PCLIENT) GlobalAlloc(GPTR, sizeof(CLIENT));
+    EnterCriticalSection(&s_csClients);
+    PCLIENT pClient = s_pFreeClients;
+    if (pClient != NULL) {
+        s_pFreeClients = pClient->pNextFree;
+    }
+    LeaveCriticalSection(&s_csClients);
+
     if (pClient == NULL) {
-        MyErrExit("GlobalAlloc pClient");
+        pClient = (PCLIENT) GlobalAlloc(GPTR, sizeof(CLIENT));
+        if (pClient == NULL) {
+            MyErrExit("GlobalAlloc pClient");
+        }
     }
 
-    ZeroMemory(pClient, sizeof(*pClient));
+    ZeroMemory(pClient, offsetof(CLIENT, rbBatch));
+    pClient->bTerminator = 0;
     pClient->hPipe = hPipe;
     pClient->fAwaitingAccept = TRUE;
+    pClient->nClient = InterlockedIncrement(&s_nClients);
 
     // Associate file with our complietion port.
     //
@@ -193,65 +303,226 @@ PCLIENT CreatePipeConnection(HANDLE hCompletionPort)
     return pClient;
 }
 
-BOOL LogMessageV(BYTE nSeverity, PCHAR pszMsg, ...)
+static VOID QueueRecord(LONG nClient,
+                        LONG nSequence,
+                        DWORD nProcessId,
+                        BYTE nFacility,
+                        BYTE nSeverity,
+                        FILETIME ftOccurance,
+                        PCSTR pszText,
+                        DWORD cchText)
 {
-    FILETIME ftOccurance;
-    CHAR szTime[64];
-    GetSystemTimeAsFileTime(&ftOccurance);
-    FileTimeToString(szTime, sizeof(szTime), ftOccurance);
+    if (cchText > SYELOG_MAXIMUM_MESSAGE) {
+        cchText = SYELOG_MAXIMUM_MESSAGE;
+    }
+    DWORD cbRecord = (DWORD)((offsetof(RECORD, szText) + cchText + 1 + 7) & ~7);
+
+    EnterCriticalSection(&s_csQueue);
+
+    while (s_pFill->cbUsed + cbRecord > sizeof(s_pFill->rbData) ||
+           s_pFill->nRecords >= ARRAYSIZE(s_pFill->rpRecords)) {
+        if (s_pFree != NULL) {
+            // Hand the full buffer to the writer and start on the idle one.
+            s_pFull = s_pFill;
+            s_pFill = s_pFree;
+            s_pFree = NULL;
+            ResetEvent(s_hFreed);
+            SetEvent(s_hWake);
+        }
+        else {
+            LeaveCriticalSection(&s_csQueue);
+            WaitForSingleObject(s_hFreed, INFINITE);
+            EnterCriticalSection(&s_csQueue);
+        }
+    }
+
+    PRECORD pRecord = (PRECORD)(s_pFill->rbData + s_pFill->cbUsed);
+    pRecord->llOccurance = ((ULONGLONG)ftOccurance.dwHighDateTime << 32) |
+        ftOccurance.dwLowDateTime;
+    pRecord->nClient = nClient;
+    pRecord->nSequence = nSequence;
+    pRecord->nProcessId = nProcessId;
+    pRecord->nFacility = nFacility;
+    pRecord->nSeverity = nSeverity;
+    pRecord->cchText = (USHORT)cchText;
+    CopyMemory(pRecord->szText, pszText, cchText);
+    pRecord->szText[cchText] = '\0';
+
+    s_pFill->rpRecords[s_pFill->nRecords++] = pRecord;
+    s_pFill->cbUsed += cbRecord;
+
+    LeaveCriticalSection(&s_csQueue);
+}
+
+static int __cdecl CompareRecords(const void *pv1, const void *pv2)
+{
+    PRECORD pRecord1 = *(PRECORD *)pv1;
+    PRECORD pRecord2 = *(PRECORD *)pv2;
+
+    if (pRecord1->llOccurance != pRecord2->llOccurance) {
+        return (pRecord1->llOccurance < pRecord2->llOccurance) ? -1 : 1;
+    }
+    if (pRecord1->nClient != pRecord2->nClient) {
+        return (pRecord1->nClient < pRecord2->nClient) ? -1 : 1;
+    }
+    if (pRecord1->nSequence != pRecord2->nSequence) {
+        return (pRecord1->nSequence < pRecord2->nSequence) ? -1 : 1;
+    }
+    return 0;
+}
 
+static VOID WriteOutput(PCHAR pszOutput, DWORD cbOutput)
+{
     if (s_fLogToScreen) {
-        printf(s_fDeltaTime
-               ? "%-7.7s ---- --.%02x: "
-               : "%-17.17s ---- --.%02x: "
-               , szTime, nSeverity);
-        va_list args;
-        va_start(args, pszMsg);
-        vprintf(pszMsg, args);
-        va_end(args);
-        printf("\n");
+        fwrite(pszOutput, 1, cbOutput, stdout);
     }
     if (s_hOutFile != INVALID_HANDLE_VALUE) {
         DWORD cbWritten = 0;
-        CHAR szBuf[4096] = "";
-        PCHAR pcchEnd = szBuf + ARRAYSIZE(szBuf) - 2;
-        PCHAR pcchCur = szBuf;
-        HRESULT hr;
-
-        hr = StringCchPrintfExA(pcchCur, pcchEnd - pcchCur,
-                                &pcchCur, NULL, STRSAFE_NULL_ON_FAILURE,
-                                s_fDeltaTime
-                                ? "%-7.7s ---- --.%02x: "
-                                : "%-17.17s ---- --.%02x: "
-                                , szTime, nSeverity);
-        if (FAILED(hr)) {
-            goto Cleanup;
+        WriteFile(s_hOutFile, pszOutput, cbOutput, &cbWritten, NULL);
+    }
+}
+
+// Sorts, formats, and writes every record in the buffer, then empties it.
+// Only the thread that owns the buffer calls this, so s_szOutput and the
+// delta time need no lock.
+//
+static VOID WriteRecords(PRECORD_BUFFER pBuffer)
+{
+    qsort(pBuffer->rpRecords, pBuffer->nRecords, sizeof(pBuffer->rpRecords[0]),
+          CompareRecords);
+
+    PCHAR pcchCur = s_szOutput;
+    PCHAR pcchEnd = s_szOutput + ARRAYSIZE(s_szOutput);
+
+    for (DWORD n = 0; n < pBuffer->nRecords; n++) {
+        PRECORD pRecord = pBuffer->rpRecords[n];
+
+        if (pcchEnd - pcchCur < (LONG_PTR)pRecord->cchText + 64) {
+            WriteOutput(s_szOutput, (DWORD)(pcchCur - s_szOutput));
+            pcchCur = s_szOutput;
         }
 
-        va_list args;
-        va_start(args, pszMsg);
-        hr = StringCchPrintfExA(pcchCur, pcchEnd - pcchCur,
-                                &pcchCur, NULL, STRSAFE_NULL_ON_FAILURE,
-                                pszMsg, args);
-        va_end(args);
-        if (FAILED(hr)) {
-            goto Cleanup;
+        FILETIME ftOccurance;
+        ftOccurance.dwLowDateTime = (DWORD)pRecord->llOccurance;
+        ftOccurance.dwHighDateTime = (DWORD)(pRecord->llOccurance >> 32);
+
+        CHAR szTime[64];
+        FileTimeToString(szTime, sizeof(szTime), ftOccurance);
+
+        if (pRecord->nClient == 0) {
+            StringCchPrintfExA(pcchCur, pcchEnd - pcchCur,
+                               &pcchCur, NULL, STRSAFE_NULL_ON_FAILURE,
+                               s_fDeltaTime
+                               ? "%-7.7s ---- --.%02x: %s\n"
+                               : "%-17.17s ---- --.%02x: %s\n",
+                               szTime,
+                               pRecord->nSeverity,
+                               pRecord->szText);
+        }
+        else {
+            StringCchPrintfExA(pcchCur, pcchEnd - pcchCur,
+                               &pcchCur, NULL, STRSAFE_NULL_ON_FAILURE,
+                               s_fDeltaTime
+                               ? "%-7.7s %4d %02x.%02x: %s\n"
+                               : "%-17.17s %4d %02x.%02x: %s\n",
+                               szTime,
+                               pRecord->nProcessId,
+                               pRecord->nFacility,
+                               pRecord->nSeverity,
+                               pRecord->szText);
+        }
+    }
+    if (pcchCur > s_szOutput) {
+        WriteOutput(s_szOutput, (DWORD)(pcchCur - s_szOutput));
+    }
+
+    pBuffer->cbUsed = 0;
+    pBuffer->nRecords = 0;
+}
+
+DWORD WINAPI WriterThread(LPVOID pvVoid)
+{
+    (void)pvVoid;
+
+    for (;;) {
+        WaitForSingleObject(s_hWake, OUTPUT_FLUSH_INTERVAL);
+
+        EnterCriticalSection(&s_csQueue);
+        if (s_pFull == NULL && s_pFill->nRecords > 0) {
+            s_pFull = s_pFill;
+            s_pFill = s_pFree;
+            s_pFree = NULL;
+            ResetEvent(s_hFreed);
         }
+        PRECORD_BUFFER pBuffer = s_pFull;
+        LeaveCriticalSection(&s_csQueue);
+
+        if (pBuffer != NULL) {
+            WriteRecords(pBuffer);
 
-        hr = StringCchPrintfExA(pcchCur, (szBuf + ARRAYSIZE(szBuf)) - pcchCur,
-                                &pcchCur, NULL, STRSAFE_NULL_ON_FAILURE,
-                                 "\n");
-        if (FAILED(hr)) {
-            goto Cleanup;
+            EnterCriticalSection(&s_csQueue);
+            s_pFull = NULL;
+            s_pFree = pBuffer;
+            SetEvent(s_hFreed);
+            LeaveCriticalSection(&s_csQueue);
         }
+    }
+}
+
+// Writes everything queued so far; called before the process exits.
+//
+VOID FlushOutput()
+{
+    if (s_hFreed == NULL) {                     // Still starting up.
+        return;
+    }
+
+    EnterCriticalSection(&s_csQueue);
+    while (s_pFull != NULL) {
+        LeaveCriticalSection(&s_csQueue);
+        WaitForSingleObject(s_hFreed, INFINITE);
+        EnterCriticalSection(&s_csQueue);
+    }
+    if (s_pFill->nRecords > 0) {
+        WriteRecords(s_pFill);
+    }
+    fflush(stdout);
+    if (s_hOutFile != INVALID_HANDLE_VALUE) {
+        FlushFileBuffers(s_hOutFile);
+    }
+    LeaveCriticalSection(&s_csQueue);
+}
+
+BOOL LogMessageV(BYTE nSeverity, PCHAR pszMsg, ...)
+{
+    FILETIME ftOccurance;
+    GetSystemTimeAsFileTime(&ftOccurance);
 
-      Cleanup:
-        WriteFile(s_hOutFile, szBuf, (DWORD)(pcchCur - szBuf), &cbWritten, NULL);
+    if (s_hFreed == NULL) {                     // Still starting up.
+        va_list args;
+        va_start(args, pszMsg);
+        vfprintf(stderr, pszMsg, args);
+        va_end(args);
+        fprintf(stderr, "\n");
+        return TRUE;
     }
+
+    CHAR szBuf[SYELOG_MAXIMUM_MESSAGE] = "";
+    PCHAR pcchCur = szBuf;
+
+    va_list args;
+    va_start(args, pszMsg);
+    StringCchVPrintfExA(szBuf, ARRAYSIZE(szBuf),
+                        &pcchCur, NULL, STRSAFE_NULL_ON_FAILURE,
+                        pszMsg, args);
+    va_end(args);
+
+    QueueRecord(0, InterlockedIncrement(&s_nSequence), 0, 0, nSeverity,
+                ftOccurance, szBuf, (DWORD)(pcchCur - szBuf));
     return TRUE;
 }
 
-BOOL LogMessage(PSYELOG_MESSAGE pMessage, DWORD nBytes)
+BOOL LogMessage(PCLIENT pClient, PSYELOG_MESSAGE pMessage, DWORD nBytes)
 {
     // Sanity check the size of the message.
     //
@@ -268,8 +539,13 @@ BOOL LogMessage(PSYELOG_MESSAGE pMessage, DWORD nBytes)
         return FALSE;
     }
 
-    CHAR szTime[64];
-    FileTimeToString(szTime, sizeof(szTime), pMessage->ftOccurance);
+    SYELOG_MESSAGE Text;
+    if (pMessage->nFormat == SYELOG_FORMAT_DEFERRED) {
+        if (!SyelogFormatMessage(pMessage, nBytes, &Text)) {
+            return FALSE;
+        }
+        pMessage = &Text;
+    }
 
     PCHAR pszMsg = pMessage->szMessage;
     while (*pszMsg) {
@@ -279,40 +555,14 @@ BOOL LogMessage(PSYELOG_MESSAGE pMessage, DWORD nBytes)
         *--pszMsg = '\0';
     }
 
-    if (s_fLogToScreen) {
-        printf(s_fDeltaTime
-               ? "%-7.7s %4d %02x.%02x: %s\n"
-               : "%-17.17s %4d %02x.%02x: %s\n",
-               szTime,
-               pMessage->nProcessId,
-               pMessage->nFacility,
-               pMessage->nSeverity,
-               pMessage->szMessage);
-    }
-    if (s_hOutFile != INVALID_HANDLE_VALUE) {
-        DWORD cbWritten = 0;
-        CHAR szBuf[4096];
-        PCHAR pcchEnd = szBuf + ARRAYSIZE(szBuf);
-        PCHAR pcchCur = szBuf;
-        HRESULT hr;
-
-        hr = StringCchPrintfExA(pcchCur, pcchEnd - pcchCur,
-                                &pcchCur, NULL, STRSAFE_NULL_ON_FAILURE,
-                                s_fDeltaTime
-                                ? "%-7.7s %4d %02x.%02x: %s\n"
-                                : "%-17.17s %4d %02x.%02x: %s\n",
-                                szTime,
-                                pMessage->nProcessId,
-                                pMessage->nFacility,
-                                pMessage->nSeverity,
-                                pMessage->szMessage);
-        if (FAILED(hr)) {
-            goto Cleanup;
-        }
-
-      Cleanup:
-        WriteFile(s_hOutFile, szBuf, (DWORD)(pcchCur - szBuf), &cbWritten, NULL);
-    }
+    QueueRecord(pClient->nClient,
+                pClient->nSequence++,
+                pMessage->nProcessId,
+                pMessage->nFacility,
+                pMessage->nSeverity,
+                pMessage->ftOccurance,
+                pMessage->szMessage,
+                (DWORD)(pszMsg - pMessage->szMessage));
     return TRUE;
 }
 
@@ -331,17 +581,15 @@ DWORD WINAPI WorkerThread(LPVOID pvVoid)
         b = GetQueuedCompletionStatus(hCompletionPort,
                                       &nBytes, (PULONG_PTR)&pClient, &lpo, INFINITE);
 
-        if (!b || lpo == NULL) {
+        if (!b && lpo == NULL) {
             fKeepLooping = FALSE;
             MyErrExit("GetQueuedCompletionState");
             break;
         }
         else if (!b) {
             if (pClient) {
-                if (GetLastError() == ERROR_BROKEN_PIPE) {
-                    LogMessageV(SYELOG_SEVERITY_INFORMATION, "Client closed pipe.");
-                }
-                else {
+                // CloseConnection logs the close itself.
+                if (GetLastError() != ERROR_BROKEN_PIPE) {
                     LogMessageV(SYELOG_SEVERITY_ERROR,
                                 "GetQueuedCompletionStatus failed %d [%p]",
                                 GetLastError(), pClient);
@@ -355,8 +603,8 @@ DWORD WINAPI WorkerThread(LPVOID pvVoid)
             InterlockedIncrement(&s_nActiveClients);
             pClient->fAwaitingAccept = FALSE;
             b = ReadFile(pClient->hPipe,
-                         &pClient->Message,
-                         sizeof(pClient->Message),
+                         pClient->rbBatch,
+                         sizeof(pClient->rbBatch),
                          &nBytes,
                          pClient);
             if (!b) {
@@ -372,19 +620,35 @@ DWORD WINAPI WorkerThread(LPVOID pvVoid)
         else {
             if (nBytes < offsetof(SYELOG_MESSAGE, szMessage)) {
                 CloseConnection(pClient);
+                continue;
             }
 
-            if (pClient->Message.fTerminate) {
-                LogMessageV(SYELOG_SEVERITY_NOTICE,
-                            "Client requested terminate on next connection close.");
-                s_fExitAfterOne = TRUE;
-            }
+            // Each read returns one batch; walk its messages by nBytes.
+            //
+            PBYTE pbNext = pClient->rbBatch;
+            PBYTE pbEnd = pClient->rbBatch + nBytes;
+            while (pbEnd - pbNext > (LONG_PTR)offsetof(SYELOG_MESSAGE, szMessage)) {
+                PSYELOG_MESSAGE pMessage = (PSYELOG_MESSAGE)pbNext;
+                DWORD cbMessage = pMessage->nBytes;
+
+                if (cbMessage <= offsetof(SYELOG_MESSAGE, szMessage) ||
+                    cbMessage > (DWORD)(pbEnd - pbNext)) {
+                    cbMessage = (DWORD)(pbEnd - pbNext);
+                }
 
-            LogMessage(&pClient->Message, nBytes);
+                if (pMessage->fTerminate) {
+                    LogMessageV(SYELOG_SEVERITY_NOTICE,
+                                "Client requested terminate on next connection close.");
+                    s_fExitAfterOne = TRUE;
+                }
+
+                LogMessage(pClient, pMessage, cbMessage);
+                pbNext += cbMessage;
+            }
 
             b = ReadFile(pClient->hPipe,
-                         &pClient->Message,
-                         sizeof(pClient->Message),
+                         pClient->rbBatch,
+                         sizeof(pClient->rbBatch),
                          &nBytes,
                          pClient);
             if (!b && GetLastError() == ERROR_BROKEN_PIPE) {
@@ -426,6 +690,7 @@ BOOL WINAPI ControlHandler(DWORD dwCtrlType)
       case CTRL_LOGOFF_EVENT:
       case CTRL_SHUTDOWN_EVENT:
         LogMessageV(SYELOG_SEVERITY_INFORMATION, "User requested stop.");
+        FlushOutput();
         printf("\nSYELOGD: Closing connections.\n");
         if (s_hOutFile != INVALID_HANDLE_VALUE) {
             printf("Closing file.\n");
@@ -444,6 +709,8 @@ DWORD main(int argc, char **argv)
     BOOL fNeedHelp = FALSE;
 
     GetSystemTimeAsFileTime((FILETIME *)&s_llStartTime);
+    InitializeCriticalSection(&s_csClients);
+    InitializeCriticalSection(&s_csQueue);
     SetConsoleCtrlHandler(ControlHandler, TRUE);
 
     int arg = 1;
@@ -532,8 +799,23 @@ DWORD main(int argc, char **argv)
         MyErrExit("CreateIoCompletionPort");
     }
 
-    // Create completion port worker threads.
+    // Create the writer thread and completion port worker threads.
     //
+    s_hWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (s_hWake == NULL) {
+        MyErrExit("CreateEvent s_hWake");
+    }
+    s_hFreed = CreateEvent(NULL, TRUE, TRUE, NULL);
+    if (s_hFreed == NULL) {
+        MyErrExit("CreateEvent s_hFreed");
+    }
+    DWORD dwThread;
+    HANDLE hThread = CreateThread(NULL, 0, WriterThread, NULL, 0, &dwThread);
+    if (!hThread) {
+        MyErrExit("CreateThread WriterThread");
+    }
+    CloseHandle(hThread);
+
     CreateWorkers(hCompletionPort);
     CreatePipeConnection(hCompletionPort);
 
@@ -543,6 +825,7 @@ DWORD main(int argc, char **argv)
     }
 
     SetConsoleCtrlHandler(ControlHandler, FALSE);
+    FlushOutput();
 
     if (s_hOutFile != INVALID_HANDLE_VALUE) {
         FlushFileBuffers(s_hOutFile);
@@ -21,6 +21,11 @@ VOID SyelogOpen(PCSTR pszIdentifier, BYTE nFacility)
     (void)nFacility;
 }
 
+VOID SyelogDeferFormatting(BOOL fDefer)
+{
+    (void)fDefer;
+}
+
 VOID SyelogExV(BOOL fTerminate, BYTE nSeverity, PCSTR pszMsgf, va_list args)
 {
     (void)fTerminate;
@@ -404,6 +404,7 @@ BOOL ProcessAttach(HMODULE hDll)
     StringCchPrintfA(s_szDllPath, ARRAYSIZE(s_szDllPath), "%ls", s_wzDllPath);
 
     SyelogOpen("trcapi" DETOURS_STRINGIFY(DETOURS_BITS), SYELOG_FACILITY_APPLICATION);
+    SyelogDeferFormatting(TRUE);                // syelogd formats each call.
     ProcessEnumerate();
 
     LONG error = AttachDetours();
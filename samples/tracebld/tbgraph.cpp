@@ -0,0 +1,858 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Detours Test Program (tbgraph.cpp of tbgraph.exe)
+//
+//  Microsoft Research Detours Package
+//
+//  Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//  Converts the per-process XML logs written by tracebld into one binary
+//  dependency graph (see tbgraph.h), and reads such graphs back.
+//
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#pragma warning(push)
+#if _MSC_VER > 1400
+#pragma warning(disable:6102 6103) // /analyze warnings
+#endif
+#include <strsafe.h>
+#pragma warning(pop)
+#include "tbgraph.h"
+
+//////////////////////////////////////////////////////////////////////////////
+//
+static BOOL             s_fVerbose = FALSE;
+
+static PCHAR *          s_ppszStrings = NULL;   // Interned strings.
+static DWORD            s_nStrings = 0;
+static DWORD            s_nStringsMax = 0;
+static DWORD            s_cbStrings = 0;
+static PDWORD           s_pnSlots = NULL;       // Hash of s_ppszStrings, index + 1.
+static DWORD            s_nSlots = 0;
+
+static PTBGRAPH_PROCESS s_pProcesses = NULL;
+static DWORD            s_nProcesses = 0;
+static DWORD            s_nProcessesMax = 0;
+static PTBGRAPH_FILE    s_pFiles = NULL;
+static DWORD            s_nFiles = 0;
+static DWORD            s_nFilesMax = 0;
+static PTBGRAPH_VAR     s_pVars = NULL;
+static DWORD            s_nVars = 0;
+static DWORD            s_nVarsMax = 0;
+
+//////////////////////////////////////////////////////////////////////////////
+//
+static VOID MyErrExit(PCSTR pszMsg)
+{
+    fprintf(stderr, "TBGRAPH: Error in %s.\n", pszMsg);
+    fflush(stderr);
+    exit(1);
+}
+
+static FILE * OpenFile(PCSTR pszPath, PCSTR pszMode)
+{
+#ifdef _MSC_VER
+    FILE *pFile = NULL;
+    if (fopen_s(&pFile, pszPath, pszMode) != 0) {
+        return NULL;
+    }
+    return pFile;
+#else
+    return fopen(pszPath, pszMode);
+#endif
+}
+
+static PVOID Grow(PVOID pvData, DWORD *pnMax, DWORD cbEntry)
+{
+    DWORD nMax = *pnMax ? *pnMax * 2 : 256;
+    pvData = realloc(pvData, (size_t)nMax * cbEntry);
+    if (pvData == NULL) {
+        MyErrExit("realloc");
+    }
+    *pnMax = nMax;
+    return pvData;
+}
+
+static DWORD Hash(PCSTR pszString, DWORD cchString)
+{
+    DWORD nHash = 2166136261u;
+    for (DWORD n = 0; n < cchString; n++) {
+        nHash = (nHash ^ (BYTE)pszString[n]) * 16777619u;
+    }
+    return nHash;
+}
+
+// Returns the index of the string, adding it if this is its first use.
+//
+static DWORD Intern(PCSTR pszString, DWORD cchString)
+{
+    if (s_nStrings >= s_nSlots / 2) {
+        DWORD nSlots = s_nSlots ? s_nSlots * 2 : 4096;
+        PDWORD pnSlots = (PDWORD)calloc(nSlots, sizeof(DWORD));
+        if (pnSlots == NULL) {
+            MyErrExit("calloc");
+        }
+        for (DWORD n = 0; n < s_nStrings; n++) {
+            PCSTR psz = s_ppszStrings[n];
+            DWORD nSlot = Hash(psz, (DWORD)strlen(psz)) & (nSlots - 1);
+            while (pnSlots[nSlot] != 0) {
+                nSlot = (nSlot + 1) & (nSlots - 1);
+            }
+            pnSlots[nSlot] = n + 1;
+        }
+        free(s_pnSlots);
+        s_pnSlots = pnSlots;
+        s_nSlots = nSlots;
+    }
+
+    DWORD nSlot = Hash(pszString, cchString) & (s_nSlots - 1);
+    for (; s_pnSlots[nSlot] != 0; nSlot = (nSlot + 1) & (s_nSlots - 1)) {
+        PCSTR psz = s_ppszStrings[s_pnSlots[nSlot] - 1];
+        if (strncmp(psz, pszString, cchString) == 0 && psz[cchString] == '\0') {
+            return s_pnSlots[nSlot] - 1;
+        }
+    }
+
+    if (s_nStrings >= s_nStringsMax) {
+        s_ppszStrings = (PCHAR *)Grow(s_ppszStrings, &s_nStringsMax, sizeof(PCHAR));
+    }
+    PCHAR psz = (PCHAR)malloc(cchString + 1);
+    if (psz == NULL) {
+        MyErrExit("malloc");
+    }
+    memcpy(psz, pszString, cchString);
+    psz[cchString] = '\0';
+
+    s_ppszStrings[s_nStrings] = psz;
+    s_pnSlots[nSlot] = ++s_nStrings;
+    s_cbStrings += cchString + 1;
+    return s_nStrings - 1;
+}
+
+///////////////////////////////////////////////////////////////// XML Parsing.
+//
+// trcbld writes one element per line, escaping text with its %e format:
+// &lt; &gt; &amp; &quot; &apos; and &#n; for control and non-ASCII
+// characters.  Paths printed with %ls are not escaped, so an '&' that does
+// not start one of these entities is kept as is.
+//
+static PCHAR AppendUtf8(PCHAR pszOut, DWORD nChar)
+{
+    if (nChar < 0x80) {
+        *pszOut++ = (CHAR)nChar;
+    }
+    else if (nChar < 0x800) {
+        *pszOut++ = (CHAR)(0xc0 | (nChar >> 6));
+        *pszOut++ = (CHAR)(0x80 | (nChar & 0x3f));
+    }
+    else {
+        *pszOut++ = (CHAR)(0xe0 | ((nChar >> 12) & 0x0f));
+        *pszOut++ = (CHAR)(0x80 | ((nChar >> 6) & 0x3f));
+        *pszOut++ = (CHAR)(0x80 | (nChar & 0x3f));
+    }
+    return pszOut;
+}
+
+static DWORD InternText(PCSTR pszBeg, PCSTR pszEnd)
+{
+    static CHAR s_szText[65536];
+    PCHAR pszOut = s_szText;
+    PCHAR pszOutEnd = s_szText + ARRAYSIZE(s_szText) - 4;
+
+    while (pszBeg < pszEnd && pszOut < pszOutEnd) {
+        if (*pszBeg == '&') {
+            static const struct { PCSTR psz; DWORD cch; CHAR c; } s_rEntities[] = {
+                { "&lt;", 4, '<' },
+                { "&gt;", 4, '>' },
+                { "&amp;", 5, '&' },
+                { "&quot;", 6, '\"' },
+                { "&apos;", 6, '\'' },
+            };
+            DWORD n = 0;
+            for (; n < ARRAYSIZE(s_rEntities); n++) {
+                if ((DWORD)(pszEnd - pszBeg) >= s_rEntities[n].cch &&
+                    strncmp(pszBeg, s_rEntities[n].psz, s_rEntities[n].cch) == 0) {
+                    *pszOut++ = s_rEntities[n].c;
+                    pszBeg += s_rEntities[n].cch;
+                    break;
+                }
+            }
+            if (n < ARRAYSIZE(s_rEntities)) {
+                continue;
+            }
+            if (pszBeg + 1 < pszEnd && pszBeg[1] == '#') {
+                PCSTR psz = pszBeg + 2;
+                DWORD nChar = 0;
+                while (psz < pszEnd && *psz >= '0' && *psz <= '9' && nChar < 0x10000) {
+                    nChar = nChar * 10 + (*psz++ - '0');
+                }
+                if (psz < pszEnd && *psz == ';' && psz > pszBeg + 2 && nChar < 0x10000) {
+                    pszOut = AppendUtf8(pszOut, nChar);
+                    pszBeg = psz + 1;
+                    continue;
+                }
+            }
+        }
+        *pszOut++ = *pszBeg++;
+    }
+    return Intern(s_szText, (DWORD)(pszOut - s_szText));
+}
+
+static PCSTR FindText(PCSTR pszBeg, PCSTR pszEnd, PCSTR pszText)
+{
+    DWORD cchText = (DWORD)strlen(pszText);
+    for (; pszBeg + cchText <= pszEnd; pszBeg++) {
+        if (*pszBeg == *pszText && strncmp(pszBeg, pszText, cchText) == 0) {
+            return pszBeg;
+        }
+    }
+    return NULL;
+}
+
+static BOOL HasPrefix(PCSTR pszBeg, PCSTR pszEnd, PCSTR pszPrefix)
+{
+    DWORD cchPrefix = (DWORD)strlen(pszPrefix);
+    return (DWORD)(pszEnd - pszBeg) >= cchPrefix && strncmp(pszBeg, pszPrefix, cchPrefix) == 0;
+}
+
+// Finds the value of attribute pszName (with its '=' and opening quote)
+// within the start tag, and stores the bounds of the value.
+//
+static BOOL FindAttribute(PCSTR pszBeg, PCSTR pszEnd, PCSTR pszName,
+                          PCSTR *ppszValue, PCSTR *ppszValueEnd)
+{
+    PCSTR pszTag = FindText(pszBeg, pszEnd, ">");
+    if (pszTag == NULL) {
+        pszTag = pszEnd;
+    }
+
+    for (PCSTR psz = pszBeg; (psz = FindText(psz, pszTag, pszName)) != NULL; psz++) {
+        if (psz > pszBeg && psz[-1] == ' ') {
+            psz += strlen(pszName);
+            PCSTR pszValueEnd = FindText(psz, pszTag, "\"");
+            if (pszValueEnd == NULL) {
+                return FALSE;
+            }
+            *ppszValue = psz;
+            *ppszValueEnd = pszValueEnd;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static BOOL HasTrueAttribute(PCSTR pszBeg, PCSTR pszEnd, PCSTR pszName)
+{
+    PCSTR pszValue;
+    PCSTR pszValueEnd;
+
+    return (FindAttribute(pszBeg, pszEnd, pszName, &pszValue, &pszValueEnd) &&
+            HasPrefix(pszValue, pszValueEnd, "true"));
+}
+
+// Process ids are written as ::1.2.::; store them as 1.2.
+//
+static DWORD InternId(PCSTR pszBeg, PCSTR pszEnd)
+{
+    if (HasPrefix(pszBeg, pszEnd, "::")) {
+        pszBeg += 2;
+    }
+    if (pszEnd - pszBeg >= 2 && pszEnd[-1] == ':' && pszEnd[-2] == ':') {
+        pszEnd -= 2;
+    }
+    return InternText(pszBeg, pszEnd);
+}
+
+static VOID EndProcess(PTBGRAPH_PROCESS pProcess)
+{
+    if (pProcess != NULL) {
+        pProcess->nFiles = s_nFiles - pProcess->nFirstFile;
+        pProcess->nVars = s_nVars - pProcess->nFirstVar;
+    }
+}
+
+static VOID ParseLine(PCSTR pszBeg, PCSTR pszEnd, PTBGRAPH_PROCESS *ppProcess)
+{
+    PTBGRAPH_PROCESS pProcess = *ppProcess;
+    PCSTR pszValue;
+    PCSTR pszValueEnd;
+
+    if (HasPrefix(pszBeg, pszEnd, "<t:Process ")) {
+        EndProcess(pProcess);
+
+        if (s_nProcesses >= s_nProcessesMax) {
+            s_pProcesses = (PTBGRAPH_PROCESS)Grow(s_pProcesses, &s_nProcessesMax,
+                                                  sizeof(TBGRAPH_PROCESS));
+        }
+        pProcess = &s_pProcesses[s_nProcesses++];
+        *ppProcess = pProcess;
+
+        ZeroMemory(pProcess, sizeof(*pProcess));
+        pProcess->nId = TBGRAPH_NONE;
+        pProcess->nParent = TBGRAPH_NONE;
+        pProcess->nExe = TBGRAPH_NONE;
+        pProcess->nExecutable = TBGRAPH_NONE;
+        pProcess->nDirectory = TBGRAPH_NONE;
+        pProcess->nLine = TBGRAPH_NONE;
+        pProcess->nFirstFile = s_nFiles;
+        pProcess->nFirstVar = s_nVars;
+
+        // Until the graph is written, nParent holds the parent's id string.
+        if (FindAttribute(pszBeg, pszEnd, "id=\"", &pszValue, &pszValueEnd)) {
+            pProcess->nId = InternId(pszValue, pszValueEnd);
+        }
+        if (FindAttribute(pszBeg, pszEnd, "parentId=\"", &pszValue, &pszValueEnd)) {
+            pProcess->nParent = InternId(pszValue, pszValueEnd);
+        }
+        if (FindAttribute(pszBeg, pszEnd, "exe=\"", &pszValue, &pszValueEnd)) {
+            pProcess->nExe = InternText(pszValue, pszValueEnd);
+        }
+        if (HasTrueAttribute(pszBeg, pszEnd, "drop=\"")) {
+            pProcess->fFlags |= TBGRAPH_PROCESS_DROP;
+        }
+        if (HasTrueAttribute(pszBeg, pszEnd, "pipes=\"")) {
+            pProcess->fFlags |= TBGRAPH_PROCESS_PIPES;
+        }
+        if (HasTrueAttribute(pszBeg, pszEnd, "redirects=\"")) {
+            pProcess->fFlags |= TBGRAPH_PROCESS_REDIRECTS;
+        }
+        return;
+    }
+    if (pProcess == NULL) {
+        return;
+    }
+    if (HasPrefix(pszBeg, pszEnd, "</t:Process>")) {
+        EndProcess(pProcess);
+        *ppProcess = NULL;
+        return;
+    }
+
+    // The remaining elements all have text content.
+    PCSTR pszText = FindText(pszBeg, pszEnd, ">");
+    if (pszText == NULL) {
+        return;
+    }
+    pszText++;
+    PCSTR pszTextEnd = FindText(pszText, pszEnd, "</t:");
+    if (pszTextEnd == NULL) {
+        return;
+    }
+
+    if (HasPrefix(pszBeg, pszEnd, "<t:File")) {
+        PCSTR pszData = FindText(pszText, pszTextEnd, "<t:Data>");
+        if (pszData != NULL) {
+            pszTextEnd = pszData;
+        }
+
+        if (s_nFiles >= s_nFilesMax) {
+            s_pFiles = (PTBGRAPH_FILE)Grow(s_pFiles, &s_nFilesMax, sizeof(TBGRAPH_FILE));
+        }
+        PTBGRAPH_FILE pFile = &s_pFiles[s_nFiles++];
+        pFile->nPath = InternText(pszText, pszTextEnd);
+        pFile->fFlags = 0;
+
+        PCSTR pszTag = pszText - 1;
+        if (HasTrueAttribute(pszBeg, pszTag, "read=\"")) {
+            pFile->fFlags |= TBGRAPH_FILE_READ;
+        }
+        if (HasTrueAttribute(pszBeg, pszTag, "write=\"")) {
+            pFile->fFlags |= TBGRAPH_FILE_WRITE;
+        }
+        if (HasTrueAttribute(pszBeg, pszTag, "delete=\"")) {
+            pFile->fFlags |= TBGRAPH_FILE_DELETE;
+        }
+        if (HasTrueAttribute(pszBeg, pszTag, "cleanup=\"")) {
+            pFile->fFlags |= TBGRAPH_FILE_CLEANUP;
+        }
+        if (HasTrueAttribute(pszBeg, pszTag, "append=\"")) {
+            pFile->fFlags |= TBGRAPH_FILE_APPEND;
+        }
+        if (HasTrueAttribute(pszBeg, pszTag, "mkdir=\"")) {
+            pFile->fFlags |= TBGRAPH_FILE_MKDIR;
+        }
+    }
+    else if (HasPrefix(pszBeg, pszEnd, "<t:Var ")) {
+        if (!FindAttribute(pszBeg, pszEnd, "var=\"", &pszValue, &pszValueEnd)) {
+            return;
+        }
+        if (s_nVars >= s_nVarsMax) {
+            s_pVars = (PTBGRAPH_VAR)Grow(s_pVars, &s_nVarsMax, sizeof(TBGRAPH_VAR));
+        }
+        PTBGRAPH_VAR pVar = &s_pVars[s_nVars++];
+        pVar->nName = InternText(pszValue, pszValueEnd);
+        pVar->nValue = InternText(pszText, pszTextEnd);
+    }
+    else if (HasPrefix(pszBeg, pszEnd, "<t:Directory>")) {
+        pProcess->nDirectory = InternText(pszText, pszTextEnd);
+    }
+    else if (HasPrefix(pszBeg, pszEnd, "<t:Executable>")) {
+        pProcess->nExecutable = InternText(pszText, pszTextEnd);
+    }
+    else if (HasPrefix(pszBeg, pszEnd, "<t:Line>")) {
+        pProcess->nLine = InternText(pszText, pszTextEnd);
+    }
+    else if (HasPrefix(pszBeg, pszEnd, "<t:Return>")) {
+        pProcess->nReturn = atol(pszText);
+        pProcess->fFlags |= TBGRAPH_PROCESS_RETURNED;
+    }
+}
+
+static BOOL ParseLog(PCSTR pszFile)
+{
+    FILE *pFile = OpenFile(pszFile, "rb");
+    if (pFile == NULL) {
+        fprintf(stderr, "TBGRAPH: Couldn't open %s.\n", pszFile);
+        return FALSE;
+    }
+
+    long cbData = -1;
+    if (fseek(pFile, 0, SEEK_END) == 0) {
+        cbData = ftell(pFile);
+    }
+    if (cbData < 0 || fseek(pFile, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "TBGRAPH: Couldn't size %s.\n", pszFile);
+        fclose(pFile);
+        return FALSE;
+    }
+
+    PCHAR pszData = (PCHAR)malloc(cbData + 1);
+    if (pszData == NULL) {
+        MyErrExit("malloc");
+    }
+    if (fread(pszData, 1, cbData, pFile) != (size_t)cbData) {
+        fprintf(stderr, "TBGRAPH: Couldn't read %s.\n", pszFile);
+        fclose(pFile);
+        free(pszData);
+        return FALSE;
+    }
+    fclose(pFile);
+    pszData[cbData] = '\0';
+
+    DWORD nProcesses = s_nProcesses;
+    PTBGRAPH_PROCESS pProcess = NULL;
+    PCSTR pszEnd = pszData + cbData;
+
+    for (PCSTR pszLine = pszData; pszLine < pszEnd;) {
+        PCSTR pszLineEnd = pszLine;
+        while (pszLineEnd < pszEnd && *pszLineEnd != '\n') {
+            pszLineEnd++;
+        }
+        ParseLine(pszLine, pszLineEnd, &pProcess);
+        pszLine = pszLineEnd + 1;
+    }
+    EndProcess(pProcess);
+
+    if (s_fVerbose) {
+        printf("TBGRAPH: %s: %d processes.\n", pszFile, s_nProcesses - nProcesses);
+    }
+    free(pszData);
+    return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////// Writing.
+//
+static PDWORD s_pnOrder = NULL;
+
+static int __cdecl CompareOrder(const void *pv1, const void *pv2)
+{
+    return strcmp(s_ppszStrings[*(PDWORD)pv1], s_ppszStrings[*(PDWORD)pv2]);
+}
+
+static int __cdecl CompareFiles(const void *pv1, const void *pv2)
+{
+    DWORD nPath1 = ((PTBGRAPH_FILE)pv1)->nPath;
+    DWORD nPath2 = ((PTBGRAPH_FILE)pv2)->nPath;
+
+    return (nPath1 < nPath2) ? -1 : (nPath1 > nPath2) ? 1 : 0;
+}
+
+static DWORD Remap(PDWORD pnRemap, DWORD nString)
+{
+    return (nString == TBGRAPH_NONE) ? TBGRAPH_NONE : pnRemap[nString];
+}
+
+static BOOL WriteGraph(PCSTR pszFile)
+{
+    // Sort the strings so readers can binary search them.
+    //
+    s_pnOrder = (PDWORD)malloc((s_nStrings + 1) * sizeof(DWORD));
+    PDWORD pnRemap = (PDWORD)malloc((s_nStrings + 1) * sizeof(DWORD));
+    if (s_pnOrder == NULL || pnRemap == NULL) {
+        MyErrExit("malloc");
+    }
+    for (DWORD n = 0; n < s_nStrings; n++) {
+        s_pnOrder[n] = n;
+    }
+    qsort(s_pnOrder, s_nStrings, sizeof(DWORD), CompareOrder);
+    for (DWORD n = 0; n < s_nStrings; n++) {
+        pnRemap[s_pnOrder[n]] = n;
+    }
+
+    for (DWORD n = 0; n < s_nVars; n++) {
+        s_pVars[n].nName = Remap(pnRemap, s_pVars[n].nName);
+        s_pVars[n].nValue = Remap(pnRemap, s_pVars[n].nValue);
+    }
+
+    // Sort each process's files by path, folding repeats together.
+    //
+    DWORD nFiles = 0;
+    for (DWORD n = 0; n < s_nProcesses; n++) {
+        PTBGRAPH_PROCESS pProcess = &s_pProcesses[n];
+        PTBGRAPH_FILE pFiles = &s_pFiles[pProcess->nFirstFile];
+
+        for (DWORD f = 0; f < pProcess->nFiles; f++) {
+            pFiles[f].nPath = pnRemap[pFiles[f].nPath];
+        }
+        qsort(pFiles, pProcess->nFiles, sizeof(TBGRAPH_FILE), CompareFiles);
+
+        DWORD nFirstFile = nFiles;
+        for (DWORD f = 0; f < pProcess->nFiles; f++) {
+            if (nFiles > nFirstFile && s_pFiles[nFiles - 1].nPath == pFiles[f].nPath) {
+                s_pFiles[nFiles - 1].fFlags |= pFiles[f].fFlags;
+            }
+            else {
+                s_pFiles[nFiles++] = pFiles[f];
+            }
+        }
+        pProcess->nFirstFile = nFirstFile;
+        pProcess->nFiles = nFiles - nFirstFile;
+
+        pProcess->nId = Remap(pnRemap, pProcess->nId);
+        pProcess->nParent = Remap(pnRemap, pProcess->nParent);
+        pProcess->nExe = Remap(pnRemap, pProcess->nExe);
+        pProcess->nExecutable = Remap(pnRemap, pProcess->nExecutable);
+        pProcess->nDirectory = Remap(pnRemap, pProcess->nDirectory);
+        pProcess->nLine = Remap(pnRemap, pProcess->nLine);
+    }
+    s_nFiles = nFiles;
+
+    // Replace each parent's id with its process index.
+    //
+    PDWORD pnProcessOfId = pnRemap;
+    for (DWORD n = 0; n < s_nStrings; n++) {
+        pnProcessOfId[n] = TBGRAPH_NONE;
+    }
+    for (DWORD n = 0; n < s_nProcesses; n++) {
+        DWORD nId = s_pProcesses[n].nId;
+        if (nId != TBGRAPH_NONE && pnProcessOfId[nId] == TBGRAPH_NONE) {
+            pnProcessOfId[nId] = n;
+        }
+    }
+    for (DWORD n = 0; n < s_nProcesses; n++) {
+        DWORD nParent = s_pProcesses[n].nParent;
+        if (nParent != TBGRAPH_NONE) {
+            s_pProcesses[n].nParent = pnProcessOfId[nParent];
+        }
+    }
+
+    // Lay out the file: header, tables, then the string bytes.
+    //
+    TBGRAPH_HEADER Header;
+    ZeroMemory(&Header, sizeof(Header));
+    ULONGLONG cbFile = sizeof(Header);
+
+    Header.nSignature = TBGRAPH_SIGNATURE;
+    Header.cbHeader = sizeof(Header);
+    Header.nStrings = s_nStrings;
+    Header.ofStrings = (DWORD)cbFile;
+    cbFile += (ULONGLONG)s_nStrings * sizeof(DWORD);
+    Header.nProcesses = s_nProcesses;
+    Header.ofProcesses = (DWORD)cbFile;
+    cbFile += (ULONGLONG)s_nProcesses * sizeof(TBGRAPH_PROCESS);
+    Header.nFiles = s_nFiles;
+    Header.ofFiles = (DWORD)cbFile;
+    cbFile += (ULONGLONG)s_nFiles * sizeof(TBGRAPH_FILE);
+    Header.nVars = s_nVars;
+    Header.ofVars = (DWORD)cbFile;
+    cbFile += (ULONGLONG)s_nVars * sizeof(TBGRAPH_VAR);
+
+    DWORD ofPool = (DWORD)cbFile;
+    cbFile += s_cbStrings + 1;                  // Always end with a zero.
+    if (cbFile > 0xffffffff) {
+        fprintf(stderr, "TBGRAPH: Graph is larger than 4GB.\n");
+        return FALSE;
+    }
+    Header.cbFile = (DWORD)cbFile;
+
+    FILE *pFile = OpenFile(pszFile, "wb");
+    if (pFile == NULL) {
+        fprintf(stderr, "TBGRAPH: Couldn't create %s.\n", pszFile);
+        return FALSE;
+    }
+
+    fwrite(&Header, sizeof(Header), 1, pFile);
+
+    DWORD ofString = ofPool;
+    for (DWORD n = 0; n < s_nStrings; n++) {
+        fwrite(&ofString, sizeof(ofString), 1, pFile);
+        ofString += (DWORD)strlen(s_ppszStrings[s_pnOrder[n]]) + 1;
+    }
+    fwrite(s_pProcesses, sizeof(TBGRAPH_PROCESS), s_nProcesses, pFile);
+    fwrite(s_pFiles, sizeof(TBGRAPH_FILE), s_nFiles, pFile);
+    fwrite(s_pVars, sizeof(TBGRAPH_VAR), s_nVars, pFile);
+    for (DWORD n = 0; n < s_nStrings; n++) {
+        PCSTR psz = s_ppszStrings[s_pnOrder[n]];
+        fwrite(psz, strlen(psz) + 1, 1, pFile);
+    }
+    fputc('\0', pFile);
+
+    BOOL fGood = !ferror(pFile);
+    if (fclose(pFile) != 0) {
+        fGood = FALSE;
+    }
+    if (!fGood) {
+        fprintf(stderr, "TBGRAPH: Couldn't write %s.\n", pszFile);
+        return FALSE;
+    }
+
+    printf("TBGRAPH: %s: %d processes, %d files, %d vars, %d strings, %d bytes.\n",
+           pszFile, s_nProcesses, s_nFiles, s_nVars, s_nStrings, Header.cbFile);
+
+    free(pnRemap);
+    free(s_pnOrder);
+    s_pnOrder = NULL;
+    return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////// Reading.
+//
+static PCSTR StringOrEmpty(PTBGRAPH_HEADER pGraph, DWORD nString)
+{
+    PCSTR psz = TbgraphString(pGraph, nString);
+    return psz ? psz : "";
+}
+
+static PCSTR FileFlags(DWORD fFlags)
+{
+    static CHAR s_szFlags[8];
+
+    s_szFlags[0] = (fFlags & TBGRAPH_FILE_READ) ? 'r' : '-';
+    s_szFlags[1] = (fFlags & TBGRAPH_FILE_WRITE) ? 'w' : '-';
+    s_szFlags[2] = (fFlags & TBGRAPH_FILE_DELETE) ? 'd' : '-';
+    s_szFlags[3] = (fFlags & TBGRAPH_FILE_CLEANUP) ? 'c' : '-';
+    s_szFlags[4] = (fFlags & TBGRAPH_FILE_APPEND) ? 'a' : '-';
+    s_szFlags[5] = (fFlags & TBGRAPH_FILE_MKDIR) ? 'm' : '-';
+    s_szFlags[6] = '\0';
+    return s_szFlags;
+}
+
+static VOID DumpGraph(PTBGRAPH_HEADER pGraph, PCSTR pszPath)
+{
+    DWORD nPath = TBGRAPH_NONE;
+    if (pszPath != NULL) {
+        nPath = TbgraphFindString(pGraph, pszPath);
+        if (nPath == TBGRAPH_NONE) {
+            printf("TBGRAPH: No process used %s.\n", pszPath);
+            return;
+        }
+    }
+
+    for (DWORD n = 0; n < pGraph->nProcesses; n++) {
+        PTBGRAPH_PROCESS pProcess = TbgraphProcess(pGraph, n);
+        PTBGRAPH_PROCESS pParent = TbgraphProcess(pGraph, pProcess->nParent);
+
+        if (nPath != TBGRAPH_NONE) {
+            DWORD fFlags = TbgraphFindFile(pGraph, pProcess, nPath);
+            if (fFlags != 0) {
+                printf("%s %-10s ::%s::\n",
+                       FileFlags(fFlags),
+                       StringOrEmpty(pGraph, pProcess->nExe),
+                       StringOrEmpty(pGraph, pProcess->nId));
+            }
+            continue;
+        }
+
+        printf("::%s:: %s", StringOrEmpty(pGraph, pProcess->nId),
+               StringOrEmpty(pGraph, pProcess->nExe));
+        if (pParent != NULL) {
+            printf(" (parent ::%s::)", StringOrEmpty(pGraph, pParent->nId));
+        }
+        if (pProcess->fFlags & TBGRAPH_PROCESS_RETURNED) {
+            printf(" returned %d", pProcess->nReturn);
+        }
+        if (pProcess->fFlags & TBGRAPH_PROCESS_DROP) {
+            printf(" drop");
+        }
+        printf("\n");
+
+        if (pProcess->nDirectory != TBGRAPH_NONE) {
+            printf("    dir    %s\n", StringOrEmpty(pGraph, pProcess->nDirectory));
+        }
+        if (pProcess->nLine != TBGRAPH_NONE) {
+            printf("    line   %s\n", StringOrEmpty(pGraph, pProcess->nLine));
+        }
+
+        PTBGRAPH_FILE pFiles = TbgraphFiles(pGraph, pProcess);
+        for (DWORD f = 0; f < pProcess->nFiles; f++) {
+            printf("    %s %s\n", FileFlags(pFiles[f].fFlags),
+                   StringOrEmpty(pGraph, pFiles[f].nPath));
+        }
+
+        PTBGRAPH_VAR pVars = TbgraphVars(pGraph, pProcess);
+        for (DWORD v = 0; v < pProcess->nVars; v++) {
+            printf("    var    %s=%s\n",
+                   StringOrEmpty(pGraph, pVars[v].nName),
+                   StringOrEmpty(pGraph, pVars[v].nValue));
+        }
+    }
+}
+
+static BOOL ReadGraph(PCSTR pszFile, PCSTR pszPath)
+{
+    HANDLE hFile = CreateFileA(pszFile, GENERIC_READ, FILE_SHARE_READ, NULL,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "TBGRAPH: Couldn't open %s: %d\n", pszFile, GetLastError());
+        return FALSE;
+    }
+
+    BOOL fGood = FALSE;
+    DWORD cbFile = GetFileSize(hFile, NULL);
+    HANDLE hMap = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (hMap != NULL) {
+        PVOID pvData = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+        if (pvData != NULL) {
+            PTBGRAPH_HEADER pGraph = TbgraphValidate(pvData, cbFile);
+            if (pGraph != NULL) {
+                DumpGraph(pGraph, pszPath);
+                fGood = TRUE;
+            }
+            else {
+                fprintf(stderr, "TBGRAPH: %s is not a valid graph.\n", pszFile);
+            }
+            UnmapViewOfFile(pvData);
+        }
+        CloseHandle(hMap);
+    }
+    if (!fGood && hMap == NULL) {
+        fprintf(stderr, "TBGRAPH: Couldn't map %s: %d\n", pszFile, GetLastError());
+    }
+    CloseHandle(hFile);
+    return fGood;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Parses every log matching the pattern, which may contain wildcards.
+//
+static BOOL ParseLogs(PCSTR pszPattern)
+{
+    CHAR szPath[MAX_PATH];
+    StringCchCopyA(szPath, ARRAYSIZE(szPath), pszPattern);
+
+    PCHAR pszName = szPath + strlen(szPath);
+    while (pszName > szPath && pszName[-1] != '\\' && pszName[-1] != '/' && pszName[-1] != ':') {
+        pszName--;
+    }
+
+    WIN32_FIND_DATAA wfd;
+    HANDLE hFind = FindFirstFileA(pszPattern, &wfd);
+    if (hFind == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "TBGRAPH: No files match %s.\n", pszPattern);
+        return FALSE;
+    }
+
+    BOOL fGood = TRUE;
+    do {
+        if (wfd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            continue;
+        }
+        StringCchCopyA(pszName, szPath + ARRAYSIZE(szPath) - pszName, wfd.cFileName);
+        if (!ParseLog(szPath)) {
+            fGood = FALSE;
+        }
+    } while (FindNextFileA(hFind, &wfd));
+
+    FindClose(hFind);
+    return fGood;
+}
+
+int CDECL main(int argc, char **argv)
+{
+    BOOL fNeedHelp = FALSE;
+    PCSTR pszOutput = NULL;
+    PCSTR pszPath = NULL;
+
+    int arg = 1;
+    for (; arg < argc && (argv[arg][0] == '-' || argv[arg][0] == '/'); arg++) {
+        CHAR *argn = argv[arg] + 1;
+        CHAR *argp = argn;
+        while (*argp && *argp != ':' && *argp != '=') {
+            argp++;
+        }
+        if (*argp == ':' || *argp == '=') {
+            *argp++ = '\0';
+        }
+
+        switch (argn[0]) {
+
+          case 'f':                                     // File to look up.
+          case 'F':
+            pszPath = argp;
+            break;
+
+          case 'o':                                     // Output graph.
+          case 'O':
+            pszOutput = argp;
+            break;
+
+          case 'v':                                     // Verbose
+          case 'V':
+            s_fVerbose = TRUE;
+            break;
+
+          case '?':                                     // Help.
+            fNeedHelp = TRUE;
+            break;
+
+          default:
+            fNeedHelp = TRUE;
+            printf("TBGRAPH: Bad argument: %s:%s\n", argn, argp);
+            break;
+        }
+    }
+
+    if (arg >= argc || (pszOutput != NULL && pszPath != NULL)) {
+        fNeedHelp = TRUE;
+    }
+
+    if (fNeedHelp) {
+        printf("Usage:\n"
+               "    tbgraph /o:graph.tbg log.*.xml...\n"
+               "    tbgraph [/f:path] graph.tbg...\n"
+               "Options:\n"
+               "    /o:file    Convert tracebld logs into one binary graph.\n"
+               "    /f:path    List only the processes that used the path.\n"
+               "    /v         Verbose: list processes per log.\n"
+               "    /?         Display this help message.\n"
+               "Summary:\n"
+               "    Converts tracebld's XML logs into a compact dependency graph that\n"
+               "    can be mapped and queried in place, or dumps such a graph.\n"
+               "\n");
+        return 9001;
+    }
+
+    BOOL fGood = TRUE;
+    if (pszOutput != NULL) {
+        for (; arg < argc; arg++) {
+            if (!ParseLogs(argv[arg])) {
+                fGood = FALSE;
+            }
+        }
+        if (!WriteGraph(pszOutput)) {
+            fGood = FALSE;
+        }
+    }
+    else {
+        for (; arg < argc; arg++) {
+            if (!ReadGraph(argv[arg], pszPath)) {
+                fGood = FALSE;
+            }
+        }
+    }
+    return fGood ? 0 : 1;
+}
+//
+///////////////////////////////////////////////////////////////// End of File.
@@ -0,0 +1,210 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Detours Test Program (tbgraph.h of tbgraph.exe)
+//
+//  Microsoft Research Detours Package
+//
+//  Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//  Binary dependency graph built by tbgraph.exe from tracebld logs.
+//
+//  The file is position independent so it can be mapped and used in place:
+//  every reference is a DWORD byte offset from the start of the header, or
+//  an index into one of the tables below.  Strings are UTF-8, interned once
+//  for the whole build, and sorted by strcmp, so TbgraphFindString is a
+//  binary search.  Each process owns a run of TBGRAPH_FILEs sorted by nPath,
+//  so asking whether a process read a path is also a binary search.
+//
+#pragma once
+#ifndef _TBGRAPH_H_
+#define _TBGRAPH_H_
+
+#include <string.h>
+
+#define TBGRAPH_SIGNATURE           0x31474254  // "TBG1"
+#define TBGRAPH_NONE                0xffffffff
+
+#define TBGRAPH_FILE_READ           0x0001
+#define TBGRAPH_FILE_WRITE          0x0002
+#define TBGRAPH_FILE_DELETE         0x0004
+#define TBGRAPH_FILE_CLEANUP        0x0008
+#define TBGRAPH_FILE_APPEND         0x0010
+#define TBGRAPH_FILE_MKDIR          0x0020
+
+#define TBGRAPH_PROCESS_DROP        0x0001
+#define TBGRAPH_PROCESS_PIPES       0x0002
+#define TBGRAPH_PROCESS_REDIRECTS   0x0004
+#define TBGRAPH_PROCESS_RETURNED    0x0008      // nReturn is valid.
+
+typedef struct _TBGRAPH_HEADER
+{
+    DWORD       nSignature;     // TBGRAPH_SIGNATURE
+    DWORD       cbHeader;       // sizeof(TBGRAPH_HEADER)
+    DWORD       cbFile;         // Whole file; the last byte is always zero.
+    DWORD       nStrings;
+    DWORD       ofStrings;      // DWORD[nStrings] of string offsets.
+    DWORD       nProcesses;
+    DWORD       ofProcesses;    // TBGRAPH_PROCESS[nProcesses].
+    DWORD       nFiles;
+    DWORD       ofFiles;        // TBGRAPH_FILE[nFiles].
+    DWORD       nVars;
+    DWORD       ofVars;         // TBGRAPH_VAR[nVars].
+} TBGRAPH_HEADER, *PTBGRAPH_HEADER;
+
+typedef struct _TBGRAPH_PROCESS
+{
+    DWORD       nId;            // String, such as "1.3.", from rGeneology.
+    DWORD       nParent;        // Process index, or TBGRAPH_NONE.
+    DWORD       nExe;           // String indexes, or TBGRAPH_NONE.
+    DWORD       nExecutable;
+    DWORD       nDirectory;
+    DWORD       nLine;
+    LONG        nReturn;
+    DWORD       fFlags;         // TBGRAPH_PROCESS_*
+    DWORD       nFirstFile;
+    DWORD       nFiles;
+    DWORD       nFirstVar;
+    DWORD       nVars;
+} TBGRAPH_PROCESS, *PTBGRAPH_PROCESS;
+
+typedef struct _TBGRAPH_FILE
+{
+    DWORD       nPath;          // String index.
+    DWORD       fFlags;         // TBGRAPH_FILE_*
+} TBGRAPH_FILE, *PTBGRAPH_FILE;
+
+typedef struct _TBGRAPH_VAR
+{
+    DWORD       nName;          // String indexes.
+    DWORD       nValue;
+} TBGRAPH_VAR, *PTBGRAPH_VAR;
+
+///////////////////////////////////////////////////////////////////// Reader.
+//
+// Checks that every table and string lies within the cbData bytes mapped
+// at pvData.  The other functions assume a graph that has passed.
+//
+inline PTBGRAPH_HEADER TbgraphValidate(PVOID pvData, DWORD cbData)
+{
+    PTBGRAPH_HEADER pGraph = (PTBGRAPH_HEADER)pvData;
+    PBYTE pbData = (PBYTE)pvData;
+
+    if (cbData < sizeof(*pGraph) ||
+        pGraph->nSignature != TBGRAPH_SIGNATURE ||
+        pGraph->cbHeader != sizeof(*pGraph) ||
+        pGraph->cbFile != cbData ||
+        pbData[cbData - 1] != 0) {
+        return NULL;
+    }
+
+    struct { DWORD nCount; DWORD of; DWORD cb; } rTables[] = {
+        { pGraph->nStrings, pGraph->ofStrings, sizeof(DWORD) },
+        { pGraph->nProcesses, pGraph->ofProcesses, sizeof(TBGRAPH_PROCESS) },
+        { pGraph->nFiles, pGraph->ofFiles, sizeof(TBGRAPH_FILE) },
+        { pGraph->nVars, pGraph->ofVars, sizeof(TBGRAPH_VAR) },
+    };
+    for (DWORD n = 0; n < ARRAYSIZE(rTables); n++) {
+        if ((rTables[n].of & 3) != 0 ||
+            rTables[n].of > cbData ||
+            rTables[n].nCount > (cbData - rTables[n].of) / rTables[n].cb) {
+            return NULL;
+        }
+    }
+
+    PDWORD pofStrings = (PDWORD)(pbData + pGraph->ofStrings);
+    for (DWORD n = 0; n < pGraph->nStrings; n++) {
+        if (pofStrings[n] >= cbData) {
+            return NULL;
+        }
+    }
+
+    PTBGRAPH_PROCESS pProcesses = (PTBGRAPH_PROCESS)(pbData + pGraph->ofProcesses);
+    for (DWORD n = 0; n < pGraph->nProcesses; n++) {
+        PTBGRAPH_PROCESS pProcess = &pProcesses[n];
+        if (pProcess->nFirstFile > pGraph->nFiles ||
+            pProcess->nFiles > pGraph->nFiles - pProcess->nFirstFile ||
+            pProcess->nFirstVar > pGraph->nVars ||
+            pProcess->nVars > pGraph->nVars - pProcess->nFirstVar ||
+            (pProcess->nParent != TBGRAPH_NONE && pProcess->nParent >= pGraph->nProcesses)) {
+            return NULL;
+        }
+    }
+    return pGraph;
+}
+
+inline PCSTR TbgraphString(PTBGRAPH_HEADER pGraph, DWORD nString)
+{
+    if (nString >= pGraph->nStrings) {
+        return NULL;
+    }
+    PDWORD pofStrings = (PDWORD)((PBYTE)pGraph + pGraph->ofStrings);
+    return (PCSTR)pGraph + pofStrings[nString];
+}
+
+inline PTBGRAPH_PROCESS TbgraphProcess(PTBGRAPH_HEADER pGraph, DWORD nProcess)
+{
+    if (nProcess >= pGraph->nProcesses) {
+        return NULL;
+    }
+    return (PTBGRAPH_PROCESS)((PBYTE)pGraph + pGraph->ofProcesses) + nProcess;
+}
+
+inline PTBGRAPH_FILE TbgraphFiles(PTBGRAPH_HEADER pGraph, PTBGRAPH_PROCESS pProcess)
+{
+    return (PTBGRAPH_FILE)((PBYTE)pGraph + pGraph->ofFiles) + pProcess->nFirstFile;
+}
+
+inline PTBGRAPH_VAR TbgraphVars(PTBGRAPH_HEADER pGraph, PTBGRAPH_PROCESS pProcess)
+{
+    return (PTBGRAPH_VAR)((PBYTE)pGraph + pGraph->ofVars) + pProcess->nFirstVar;
+}
+
+// Returns the index of the string, or TBGRAPH_NONE if no process used it.
+//
+inline DWORD TbgraphFindString(PTBGRAPH_HEADER pGraph, PCSTR pszString)
+{
+    DWORD nLo = 0;
+    DWORD nHi = pGraph->nStrings;
+
+    while (nLo < nHi) {
+        DWORD nMid = nLo + (nHi - nLo) / 2;
+        int nCmp = strcmp(TbgraphString(pGraph, nMid), pszString);
+        if (nCmp == 0) {
+            return nMid;
+        }
+        if (nCmp < 0) {
+            nLo = nMid + 1;
+        }
+        else {
+            nHi = nMid;
+        }
+    }
+    return TBGRAPH_NONE;
+}
+
+// Returns the TBGRAPH_FILE_* flags for the path in the process, or 0.
+//
+inline DWORD TbgraphFindFile(PTBGRAPH_HEADER pGraph, PTBGRAPH_PROCESS pProcess, DWORD nPath)
+{
+    PTBGRAPH_FILE pFiles = TbgraphFiles(pGraph, pProcess);
+    DWORD nLo = 0;
+    DWORD nHi = pProcess->nFiles;
+
+    while (nLo < nHi) {
+        DWORD nMid = nLo + (nHi - nLo) / 2;
+        if (pFiles[nMid].nPath == nPath) {
+            return pFiles[nMid].fFlags;
+        }
+        if (pFiles[nMid].nPath < nPath) {
+            nLo = nMid + 1;
+        }
+        else {
+            nHi = nMid;
+        }
+    }
+    return 0;
+}
+
+#endif // _TBGRAPH_H_
+//
+///////////////////////////////////////////////////////////////// End of File.
@@ -59,10 +59,13 @@ typedef struct _CLIENT : OVERLAPPED
     HANDLE          hFile;
     BOOL            fAwaitingAccept;
     PVOID           Zero;
+    PTBLOG_RING     pRing;
     TBLOG_MESSAGE   Message;
 
     BOOL LogMessage(PTBLOG_MESSAGE pMessage, DWORD nBytes);
     BOOL LogMessageV(PCHAR pszMsg, ...);
+    BOOL OpenRing(DWORD nProcessId);
+    BOOL DrainRing();
 } CLIENT, *PCLIENT;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -73,6 +76,7 @@ LONG        s_nActiveClients = 0;
 LONG        s_nTotalClients = 0;
 LONGLONG    s_llStartTime;
 BOOL        s_fVerbose = FALSE;
+BOOL        s_fPipeOnly = FALSE;
 TBLOG_PAYLOAD s_Payload;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -115,8 +119,87 @@ BOOL CLIENT::LogMessageV(PCHAR pszMsg, ...)
     return TRUE;
 }
 
+// Maps the ring announced by the client's first doorbell.
+//
+BOOL CLIENT::OpenRing(DWORD nProcessId)
+{
+    WCHAR wzRing[256];
+    StringCchPrintfW(wzRing, ARRAYSIZE(wzRing), L"%ls.%d.%d",
+                     TBLOG_RING_NAMEW, GetCurrentProcessId(), nProcessId);
+
+    HANDLE hRing = OpenFileMappingW(FILE_MAP_WRITE, FALSE, wzRing);
+    if (hRing == NULL) {
+        LogMessageV("<!-- Error %d in OpenFileMapping. -->", GetLastError());
+        return FALSE;
+    }
+
+    pRing = (PTBLOG_RING)MapViewOfFile(hRing, FILE_MAP_WRITE, 0, 0,
+                                       offsetof(TBLOG_RING, rbData) + s_Payload.cbRing);
+    CloseHandle(hRing);
+    if (pRing == NULL) {
+        LogMessageV("<!-- Error %d in MapViewOfFile. -->", GetLastError());
+        return FALSE;
+    }
+    if (pRing->cbData != s_Payload.cbRing) {
+        LogMessageV("<!-- Ring has the wrong size: %d. -->", pRing->cbData);
+        UnmapViewOfFile(pRing);
+        pRing = NULL;
+        return FALSE;
+    }
+
+    InterlockedExchange(&pRing->fAttached, TRUE);
+    return TRUE;
+}
+
+// Writes everything the client has put in its ring to the log file.
+//
+BOOL CLIENT::DrainRing()
+{
+    if (pRing == NULL) {
+        return TRUE;
+    }
+
+    DWORD cbRing = s_Payload.cbRing;
+    DWORD nRead = (DWORD)pRing->nRead;
+    DWORD nWrite = (DWORD)pRing->nWrite;
+    MemoryBarrier();
+
+    if (nWrite - nRead > cbRing) {
+        LogMessageV("<!-- Ring is corrupt: %d to %d. -->", nRead, nWrite);
+        return FALSE;
+    }
+
+    while (nRead != nWrite) {
+        DWORD nOffset = nRead & (cbRing - 1);
+        DWORD cbWrite = cbRing - nOffset;
+        if (cbWrite > nWrite - nRead) {
+            cbWrite = nWrite - nRead;
+        }
+
+        if (s_fVerbose) {
+            printf("[%.*s]", (int)cbWrite, (PCHAR)pRing->rbData + nOffset);
+        }
+
+        DWORD cbWritten = 0;
+        WriteFile(hFile, pRing->rbData + nOffset, cbWrite, &cbWritten, NULL);
+        nRead += cbWrite;
+    }
+
+    InterlockedExchange(&pRing->nRead, (LONG)nRead);
+    return TRUE;
+}
+
 BOOL CLIENT::LogMessage(PTBLOG_MESSAGE pMessage, DWORD nBytes)
 {
+    // A doorbell says the client's ring has data (or has just been created).
+    //
+    if (nBytes == sizeof(TBLOG_DOORBELL) && pMessage->nBytes == TBLOG_DOORBELL) {
+        if (pRing == NULL && !OpenRing(((PTBLOG_DOORBELL)pMessage)->nProcessId)) {
+            return FALSE;
+        }
+        return DrainRing();
+    }
+
     // Sanity check the size of the message.
     //
     if (nBytes > pMessage->nBytes) {
@@ -146,6 +229,11 @@ BOOL CloseConnection(PCLIENT pClient)
 {
     InterlockedDecrement(&s_nActiveClients);
     if (pClient != NULL) {
+        if (pClient->pRing != NULL) {
+            pClient->DrainRing();
+            UnmapViewOfFile(pClient->pRing);
+            pClient->pRing = NULL;
+        }
         if (pClient->hPipe != INVALID_HANDLE_VALUE) {
             //FlushFileBuffers(pClient->hPipe);
             if (!DisconnectNamedPipe(pClient->hPipe)) {
@@ -299,12 +387,15 @@ DWORD WINAPI WorkerThread(LPVOID pvVoid)
 
         if (!b) {
             if (pClient) {
-                if (GetLastError() == ERROR_BROKEN_PIPE) {
+                DWORD error = GetLastError();
+                pClient->DrainRing();
+
+                if (error == ERROR_BROKEN_PIPE) {
                     pClient->LogMessageV("<!-- Client closed pipe. -->");
                 }
                 else {
                     pClient->LogMessageV("<!-- *** GetQueuedCompletionStatus failed %d -->",
-                                         GetLastError());
+                                         error);
                 }
                 CloseConnection(pClient);
             }
@@ -329,6 +420,7 @@ DWORD WINAPI WorkerThread(LPVOID pvVoid)
         }
         else {
             if (nBytes <= offsetof(TBLOG_MESSAGE, szMessage)) {
+                pClient->DrainRing();
                 pClient->LogMessageV("</t:Process>\n");
                 CloseConnection(pClient);
                 continue;
@@ -419,6 +511,11 @@ DWORD main(int argc, char **argv)
             StringCchCopyA(s_szLogFile, ARRAYSIZE(s_szLogFile), argp);
             break;
 
+          case 'p':                                     // Pipe only
+          case 'P':
+            s_fPipeOnly = TRUE;
+            break;
+
           case 'v':                                     // Verbose
           case 'V':
             s_fVerbose = TRUE;
@@ -444,6 +541,7 @@ DWORD main(int argc, char **argv)
                "    tracebld [options] command {command arguments}\n"
                "Options:\n"
                "    /o:file    Log all events to the output files.\n"
+               "    /p         Send events through the pipe, not a shared ring.\n"
                "    /?         Display this help message.\n"
                "Summary:\n"
                "    Runs the build commands and figures out which files have dependencies..\n"
@@ -536,6 +634,7 @@ DWORD main(int argc, char **argv)
     s_Payload.nTraceProcessId = GetCurrentProcessId();
     s_Payload.nGeneology = 1;
     s_Payload.rGeneology[0] = 0;
+    s_Payload.cbRing = s_fPipeOnly ? 0 : TBLOG_RING_SIZE;
     StringCchCopyW(s_Payload.wzStdin, ARRAYSIZE(s_Payload.wzStdin), L"\\\\.\\CONIN$");
     StringCchCopyW(s_Payload.wzStdout, ARRAYSIZE(s_Payload.wzStdout), L"\\\\.\\CONOUT$");
     StringCchCopyW(s_Payload.wzStderr, ARRAYSIZE(s_Payload.wzStderr), L"\\\\.\\CONOUT$");
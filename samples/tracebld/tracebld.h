@@ -22,6 +22,9 @@
 #define TBLOG_PIPE_NAME        TBLOG_PIPE_NAMEA
 #endif
 
+#define TBLOG_RING_NAMEW       L"Local\\tracebuild"
+#define TBLOG_RING_SIZE        (1024 * 1024)
+
 //////////////////////////////////////////////////////////////////////////////
 //
 typedef struct _TBLOG_MESSAGE
@@ -30,6 +33,31 @@ typedef struct _TBLOG_MESSAGE
     CHAR        szMessage[32764]; // 32768 - sizeof(nBytes)
 } TBLOG_MESSAGE, *PTBLOG_MESSAGE;
 
+//////////////////////////////////////////////////////////////////////////////
+//
+// When TBLOG_PAYLOAD.cbRing is non-zero, each traced process appends its
+// log text to a shared ring, TBLOG_RING_NAMEW.<nTraceProcessId>.<nProcessId>,
+// instead of sending a TBLOG_MESSAGE per event.  The pipe then carries only
+// a TBLOG_DOORBELL, sent when the ring is created and whenever it is full,
+// and the final empty message.  tracebld drains the ring on each.
+//
+#define TBLOG_DOORBELL          0xffffffff
+
+typedef struct _TBLOG_DOORBELL
+{
+    DWORD       nBytes;         // Always TBLOG_DOORBELL.
+    DWORD       nProcessId;
+} TBLOG_DOORBELL, *PTBLOG_DOORBELL;
+
+typedef struct _TBLOG_RING
+{
+    volatile LONG   nWrite;     // Bytes ever written, advanced by the process.
+    volatile LONG   nRead;      // Bytes ever read, advanced by tracebld.
+    volatile LONG   fAttached;  // Set by tracebld once it has mapped the ring.
+    DWORD           cbData;     // Size of rbData, a power of two.
+    BYTE            rbData[1];
+} TBLOG_RING, *PTBLOG_RING;
+
 typedef struct _TBLOG_PAYLOAD
 {
     DWORD       nParentProcessId;
@@ -42,6 +70,7 @@ typedef struct _TBLOG_PAYLOAD
     WCHAR       wzStderr[256];
     BOOL        fStdoutAppend;
     BOOL        fStderrAppend;
+    DWORD       cbRing;         // Non-zero to log through a TBLOG_RING this size.
     WCHAR       wzzDrop[1024];  // Like an environment: zero terminated strings with a last zero.
     WCHAR       wzzEnvironment[32768];
 } TBLOG_PAYLOAD, *PTBLOG_PAYLOAD;
@@ -15,6 +15,7 @@
 
 #include <windows.h>
 #include <stdio.h>
+#include <stddef.h>
 #pragma warning(push)
 #if _MSC_VER > 1400
 #pragma warning(disable:6102 6103) // /analyze warnings
@@ -67,6 +68,8 @@ static DWORD s_cbEnvironment = NULL;
 static CRITICAL_SECTION s_csPipe;                       // Guards access to hPipe.
 static HANDLE           s_hPipe = INVALID_HANDLE_VALUE;
 static TBLOG_MESSAGE    s_rMessage;
+static HANDLE           s_hRing = NULL;                 // Also guarded by s_csPipe.
+static PTBLOG_RING      s_pRing = NULL;
 
 // Logging Functions.
 //
@@ -2218,6 +2221,100 @@ PCHAR SafePrintf(PCHAR pszBuffer, LONG cbBuffer, PCSTR pszMsg, ...)
 
 //////////////////////////////////////////////////////////////////////////////
 //
+static BOOL TblogRingDoorbell()
+{
+    TBLOG_DOORBELL Doorbell;
+    DWORD cbWritten = 0;
+
+    Doorbell.nBytes = TBLOG_DOORBELL;
+    Doorbell.nProcessId = GetCurrentProcessId();
+    return Real_WriteFile(s_hPipe, &Doorbell, sizeof(Doorbell), &cbWritten, NULL);
+}
+
+// Creates this process's shared ring and waits for tracebld to map it.  The
+// wait is made outside s_csPipe so other threads keep logging to the pipe
+// meanwhile.  If anything fails, we leave s_pRing NULL and keep writing to
+// the pipe.
+//
+static VOID TblogOpenRing()
+{
+    DWORD cbRing = s_Payload.cbRing;
+    if (cbRing == 0 || (cbRing & (cbRing - 1)) != 0) {
+        return;
+    }
+
+    WCHAR wzRing[256];
+    StringCchPrintfW(wzRing, ARRAYSIZE(wzRing), L"%ls.%d.%d",
+                     TBLOG_RING_NAMEW, s_nTraceProcessId, GetCurrentProcessId());
+
+    HANDLE hRing = Real_CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                           0, (DWORD)(offsetof(TBLOG_RING, rbData) + cbRing),
+                                           wzRing);
+    if (hRing == NULL) {
+        return;
+    }
+
+    PTBLOG_RING pRing = (PTBLOG_RING)MapViewOfFile(hRing, FILE_MAP_WRITE, 0, 0, 0);
+    if (pRing == NULL) {
+        Real_CloseHandle(hRing);
+        return;
+    }
+    pRing->cbData = cbRing;
+
+    EnterCriticalSection(&s_csPipe);
+    BOOL fRung = (s_hPipe != INVALID_HANDLE_VALUE && TblogRingDoorbell());
+    LeaveCriticalSection(&s_csPipe);
+
+    if (fRung) {
+        for (int waits = 0; waits < 10000; waits++) { // Up to 10 seconds.
+            if (pRing->fAttached) {
+                EnterCriticalSection(&s_csPipe);
+                if (s_hPipe != INVALID_HANDLE_VALUE) {
+                    s_hRing = hRing;
+                    s_pRing = pRing;
+                    LeaveCriticalSection(&s_csPipe);
+                    return;
+                }
+                LeaveCriticalSection(&s_csPipe);
+                break;
+            }
+            Sleep(1);
+        }
+    }
+
+    UnmapViewOfFile(pRing);
+    Real_CloseHandle(hRing);
+}
+
+// Copies a message into the ring, waiting for tracebld if the ring is full.
+// cbData must not exceed the ring size; TblogV sends larger messages through
+// the pipe.
+//
+static VOID TblogAppend(PCSTR pbData, DWORD cbData)
+{
+    PTBLOG_RING pRing = s_pRing;
+    DWORD cbRing = pRing->cbData;
+    DWORD nWrite = (DWORD)pRing->nWrite;
+
+    for (DWORD nWaits = 0; cbRing - (nWrite - (DWORD)pRing->nRead) < cbData; nWaits++) {
+        if ((nWaits % 100) == 0 && !TblogRingDoorbell()) {
+            Real_ExitProcess(9991);
+        }
+        Sleep(1);
+    }
+    MemoryBarrier();
+
+    DWORD nOffset = nWrite & (cbRing - 1);
+    DWORD cbFirst = cbRing - nOffset;
+    if (cbFirst > cbData) {
+        cbFirst = cbData;
+    }
+    CopyMemory(pRing->rbData + nOffset, pbData, cbFirst);
+    CopyMemory(pRing->rbData, pbData + cbFirst, cbData - cbFirst);
+
+    InterlockedExchange(&pRing->nWrite, (LONG)(nWrite + cbData));
+}
+
 BOOL TblogOpen()
 {
     EnterCriticalSection(&s_csPipe);
@@ -2233,6 +2330,7 @@ BOOL TblogOpen()
             DWORD dwMode = PIPE_READMODE_MESSAGE;
             if (SetNamedPipeHandleState(s_hPipe, &dwMode, NULL, NULL)) {
                 LeaveCriticalSection(&s_csPipe);
+                TblogOpenRing();
                 return TRUE;
             }
         }
@@ -2266,8 +2364,17 @@ VOID TblogV(PCSTR pszMsgf, va_list args)
     }
     s_rMessage.nBytes = (DWORD)(pszEnd - ((PCSTR)&s_rMessage));
 
+    DWORD cbMessage = s_rMessage.nBytes - (DWORD)offsetof(TBLOG_MESSAGE, szMessage);
+    if (s_pRing != NULL && cbMessage <= s_pRing->cbData) {
+        TblogAppend(s_rMessage.szMessage, cbMessage);
+    }
     // If the write fails, then we abort
-    if (s_hPipe != INVALID_HANDLE_VALUE) {
+    else if (s_hPipe != INVALID_HANDLE_VALUE) {
+        // A message that can't fit in the ring goes through the pipe.  Ring
+        // first so tracebld drains what is already queued ahead of it.
+        if (s_pRing != NULL && !TblogRingDoorbell()) {
+            Real_ExitProcess(9991);
+        }
         if (!Real_WriteFile(s_hPipe, &s_rMessage, s_rMessage.nBytes, &cbWritten, NULL)) {
             Real_ExitProcess(9991);
         }
@@ -2302,6 +2409,14 @@ VOID TblogClose()
         Real_CloseHandle(s_hPipe);
         s_hPipe = INVALID_HANDLE_VALUE;
     }
+    if (s_pRing != NULL) {
+        UnmapViewOfFile(s_pRing);
+        s_pRing = NULL;
+    }
+    if (s_hRing != NULL) {
+        Real_CloseHandle(s_hRing);
+        s_hRing = NULL;
+    }
 
     LeaveCriticalSection(&s_csPipe);
 }
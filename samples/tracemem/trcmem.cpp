@@ -459,6 +459,7 @@ BOOL ProcessAttach(HMODULE hDll)
     Real_GetModuleFileNameW(NULL, wzExePath, ARRAYSIZE(wzExePath));
 
     SyelogOpen("trcmem" DETOURS_STRINGIFY(DETOURS_BITS), SYELOG_FACILITY_APPLICATION);
+    SyelogDeferFormatting(TRUE);                // syelogd formats each call.
     Syelog(SYELOG_SEVERITY_INFORMATION, "##########################################\n");
     Syelog(SYELOG_SEVERITY_INFORMATION, "### %ls\n", wzExePath);
 
@@ -849,79 +849,66 @@ BOOL DETOURS_API DetourCopyPayloadToProcess(_In_ HANDLE hProcess,
         return FALSE;
     }
 
-    PBYTE pbTarget = pbBase;
-    IMAGE_DOS_HEADER idh;
-    IMAGE_NT_HEADERS inh;
-    IMAGE_SECTION_HEADER ish;
-    DETOUR_SECTION_HEADER dsh;
-    DETOUR_SECTION_RECORD dsr;
-    SIZE_T cbWrote = 0;
-
-    RtlSecureZeroMemory(&idh, sizeof(idh));
-    idh.e_magic = IMAGE_DOS_SIGNATURE;
-    idh.e_lfanew = sizeof(idh);
-    if (!WriteProcessMemory(hProcess, pbTarget, &idh, sizeof(idh), &cbWrote) ||
-        cbWrote != sizeof(idh)) {
-        DETOUR_TRACE(("WriteProcessMemory(idh) failed: %d\n", DetoursGetLastError()));
-        return FALSE;
-    }
-    pbTarget += sizeof(idh);
-
-    RtlSecureZeroMemory(&inh, sizeof(inh));
-    inh.Signature = IMAGE_NT_SIGNATURE;
-    inh.FileHeader.SizeOfOptionalHeader = sizeof(inh.OptionalHeader);
-    inh.FileHeader.Characteristics = IMAGE_FILE_DLL;
-    inh.FileHeader.NumberOfSections = 1;
-    inh.OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR_MAGIC;
-    if (!WriteProcessMemory(hProcess, pbTarget, &inh, sizeof(inh), &cbWrote) ||
-        cbWrote != sizeof(inh)) {
-        return FALSE;
-    }
-    pbTarget += sizeof(inh);
-
-    RtlSecureZeroMemory(&ish, sizeof(ish));
-    memcpy(ish.Name, ".detour", sizeof(ish.Name));
-    ish.VirtualAddress = (DWORD)((pbTarget + sizeof(ish)) - pbBase);
-    ish.SizeOfRawData = (sizeof(DETOUR_SECTION_HEADER) +
-                         sizeof(DETOUR_SECTION_RECORD) +
-                         cbData);
-    if (!WriteProcessMemory(hProcess, pbTarget, &ish, sizeof(ish), &cbWrote) ||
-        cbWrote != sizeof(ish)) {
-        return FALSE;
-    }
-    pbTarget += sizeof(ish);
-
-    RtlSecureZeroMemory(&dsh, sizeof(dsh));
-    dsh.cbHeaderSize = sizeof(dsh);
-    dsh.nSignature = DETOUR_SECTION_HEADER_SIGNATURE;
-    dsh.nDataOffset = sizeof(DETOUR_SECTION_HEADER);
-    dsh.cbDataSize = (sizeof(DETOUR_SECTION_HEADER) +
-                      sizeof(DETOUR_SECTION_RECORD) +
-                      cbData);
-    if (!WriteProcessMemory(hProcess, pbTarget, &dsh, sizeof(dsh), &cbWrote) ||
-        cbWrote != sizeof(dsh)) {
+    // Assemble the fake image locally so the target sees a single write.
+    PBYTE pbImage = new NOTHROW BYTE [cbTotal];
+    if (pbImage == nullptr) {
+        VirtualFreeEx(hProcess, pbBase, 0, MEM_RELEASE);
+        DetoursSetLastError(DETOURS_STATUS_OUTOFMEMORY);
         return FALSE;
     }
-    pbTarget += sizeof(dsh);
+    RtlSecureZeroMemory(pbImage, cbTotal - cbData);
+
+    PBYTE pbTarget = pbImage;
+    PIMAGE_DOS_HEADER pidh = (PIMAGE_DOS_HEADER)pbTarget;
+    pidh->e_magic = IMAGE_DOS_SIGNATURE;
+    pidh->e_lfanew = sizeof(*pidh);
+    pbTarget += sizeof(*pidh);
+
+    PIMAGE_NT_HEADERS pinh = (PIMAGE_NT_HEADERS)pbTarget;
+    pinh->Signature = IMAGE_NT_SIGNATURE;
+    pinh->FileHeader.SizeOfOptionalHeader = sizeof(pinh->OptionalHeader);
+    pinh->FileHeader.Characteristics = IMAGE_FILE_DLL;
+    pinh->FileHeader.NumberOfSections = 1;
+    pinh->OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR_MAGIC;
+    pbTarget += sizeof(*pinh);
+
+    PIMAGE_SECTION_HEADER pish = (PIMAGE_SECTION_HEADER)pbTarget;
+    memcpy(pish->Name, ".detour", sizeof(pish->Name));
+    pish->VirtualAddress = (DWORD)((pbTarget + sizeof(*pish)) - pbImage);
+    pish->SizeOfRawData = (sizeof(DETOUR_SECTION_HEADER) +
+                           sizeof(DETOUR_SECTION_RECORD) +
+                           cbData);
+    pbTarget += sizeof(*pish);
+
+    PDETOUR_SECTION_HEADER pdsh = (PDETOUR_SECTION_HEADER)pbTarget;
+    pdsh->cbHeaderSize = sizeof(*pdsh);
+    pdsh->nSignature = DETOUR_SECTION_HEADER_SIGNATURE;
+    pdsh->nDataOffset = sizeof(DETOUR_SECTION_HEADER);
+    pdsh->cbDataSize = (sizeof(DETOUR_SECTION_HEADER) +
+                        sizeof(DETOUR_SECTION_RECORD) +
+                        cbData);
+    pbTarget += sizeof(*pdsh);
+
+    PDETOUR_SECTION_RECORD pdsr = (PDETOUR_SECTION_RECORD)pbTarget;
+    pdsr->cbBytes = cbData + sizeof(DETOUR_SECTION_RECORD);
+    pdsr->nReserved = 0;
+    pdsr->guid = rguid;
+    pbTarget += sizeof(*pdsr);
+
+    memcpy(pbTarget, pvData, cbData);
 
-    RtlSecureZeroMemory(&dsr, sizeof(dsr));
-    dsr.cbBytes = cbData + sizeof(DETOUR_SECTION_RECORD);
-    dsr.nReserved = 0;
-    dsr.guid = rguid;
-    if (!WriteProcessMemory(hProcess, pbTarget, &dsr, sizeof(dsr), &cbWrote) ||
-        cbWrote != sizeof(dsr)) {
-        return FALSE;
-    }
-    pbTarget += sizeof(dsr);
+    SIZE_T cbWrote = 0;
+    BOOL fWrote = WriteProcessMemory(hProcess, pbBase, pbImage, cbTotal, &cbWrote);
+    delete[] pbImage;
 
-    if (!WriteProcessMemory(hProcess, pbTarget, pvData, cbData, &cbWrote) ||
-        cbWrote != cbData) {
+    if (!fWrote || cbWrote != cbTotal) {
+        DETOUR_TRACE(("WriteProcessMemory(%d) failed: %d\n", cbTotal, DetoursGetLastError()));
+        VirtualFreeEx(hProcess, pbBase, 0, MEM_RELEASE);
         return FALSE;
     }
-    pbTarget += cbData;
 
     DETOUR_TRACE(("Copied %d byte payload into target process at %p\n",
-                  cbTotal, pbTarget - cbTotal));
+                  cbTotal, pbBase));
     return TRUE;
 }
 
@@ -1075,39 +1075,142 @@ inline ULONG detour_is_code_filler(PBYTE pbCode)
 typedef struct DETOUR_REGION
 {
     ULONG               dwSignature;
+    ULONG               cLive;  // Number of trampolines handed out.
+    ULONG               fWritable;  // Made writable by the pending transaction.
     DETOUR_REGION *     pNext;  // Next region in list of regions.
     DETOUR_TRAMPOLINE * pFree;  // List of free trampolines in this region.
+    DETOUR_REGION *     pNextInWindow;  // Next region with free trampolines in window.
+    DETOUR_REGION *     pPrevInWindow;  // Previous region with free trampolines in window.
 }* PDETOUR_REGION;
 
+C_ASSERT(sizeof(DETOUR_REGION) <= sizeof(DETOUR_TRAMPOLINE));
+
 const ULONG DETOUR_REGION_SIGNATURE = 'Rrtd';
 const ULONG DETOUR_REGION_SIZE = 0x10000;
 const ULONG DETOUR_TRAMPOLINES_PER_REGION = (DETOUR_REGION_SIZE
                                              / sizeof(DETOUR_TRAMPOLINE)) - 1;
 static PDETOUR_REGION s_pRegions = nullptr;            // List of all regions.
 static PDETOUR_REGION s_pRegion = nullptr;             // Default region.
+static ULONG          s_nEmptyRegions = 0;             // Regions with no live trampolines.
+
+static DETOUR_TRANSACTION_STATISTICS s_PendingStatistics;   // Pending transaction.
+static DETOUR_TRANSACTION_STATISTICS s_LastStatistics;      // Last finished transaction.
 
-static DWORD detour_writable_trampoline_regions()
+static BOOL detour_writable_trampoline_region(PDETOUR_REGION pRegion)
 {
-    // Mark all of the regions as writable.
-    for (PDETOUR_REGION pRegion = s_pRegions; pRegion != nullptr; pRegion = pRegion->pNext) {
-        DWORD dwOld;
-        if (!VirtualProtect(pRegion, DETOUR_REGION_SIZE, PAGE_EXECUTE_READWRITE, &dwOld)) {
-            return DetoursGetLastError();
-        }
+    // A region is only made writable once the pending transaction touches it,
+    // so commit only has to restore and flush the regions that changed.
+    if (pRegion->fWritable) {
+        return TRUE;
     }
-    return DETOURS_STATUS_SUCCESS;
+
+    DWORD dwOld;
+    s_PendingStatistics.nProtectCalls++;
+    if (!VirtualProtect(pRegion, DETOUR_REGION_SIZE, PAGE_EXECUTE_READWRITE, &dwOld)) {
+        return FALSE;
+    }
+    pRegion->fWritable = TRUE;
+    return TRUE;
 }
 
 static void detour_runnable_trampoline_regions()
 {
     HANDLE hProcess = DetoursCurrentProcess();
 
-    // Mark all of the regions as executable.
+    // Mark the regions touched by the transaction as executable.
     for (PDETOUR_REGION pRegion = s_pRegions; pRegion != nullptr; pRegion = pRegion->pNext) {
+        if (!pRegion->fWritable) {
+            continue;
+        }
+        // Clear the flag while we can still write to the region.
+        pRegion->fWritable = FALSE;
+
         DWORD dwOld;
         VirtualProtect(pRegion, DETOUR_REGION_SIZE, PAGE_EXECUTE_READ, &dwOld);
         FlushInstructionCache(hProcess, pRegion, DETOUR_REGION_SIZE);
+        s_PendingStatistics.nProtectCalls++;
+        s_PendingStatistics.nFlushCalls++;
+    }
+}
+
+// Regions that still have free trampolines are also linked into a bucket
+// keyed by the 2GB window they sit in.  A target can only reach the windows
+// that overlap [pLo, pHi], so allocation looks at no more than three buckets
+// instead of walking every region.
+const ULONG DETOUR_REGION_WINDOWS = 64;
+static PDETOUR_REGION s_rpRegionWindows[DETOUR_REGION_WINDOWS];
+
+inline ULONG_PTR detour_region_window(PVOID pv)
+{
+    return ((ULONG_PTR)pv) >> 31;
+}
+
+// Both functions write to the neighboring regions, so they make those
+// writable first and change nothing if they can't.  The caller has already
+// made pRegion itself writable.
+//
+static BOOL detour_region_link_window(PDETOUR_REGION pRegion)
+{
+    PDETOUR_REGION *ppHead =
+        &s_rpRegionWindows[detour_region_window(pRegion) % DETOUR_REGION_WINDOWS];
+
+    if (*ppHead != nullptr && !detour_writable_trampoline_region(*ppHead)) {
+        return FALSE;
+    }
+
+    pRegion->pPrevInWindow = nullptr;
+    pRegion->pNextInWindow = *ppHead;
+    if (*ppHead != nullptr) {
+        (*ppHead)->pPrevInWindow = pRegion;
     }
+    *ppHead = pRegion;
+    return TRUE;
+}
+
+static BOOL detour_region_unlink_window(PDETOUR_REGION pRegion)
+{
+    if ((pRegion->pPrevInWindow != nullptr &&
+         !detour_writable_trampoline_region(pRegion->pPrevInWindow)) ||
+        (pRegion->pNextInWindow != nullptr &&
+         !detour_writable_trampoline_region(pRegion->pNextInWindow))) {
+        return FALSE;
+    }
+
+    if (pRegion->pPrevInWindow != nullptr) {
+        pRegion->pPrevInWindow->pNextInWindow = pRegion->pNextInWindow;
+    }
+    else {
+        s_rpRegionWindows[detour_region_window(pRegion) % DETOUR_REGION_WINDOWS] =
+            pRegion->pNextInWindow;
+    }
+    if (pRegion->pNextInWindow != nullptr) {
+        pRegion->pNextInWindow->pPrevInWindow = pRegion->pPrevInWindow;
+    }
+    pRegion->pNextInWindow = nullptr;
+    pRegion->pPrevInWindow = nullptr;
+    return TRUE;
+}
+
+static PDETOUR_REGION detour_region_find_window(PDETOUR_TRAMPOLINE pLo,
+                                                PDETOUR_TRAMPOLINE pHi)
+{
+    // A range wider than the table visits every bucket once and no more.
+    ULONG_PTR nWindow = detour_region_window(pLo);
+    ULONG_PTR nLast = detour_region_window(pHi);
+    if (nLast >= nWindow && nLast - nWindow >= DETOUR_REGION_WINDOWS) {
+        nLast = nWindow + DETOUR_REGION_WINDOWS - 1;
+    }
+
+    for (; nWindow <= nLast; nWindow++) {
+        PDETOUR_REGION pRegion = s_rpRegionWindows[nWindow % DETOUR_REGION_WINDOWS];
+        for (; pRegion != nullptr; pRegion = pRegion->pNextInWindow) {
+            // Buckets are shared by windows that hash together.
+            if (pRegion->pFree >= pLo && pRegion->pFree <= pHi) {
+                return pRegion;
+            }
+        }
+    }
+    return nullptr;
 }
 
 static PBYTE detour_alloc_round_down_to_region(PBYTE pbTry)
@@ -1131,6 +1234,131 @@ static PBYTE detour_alloc_round_up_to_region(PBYTE pbTry)
     return pbTry;
 }
 
+///////////////////////////////////////////////////// Address Space Snapshot.
+//
+// The region search probes the address space near each target one span at a
+// time.  Spans already seen during the current transaction are kept in an
+// array sorted by address, so repeated searches (the four +/-1GB passes in
+// detour_alloc_trampoline, or many targets in the same module) are answered
+// by a binary search instead of another query.  The snapshot is dropped at
+// DetourTransactionBegin, and any span we allocate in, free, or fail to
+// allocate in is evicted so the next probe goes back to the OS.
+//
+struct DETOUR_VM_SPAN
+{
+    PBYTE               pbBase;
+    PBYTE               pbLimit;
+    PBYTE               pbAllocationBase;
+    DWORD               dwState;
+};
+
+const ULONG DETOUR_VM_SPANS = 256;
+static DETOUR_VM_SPAN   s_rVmSpans[DETOUR_VM_SPANS];
+static ULONG            s_nVmSpans      = 0;
+static ULONG            s_nVmQueries    = 0;    // Probes that went to the OS.
+static ULONG            s_nVmHits       = 0;    // Probes answered from the snapshot.
+
+static void detour_vm_reset()
+{
+    s_nVmSpans = 0;
+    s_nVmQueries = 0;
+    s_nVmHits = 0;
+}
+
+// Index of the first span whose limit is above pbAddress.
+static ULONG detour_vm_lower_bound(PBYTE pbAddress)
+{
+    ULONG nLo = 0;
+    ULONG nHi = s_nVmSpans;
+
+    while (nLo < nHi) {
+        ULONG nMid = nLo + (nHi - nLo) / 2;
+        if (s_rVmSpans[nMid].pbLimit <= pbAddress) {
+            nLo = nMid + 1;
+        }
+        else {
+            nHi = nMid;
+        }
+    }
+    return nLo;
+}
+
+static void detour_vm_evict(PBYTE pbBase, PBYTE pbLimit)
+{
+    ULONG nBeg = detour_vm_lower_bound(pbBase);
+    ULONG nEnd = nBeg;
+
+    while (nEnd < s_nVmSpans && s_rVmSpans[nEnd].pbBase < pbLimit) {
+        nEnd++;
+    }
+    if (nEnd > nBeg) {
+        memmove(&s_rVmSpans[nBeg], &s_rVmSpans[nEnd],
+                (s_nVmSpans - nEnd) * sizeof(s_rVmSpans[0]));
+        s_nVmSpans -= nEnd - nBeg;
+    }
+}
+
+static void detour_vm_insert(PMEMORY_BASIC_INFORMATION pmbi)
+{
+    PBYTE pbBase = (PBYTE)pmbi->BaseAddress;
+    PBYTE pbLimit = pbBase + pmbi->RegionSize;
+
+    if (pbLimit <= pbBase) {
+        return;
+    }
+
+    // Anything overlapping the fresh answer is stale.
+    detour_vm_evict(pbBase, pbLimit);
+
+    if (s_nVmSpans >= DETOUR_VM_SPANS) {
+        s_nVmSpans = 0;
+    }
+
+    ULONG n = detour_vm_lower_bound(pbBase);
+    memmove(&s_rVmSpans[n + 1], &s_rVmSpans[n],
+            (s_nVmSpans - n) * sizeof(s_rVmSpans[0]));
+    s_rVmSpans[n].pbBase = pbBase;
+    s_rVmSpans[n].pbLimit = pbLimit;
+    s_rVmSpans[n].pbAllocationBase = (PBYTE)pmbi->AllocationBase;
+    s_rVmSpans[n].dwState = pmbi->State;
+    s_nVmSpans++;
+}
+
+// Same contract as VirtualQuery for the fields the region search reads:
+// BaseAddress, RegionSize, AllocationBase and State.
+static BOOL detour_vm_query(PBYTE pbTry, PMEMORY_BASIC_INFORMATION pmbi)
+{
+    // pbTry is always region aligned, so it is also page aligned.
+    ULONG n = detour_vm_lower_bound(pbTry);
+    if (n < s_nVmSpans && s_rVmSpans[n].pbBase <= pbTry) {
+        pmbi->BaseAddress = pbTry;
+        pmbi->RegionSize = s_rVmSpans[n].pbLimit - pbTry;
+        pmbi->AllocationBase = s_rVmSpans[n].pbAllocationBase;
+        pmbi->State = s_rVmSpans[n].dwState;
+        s_nVmHits++;
+        return TRUE;
+    }
+
+    s_nVmQueries++;
+    if (!DetoursQueryVirtualMemory(pbTry, pmbi, sizeof(*pmbi))) {
+        return FALSE;
+    }
+    detour_vm_insert(pmbi);
+    return TRUE;
+}
+
+static PVOID detour_alloc_region_at(PBYTE pbTry)
+{
+    PVOID pv = DetoursAllocateVirtualMemory(pbTry,
+                                            DETOUR_REGION_SIZE,
+                                            MEM_COMMIT|MEM_RESERVE,
+                                            PAGE_EXECUTE_READWRITE);
+
+    // Either the span is no longer free, or our snapshot of it was wrong.
+    detour_vm_evict(pbTry, pbTry + DETOUR_REGION_SIZE);
+    return pv;
+}
+
 // Starting at pbLo, try to allocate a memory region, continue until pbHi.
 
 static PVOID detour_alloc_region_from_lo(PBYTE pbLo, PBYTE pbHi)
@@ -1149,7 +1377,7 @@ static PVOID detour_alloc_region_from_lo(PBYTE pbLo, PBYTE pbHi)
         }
 
         RtlSecureZeroMemory(&mbi, sizeof(mbi));
-        if (!VirtualQuery(pbTry, &mbi, sizeof(mbi))) {
+        if (!detour_vm_query(pbTry, &mbi)) {
             break;
         }
 
@@ -1161,10 +1389,7 @@ static PVOID detour_alloc_region_from_lo(PBYTE pbLo, PBYTE pbHi)
 
         if (mbi.State == MEM_FREE && mbi.RegionSize >= DETOUR_REGION_SIZE) {
 
-            PVOID pv = VirtualAlloc(pbTry,
-                                    DETOUR_REGION_SIZE,
-                                    MEM_COMMIT|MEM_RESERVE,
-                                    PAGE_EXECUTE_READWRITE);
+            PVOID pv = detour_alloc_region_at(pbTry);
             if (pv != nullptr) {
                 return pv;
             }
@@ -1196,7 +1421,7 @@ static PVOID detour_alloc_region_from_hi(PBYTE pbLo, PBYTE pbHi)
         }
 
         RtlSecureZeroMemory(&mbi, sizeof(mbi));
-        if (!VirtualQuery(pbTry, &mbi, sizeof(mbi))) {
+        if (!detour_vm_query(pbTry, &mbi)) {
             break;
         }
 
@@ -1208,10 +1433,7 @@ static PVOID detour_alloc_region_from_hi(PBYTE pbLo, PBYTE pbHi)
 
         if (mbi.State == MEM_FREE && mbi.RegionSize >= DETOUR_REGION_SIZE) {
 
-            PVOID pv = VirtualAlloc(pbTry,
-                                    DETOUR_REGION_SIZE,
-                                    MEM_COMMIT|MEM_RESERVE,
-                                    PAGE_EXECUTE_READWRITE);
+            PVOID pv = detour_alloc_region_at(pbTry);
             if (pv != nullptr) {
                 return pv;
             }
@@ -1251,17 +1473,25 @@ static PDETOUR_TRAMPOLINE detour_alloc_trampoline(PBYTE pbTarget)
         if (pTrampoline < pLo || pTrampoline > pHi) {
             return nullptr;
         }
+        if (!detour_writable_trampoline_region(s_pRegion)) {
+            return nullptr;
+        }
+        if (pTrampoline->pbRemain == nullptr &&
+            !detour_region_unlink_window(s_pRegion)) {
+            return nullptr;
+        }
         s_pRegion->pFree = (PDETOUR_TRAMPOLINE)pTrampoline->pbRemain;
+        if (s_pRegion->cLive++ == 0) {
+            s_nEmptyRegions--;
+        }
         memset(pTrampoline, 0xcc, sizeof(*pTrampoline));
         return pTrampoline;
     }
 
-    // Then check the existing regions for a valid free block.
-    for (s_pRegion = s_pRegions; s_pRegion != nullptr; s_pRegion = s_pRegion->pNext) {
-        if (s_pRegion != nullptr && s_pRegion->pFree != nullptr &&
-            s_pRegion->pFree >= pLo && s_pRegion->pFree <= pHi) {
-            goto found_region;
-        }
+    // Then check the existing regions in reach for a valid free block.
+    s_pRegion = detour_region_find_window(pLo, pHi);
+    if (s_pRegion != nullptr) {
+        goto found_region;
     }
 
     // We need to allocate a new region.
@@ -1302,23 +1532,37 @@ static PDETOUR_TRAMPOLINE detour_alloc_trampoline(PBYTE pbTarget)
         pbTry = detour_alloc_region_from_lo(pbTarget, (PBYTE)pHi);
     }
 
+    DETOUR_TRACE(("  Region search: %d queries, %d snapshot hits, %d spans\n",
+                  s_nVmQueries, s_nVmHits, s_nVmSpans));
+
     if (pbTry != nullptr) {
-        s_pRegion = (DETOUR_REGION*)pbTry;
-        s_pRegion->dwSignature = DETOUR_REGION_SIGNATURE;
-        s_pRegion->pFree = nullptr;
-        s_pRegion->pNext = s_pRegions;
-        s_pRegions = s_pRegion;
-        DETOUR_TRACE(("  Allocated region %p..%p\n\n",
-                      s_pRegion, ((PBYTE)s_pRegion) + DETOUR_REGION_SIZE - 1));
+        PDETOUR_REGION pRegion = (DETOUR_REGION*)pbTry;
+        pRegion->dwSignature = DETOUR_REGION_SIGNATURE;
+        pRegion->cLive = 0;
+        pRegion->fWritable = TRUE;
+        pRegion->pFree = nullptr;
 
         // Put everything but the first trampoline on the free list.
         PBYTE pFree = nullptr;
-        pTrampoline = ((PDETOUR_TRAMPOLINE)s_pRegion) + 1;
+        pTrampoline = ((PDETOUR_TRAMPOLINE)pRegion) + 1;
         for (int i = DETOUR_TRAMPOLINES_PER_REGION - 1; i > 1; i--) {
             pTrampoline[i].pbRemain = pFree;
             pFree = (PBYTE)&pTrampoline[i];
         }
-        s_pRegion->pFree = (PDETOUR_TRAMPOLINE)pFree;
+        pRegion->pFree = (PDETOUR_TRAMPOLINE)pFree;
+
+        if (!detour_region_link_window(pRegion)) {
+            DetoursFreeVirtualMemory(pRegion);
+            detour_vm_evict((PBYTE)pRegion, (PBYTE)pRegion + DETOUR_REGION_SIZE);
+            return nullptr;
+        }
+
+        s_pRegion = pRegion;
+        s_pRegion->pNext = s_pRegions;
+        s_pRegions = s_pRegion;
+        s_nEmptyRegions++;
+        DETOUR_TRACE(("  Allocated region %p..%p\n\n",
+                      s_pRegion, ((PBYTE)s_pRegion) + DETOUR_REGION_SIZE - 1));
         goto found_region;
     }
 
@@ -1326,14 +1570,28 @@ static PDETOUR_TRAMPOLINE detour_alloc_trampoline(PBYTE pbTarget)
     return nullptr;
 }
 
-static void detour_free_trampoline(PDETOUR_TRAMPOLINE pTrampoline)
+// Returns FALSE, leaving the region unchanged, if it couldn't be made
+// writable; the trampoline then stays allocated.
+//
+static BOOL detour_free_trampoline(PDETOUR_TRAMPOLINE pTrampoline)
 {
     PDETOUR_REGION pRegion = (PDETOUR_REGION)
         ((ULONG_PTR)pTrampoline & ~(ULONG_PTR)0xffff);
 
+    if (!detour_writable_trampoline_region(pRegion)) {
+        return FALSE;
+    }
+    if (pRegion->pFree == nullptr && !detour_region_link_window(pRegion)) {
+        return FALSE;
+    }
+
     memset(pTrampoline, 0, sizeof(*pTrampoline));
     pTrampoline->pbRemain = (PBYTE)pRegion->pFree;
     pRegion->pFree = pTrampoline;
+    if (--pRegion->cLive == 0) {
+        s_nEmptyRegions++;
+    }
+    return TRUE;
 }
 
 static BOOL detour_is_region_empty(PDETOUR_REGION pRegion)
@@ -1343,21 +1601,7 @@ static BOOL detour_is_region_empty(PDETOUR_REGION pRegion)
         return FALSE;
     }
 
-    PBYTE pbRegionBeg = (PBYTE)pRegion;
-    PBYTE pbRegionLim  = pbRegionBeg + DETOUR_REGION_SIZE;
-
-    // Stop if any of the trampolines aren't free.
-    PDETOUR_TRAMPOLINE pTrampoline = ((PDETOUR_TRAMPOLINE)pRegion) + 1;
-    for (int i = 0; i < DETOUR_TRAMPOLINES_PER_REGION; i++) {
-        if (pTrampoline[i].pbRemain != nullptr &&
-            (pTrampoline[i].pbRemain < pbRegionBeg ||
-             pTrampoline[i].pbRemain >= pbRegionLim)) {
-            return FALSE;
-        }
-    }
-
-    // OK, the region is empty.
-    return TRUE;
+    return pRegion->cLive == 0;
 }
 
 static void detour_free_unused_trampoline_regions()
@@ -1365,11 +1609,14 @@ static void detour_free_unused_trampoline_regions()
     PDETOUR_REGION *ppRegionBase = &s_pRegions;
     PDETOUR_REGION pRegion = s_pRegions;
 
-    while (pRegion != nullptr) {
-        if (detour_is_region_empty(pRegion)) {
+    while (pRegion != nullptr && s_nEmptyRegions != 0) {
+        // Keep an empty region whose neighbors can't be made writable.
+        if (detour_is_region_empty(pRegion) && detour_region_unlink_window(pRegion)) {
             *ppRegionBase = pRegion->pNext;
+            s_nEmptyRegions--;
 
-            VirtualFree(pRegion, 0, MEM_RELEASE);
+            DetoursFreeVirtualMemory(pRegion);
+            detour_vm_evict((PBYTE)pRegion, (PBYTE)pRegion + DETOUR_REGION_SIZE);
             s_pRegion = nullptr;
         }
         else {
@@ -1385,6 +1632,7 @@ struct DetourThread
 {
     DetourThread *      pNext;
     HANDLE              hThread;
+    BOOL                fCloseHandle;
 };
 
 struct DetourOperation
@@ -1406,6 +1654,344 @@ static PVOID *              s_ppPendingError        = nullptr;
 static DetourThread *       s_pPendingThreads       = nullptr;
 static DetourOperation *    s_pPendingOperations    = nullptr;
 
+/////////////////////////////////////////////////////////// Transaction Arena.
+//
+// Operation and thread records only live as long as the transaction, so they
+// are carved out of a bump arena that is reset once at commit or abort.  The
+// largest block is kept for the next transaction, so a steady stream of
+// transactions makes no heap calls, in particular none while threads are
+// suspended.
+//
+struct DetourArenaBlock
+{
+    DetourArenaBlock *  pNext;      // Older (smaller) blocks.
+    SIZE_T              cbSize;     // Usable bytes after the header.
+    SIZE_T              cbUsed;
+};
+
+const SIZE_T DETOUR_ARENA_ALIGN = 16;
+const SIZE_T DETOUR_ARENA_HEADER = (sizeof(DetourArenaBlock) + DETOUR_ARENA_ALIGN - 1)
+                                   & ~(DETOUR_ARENA_ALIGN - 1);
+const SIZE_T DETOUR_ARENA_BLOCK_SIZE = 0x4000;
+
+static DetourArenaBlock *   s_pArena                = nullptr;
+
+inline SIZE_T detour_arena_align(SIZE_T cb)
+{
+    return (cb + DETOUR_ARENA_ALIGN - 1) & ~(DETOUR_ARENA_ALIGN - 1);
+}
+
+// Make sure the newest block has room for cb more bytes.
+static BOOL detour_arena_reserve(SIZE_T cb)
+{
+    cb = detour_arena_align(cb);
+
+    if (s_pArena != nullptr && s_pArena->cbUsed + cb <= s_pArena->cbSize) {
+        return TRUE;
+    }
+
+    // Grow geometrically so a large transaction needs few blocks.
+    SIZE_T cbBlock = DETOUR_ARENA_BLOCK_SIZE;
+    if (s_pArena != nullptr) {
+        cbBlock = (DETOUR_ARENA_HEADER + s_pArena->cbSize) * 2;
+    }
+    if (cbBlock < DETOUR_ARENA_HEADER + cb) {
+        cbBlock = DETOUR_ARENA_HEADER + cb;
+    }
+
+    DetourArenaBlock *pBlock = (DetourArenaBlock *)new NOTHROW BYTE [cbBlock];
+    if (pBlock == nullptr) {
+        return FALSE;
+    }
+    s_PendingStatistics.nHeapAllocations++;
+
+    pBlock->pNext = s_pArena;
+    pBlock->cbSize = cbBlock - DETOUR_ARENA_HEADER;
+    pBlock->cbUsed = 0;
+    s_pArena = pBlock;
+    return TRUE;
+}
+
+static PVOID detour_arena_alloc(SIZE_T cb)
+{
+    cb = detour_arena_align(cb);
+
+    if (!detour_arena_reserve(cb)) {
+        return nullptr;
+    }
+
+    PVOID pv = (PBYTE)s_pArena + DETOUR_ARENA_HEADER + s_pArena->cbUsed;
+    s_pArena->cbUsed += cb;
+    s_PendingStatistics.nArenaAllocations++;
+    return pv;
+}
+
+// Give back the most recent allocation, used on the failure paths.
+static void detour_arena_free(PVOID pv, SIZE_T cb)
+{
+    cb = detour_arena_align(cb);
+
+    if (s_pArena != nullptr && s_pArena->cbUsed >= cb &&
+        (PBYTE)pv == (PBYTE)s_pArena + DETOUR_ARENA_HEADER + s_pArena->cbUsed - cb) {
+        s_pArena->cbUsed -= cb;
+    }
+}
+
+static void detour_arena_reset()
+{
+    if (s_pArena == nullptr) {
+        return;
+    }
+
+    // Keep the newest block, it is the largest.
+    for (DetourArenaBlock *pBlock = s_pArena->pNext; pBlock != nullptr;) {
+        DetourArenaBlock *pNext = pBlock->pNext;
+        delete [] (PBYTE)pBlock;
+        pBlock = pNext;
+    }
+    s_pArena->pNext = nullptr;
+    s_pArena->cbUsed = 0;
+}
+
+//////////////////////////////////////////////////////// Target Page Batching.
+//
+// Targets that share pages are only made writable once per transaction, and
+// commit restores protection and flushes the icache once per run of
+// adjacent pages instead of once per operation.
+//
+static ULONG_PTR detour_page_mask()
+{
+    static ULONG_PTR s_cbPage = 0;
+
+    if (s_cbPage == 0) {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        s_cbPage = si.dwPageSize;
+    }
+    return s_cbPage - 1;
+}
+
+inline PBYTE detour_page_round_down(PBYTE pbAddress)
+{
+    return (PBYTE)((ULONG_PTR)pbAddress & ~detour_page_mask());
+}
+
+inline PBYTE detour_page_round_up(PBYTE pbAddress)
+{
+    return detour_page_round_down(pbAddress + detour_page_mask());
+}
+
+// The pages the pending operations have made writable, each with the
+// protection its operation saw first, in an open-addressed hash so attach
+// and detach find them in constant time.  An entry only counts if it has
+// the current generation, so DetourTransactionBegin empties the table by
+// bumping the generation.  The table is kept between transactions.
+//
+struct DetourWritablePage
+{
+    PBYTE               pbPage;
+    DWORD               dwPerm;
+    ULONG               nGeneration;
+};
+
+static DetourWritablePage * s_pWritablePages        = nullptr;
+static ULONG                s_nWritablePages        = 0;
+static ULONG                s_nWritablePagesMax     = 0;    // Power of two.
+static ULONG                s_nWritableGeneration   = 1;
+
+inline ULONG detour_writable_page_hash(PBYTE pbPage)
+{
+    return (ULONG)((ULONG_PTR)pbPage >> 12) * 2654435761u;
+}
+
+// Returns the entry for pbPage, or the empty slot where it would go.
+static DetourWritablePage * detour_probe_writable_page(PBYTE pbPage)
+{
+    ULONG nMask = s_nWritablePagesMax - 1;
+    for (ULONG n = detour_writable_page_hash(pbPage) & nMask;; n = (n + 1) & nMask) {
+        DetourWritablePage *p = &s_pWritablePages[n];
+        if (p->nGeneration != s_nWritableGeneration || p->pbPage == pbPage) {
+            return p;
+        }
+    }
+}
+
+static DetourWritablePage * detour_find_writable_page(PBYTE pbPage)
+{
+    if (s_nWritablePages == 0) {
+        return nullptr;
+    }
+    DetourWritablePage *p = detour_probe_writable_page(pbPage);
+    return (p->nGeneration == s_nWritableGeneration) ? p : nullptr;
+}
+
+// Keep the table at most half full for nPages entries.
+static BOOL detour_reserve_writable_pages(ULONG nPages)
+{
+    if (2 * nPages <= s_nWritablePagesMax) {
+        return TRUE;
+    }
+
+    ULONG nMax = s_nWritablePagesMax ? s_nWritablePagesMax * 2 : 128;
+    while (nMax < 2 * nPages) {
+        nMax *= 2;
+    }
+    DetourWritablePage *pPages = new NOTHROW DetourWritablePage [nMax];
+    if (pPages == nullptr) {
+        return FALSE;
+    }
+    s_PendingStatistics.nHeapAllocations++;
+    memset(pPages, 0, nMax * sizeof(DetourWritablePage));
+
+    DetourWritablePage *pOld = s_pWritablePages;
+    ULONG nOld = s_nWritablePagesMax;
+    s_pWritablePages = pPages;
+    s_nWritablePagesMax = nMax;
+
+    for (ULONG n = 0; n < nOld; n++) {
+        if (pOld[n].nGeneration == s_nWritableGeneration) {
+            *detour_probe_writable_page(pOld[n].pbPage) = pOld[n];
+        }
+    }
+    delete [] pOld;
+    return TRUE;
+}
+
+static void detour_reset_writable_pages()
+{
+    s_nWritablePages = 0;
+    if (++s_nWritableGeneration == 0) {
+        if (s_pWritablePages != nullptr) {
+            memset(s_pWritablePages, 0, s_nWritablePagesMax * sizeof(DetourWritablePage));
+        }
+        s_nWritableGeneration = 1;
+    }
+}
+
+// Record the pages a newly queued operation made writable.  The latest
+// operation on a page wins, as it saw the protection of the earlier one.
+static void detour_add_writable_pages(DetourOperation *o)
+{
+    PBYTE pbEnd = detour_page_round_up(o->pbTarget + o->pTrampoline->cbRestore);
+
+    for (PBYTE pbPage = detour_page_round_down(o->pbTarget);
+         pbPage < pbEnd; pbPage += detour_page_mask() + 1) {
+
+        // Reserved as the operation was queued; if not, later lookups
+        // just miss and make the page writable again.
+        if (2 * (s_nWritablePages + 1) > s_nWritablePagesMax) {
+            return;
+        }
+        DetourWritablePage *p = detour_probe_writable_page(pbPage);
+        if (p->nGeneration != s_nWritableGeneration) {
+            p->pbPage = pbPage;
+            p->nGeneration = s_nWritableGeneration;
+            s_nWritablePages++;
+        }
+        p->dwPerm = o->dwPerm;
+    }
+}
+
+static BOOL detour_writable_target(PBYTE pbTarget, ULONG cbTarget, PDWORD pdwOld)
+{
+    DetourWritablePage *pFirst = detour_find_writable_page(detour_page_round_down(pbTarget));
+    DetourWritablePage *pLast = detour_find_writable_page(detour_page_round_down(pbTarget
+                                                                                 + cbTarget - 1));
+
+    if (pFirst == nullptr || pLast == nullptr) {
+        s_PendingStatistics.nProtectCalls++;
+        if (!VirtualProtect(pbTarget, cbTarget, PAGE_EXECUTE_READWRITE, pdwOld)) {
+            return FALSE;
+        }
+    }
+    // The earlier operation saw the page before we made it writable.
+    if (pFirst != nullptr) {
+        *pdwOld = pFirst->dwPerm;
+    }
+    return TRUE;
+}
+
+static DetourOperation * detour_merge_operations(DetourOperation *pLeft,
+                                                 DetourOperation *pRight)
+{
+    DetourOperation *pHead = nullptr;
+    DetourOperation **ppTail = &pHead;
+
+    while (pLeft != nullptr && pRight != nullptr) {
+        if (pRight->pbTarget < pLeft->pbTarget) {
+            *ppTail = pRight;
+            pRight = pRight->pNext;
+        }
+        else {
+            *ppTail = pLeft;
+            pLeft = pLeft->pNext;
+        }
+        ppTail = &(*ppTail)->pNext;
+    }
+    *ppTail = (pLeft != nullptr) ? pLeft : pRight;
+    return pHead;
+}
+
+// Stable merge sort of the pending operations by target address.
+static DetourOperation * detour_sort_operations(DetourOperation *pList)
+{
+    if (pList == nullptr || pList->pNext == nullptr) {
+        return pList;
+    }
+
+    DetourOperation *pSlow = pList;
+    DetourOperation *pFast = pList->pNext;
+    while (pFast != nullptr && pFast->pNext != nullptr) {
+        pSlow = pSlow->pNext;
+        pFast = pFast->pNext->pNext;
+    }
+    DetourOperation *pBack = pSlow->pNext;
+    pSlow->pNext = nullptr;
+
+    return detour_merge_operations(detour_sort_operations(pList),
+                                   detour_sort_operations(pBack));
+}
+
+static void detour_restore_target_pages(BOOL fFlush)
+{
+    HANDLE hProcess = DetoursCurrentProcess();
+
+    s_pPendingOperations = detour_sort_operations(s_pPendingOperations);
+
+    for (DetourOperation *o = s_pPendingOperations; o != nullptr;) {
+        DetourOperation *oSpan = o;
+        PBYTE pbBeg = o->pbTarget;
+        PBYTE pbEnd = o->pbTarget + o->pTrampoline->cbRestore;
+        DWORD dwPerm = o->dwPerm;
+
+        // Extend the span over operations on the same or the next page.
+        for (o = o->pNext; o != nullptr; o = o->pNext) {
+            if (detour_page_round_down(o->pbTarget) > detour_page_round_up(pbEnd) ||
+                o->dwPerm != dwPerm) {
+                break;
+            }
+            if (o->pbTarget + o->pTrampoline->cbRestore > pbEnd) {
+                pbEnd = o->pbTarget + o->pTrampoline->cbRestore;
+            }
+        }
+
+        // We don't care if this fails, because the code is still accessible.
+        DWORD dwOld;
+        s_PendingStatistics.nProtectCalls++;
+        if (!VirtualProtect(pbBeg, pbEnd - pbBeg, dwPerm, &dwOld)) {
+            // The span crossed an allocation boundary, fall back to each target.
+            for (DetourOperation *p = oSpan; p != o; p = p->pNext) {
+                s_PendingStatistics.nProtectCalls++;
+                VirtualProtect(p->pbTarget, p->pTrampoline->cbRestore, dwPerm, &dwOld);
+            }
+        }
+        if (fFlush) {
+            s_PendingStatistics.nFlushCalls++;
+            FlushInstructionCache(hProcess, pbBeg, pbEnd - pbBeg);
+        }
+    }
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 PVOID DETOURS_API DetourCodeFromPointer(_In_ PVOID pPointer,
@@ -1414,6 +2000,77 @@ PVOID DETOURS_API DetourCodeFromPointer(_In_ PVOID pPointer,
     return detour_skip_jmp((PBYTE)pPointer, ppGlobals);
 }
 
+////////////////////////////////////////////////////////////// Decode Cache.
+//
+// Remembers how the prologue of a target was split into instructions so that
+// re-attaching the same target skips the disassembler.  Only prologues whose
+// instructions were copied to the trampoline unchanged (no relocation, no
+// branch expansion, no literal pool) are cached, so a hit is just a copy of
+// the target bytes.  An entry is only used if the target bytes still match.
+//
+#if defined(DETOURS_X86) || defined(DETOURS_X64) || defined(DETOURS_ARM64)
+#define DETOUR_DECODE_CACHE 1
+#endif
+
+#ifdef DETOUR_DECODE_CACHE
+
+struct DETOUR_DECODE_ENTRY
+{
+    PBYTE           pbTarget;
+    BYTE            cbTarget;       // bytes consumed, including filler.
+    BYTE            cbCode;         // bytes copied to the trampoline.
+    BYTE            nAlign;
+    BYTE            rbTarget[sizeof(((_DETOUR_TRAMPOLINE *)0)->rbRestore)];
+    _DETOUR_ALIGN   rAlign[8];
+};
+
+const ULONG DETOUR_DECODE_ENTRIES = 4096;
+
+static DETOUR_DECODE_ENTRY *    s_pDecodeCache          = nullptr;
+
+inline DETOUR_DECODE_ENTRY * detour_decode_slot(PBYTE pbTarget)
+{
+    ULONG_PTR n = (ULONG_PTR)pbTarget;
+    n ^= n >> 12;
+    n ^= n >> 4;
+    return &s_pDecodeCache[n & (DETOUR_DECODE_ENTRIES - 1)];
+}
+
+static DETOUR_DECODE_ENTRY * detour_decode_lookup(PBYTE pbTarget)
+{
+    if (s_pDecodeCache == nullptr) {
+        return nullptr;
+    }
+
+    DETOUR_DECODE_ENTRY *pEntry = detour_decode_slot(pbTarget);
+    if (pEntry->pbTarget != pbTarget ||
+        memcmp(pEntry->rbTarget, pbTarget, pEntry->cbTarget) != 0) {
+        s_PendingStatistics.nDecodeCacheMisses++;
+        return nullptr;
+    }
+    s_PendingStatistics.nDecodeCacheHits++;
+    return pEntry;
+}
+
+static void detour_decode_insert(PDETOUR_TRAMPOLINE pTrampoline,
+                                 PBYTE pbTarget,
+                                 ULONG nAlign)
+{
+    if (s_pDecodeCache == nullptr || pTrampoline->cbRestore > sizeof(pTrampoline->rbRestore)) {
+        return;
+    }
+
+    DETOUR_DECODE_ENTRY *pEntry = detour_decode_slot(pbTarget);
+    pEntry->pbTarget = pbTarget;
+    pEntry->cbTarget = pTrampoline->cbRestore;
+    pEntry->cbCode = pTrampoline->cbCode;
+    pEntry->nAlign = (BYTE)nAlign;
+    memcpy(pEntry->rbTarget, pTrampoline->rbRestore, pTrampoline->cbRestore);
+    memcpy(pEntry->rAlign, pTrampoline->rAlign, sizeof(pEntry->rAlign));
+}
+
+#endif // DETOUR_DECODE_CACHE
+
 //////////////////////////////////////////////////////////// Transaction APIs.
 //
 BOOL DETOURS_API DetourSetIgnoreTooSmall(_In_ BOOL fIgnore)
@@ -1430,6 +2087,30 @@ BOOL DETOURS_API DetourSetRetainRegions(_In_ BOOL fRetain)
     return fPrevious;
 }
 
+BOOL DETOURS_API DetourSetDecodeCache(_In_ BOOL fEnable)
+{
+#ifdef DETOUR_DECODE_CACHE
+    BOOL fPrevious = (s_pDecodeCache != nullptr);
+
+    if (fEnable && s_pDecodeCache == nullptr) {
+        s_pDecodeCache = new NOTHROW DETOUR_DECODE_ENTRY [DETOUR_DECODE_ENTRIES];
+        if (s_pDecodeCache == nullptr) {
+            DetoursSetLastError(DETOURS_STATUS_INSUFFICIENT_RESOURCES);
+            return fPrevious;
+        }
+        memset(s_pDecodeCache, 0, DETOUR_DECODE_ENTRIES * sizeof(DETOUR_DECODE_ENTRY));
+    }
+    else if (!fEnable && s_pDecodeCache != nullptr) {
+        delete [] s_pDecodeCache;
+        s_pDecodeCache = nullptr;
+    }
+    return fPrevious;
+#else
+    (void)fEnable;
+    return FALSE;
+#endif
+}
+
 PVOID DETOURS_API DetourSetSystemRegionLowerBound(_In_ PVOID pSystemRegionLowerBound)
 {
     PVOID pPrevious = s_pSystemRegionLowerBound;
@@ -1444,6 +2125,73 @@ PVOID DETOURS_API DetourSetSystemRegionUpperBound(_In_ PVOID pSystemRegionUpperB
     return pPrevious;
 }
 
+BOOL DETOURS_API DetourGetTransactionStatistics(_Out_ PDETOUR_TRANSACTION_STATISTICS pStatistics)
+{
+    if (pStatistics == nullptr) {
+        DetoursSetLastError(DETOURS_STATUS_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    *pStatistics = s_LastStatistics;
+    pStatistics->cb = sizeof(*pStatistics);
+    return TRUE;
+}
+
+//////////////////////////////////////////////////////// Thread Suspension.
+//
+static LARGE_INTEGER        s_liSuspendBegin;
+
+static LONG detour_update_thread(HANDLE hThread, BOOL fCloseHandle)
+{
+    DetourThread *t = (DetourThread *)detour_arena_alloc(sizeof(DetourThread));
+    if (t == nullptr) {
+        return DETOURS_STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (SuspendThread(hThread) == (DWORD)-1) {
+        LONG error = DetoursGetLastError();
+        detour_arena_free(t, sizeof(DetourThread));
+        return error;
+    }
+
+    if (s_PendingStatistics.nThreads++ == 0) {
+        QueryPerformanceCounter(&s_liSuspendBegin);
+    }
+
+    t->hThread = hThread;
+    t->fCloseHandle = fCloseHandle;
+    t->pNext = s_pPendingThreads;
+    s_pPendingThreads = t;
+
+    return DETOURS_STATUS_SUCCESS;
+}
+
+static void detour_resume_threads()
+{
+    for (DetourThread *t = s_pPendingThreads; t != nullptr;) {
+        // There is nothing we can do if this fails.
+        ResumeThread(t->hThread);
+        if (t->fCloseHandle) {
+            CloseHandle(t->hThread);
+        }
+
+        t = t->pNext;
+    }
+    s_pPendingThreads = nullptr;
+
+    if (s_PendingStatistics.nThreads != 0) {
+        LARGE_INTEGER liEnd;
+        LARGE_INTEGER liFrequency;
+        QueryPerformanceCounter(&liEnd);
+        QueryPerformanceFrequency(&liFrequency);
+
+        ULONGLONG ullElapsed = (ULONGLONG)(liEnd.QuadPart - s_liSuspendBegin.QuadPart);
+        ullElapsed = ullElapsed * 1000000 / (ULONGLONG)liFrequency.QuadPart;
+        s_PendingStatistics.nSuspendedMicroseconds =
+            ullElapsed > MAXDWORD ? MAXDWORD : (DWORD)ullElapsed;
+    }
+}
+
 LONG DETOURS_API DetourTransactionBegin()
 {
     // Only one transaction is allowed at a time.
@@ -1462,8 +2210,13 @@ _Benign_race_end_
     s_pPendingThreads = nullptr;
     s_ppPendingError = nullptr;
 
-    // Make sure the trampoline pages are writable.
-    s_nPendingError = detour_writable_trampoline_regions();
+    // Other threads may have changed the address space since the last one.
+    detour_vm_reset();
+
+    // Trampoline regions are made writable as the transaction touches them.
+    RtlSecureZeroMemory(&s_PendingStatistics, sizeof(s_PendingStatistics));
+    detour_reset_writable_pages();
+    s_nPendingError = DETOURS_STATUS_SUCCESS;
 
     return s_nPendingError;
 }
@@ -1475,22 +2228,20 @@ LONG DETOURS_API DetourTransactionAbort()
     }
 
     // Restore all of the page permissions.
-    for (DetourOperation *o = s_pPendingOperations; o != nullptr;) {
-        // We don't care if this fails, because the code is still accessible.
-        DWORD dwOld;
-        VirtualProtect(o->pbTarget, o->pTrampoline->cbRestore,
-                       o->dwPerm, &dwOld);
+    detour_restore_target_pages(FALSE);
 
+    LONG error = DETOURS_STATUS_SUCCESS;
+    for (DetourOperation *o = s_pPendingOperations; o != nullptr;) {
         if (!o->fIsRemove) {
             if (o->pTrampoline) {
-                detour_free_trampoline(o->pTrampoline);
+                if (!detour_free_trampoline(o->pTrampoline)) {
+                    error = DetoursGetLastError();
+                }
                 o->pTrampoline = nullptr;
             }
         }
 
-        DetourOperation *n = o->pNext;
-        delete o;
-        o = n;
+        o = o->pNext;
     }
     s_pPendingOperations = nullptr;
 
@@ -1498,18 +2249,12 @@ LONG DETOURS_API DetourTransactionAbort()
     detour_runnable_trampoline_regions();
 
     // Resume any suspended threads.
-    for (DetourThread *t = s_pPendingThreads; t != nullptr;) {
-        // There is nothing we can do if this fails.
-        ResumeThread(t->hThread);
-
-        DetourThread *n = t->pNext;
-        delete t;
-        t = n;
-    }
-    s_pPendingThreads = nullptr;
+    detour_resume_threads();
+    detour_arena_reset();
+    s_LastStatistics = s_PendingStatistics;
     s_nPendingThreadId = 0;
 
-    return DETOURS_STATUS_SUCCESS;
+    return error;
 }
 
 LONG DETOURS_API DetourTransactionCommit()
@@ -1537,6 +2282,169 @@ static LONG detour_align_from_target(PDETOUR_TRAMPOLINE pTrampoline, LONG obTarg
     return 0;
 }
 
+///////////////////////////////////////////////////////// Thread PC Fixups.
+//
+// A suspended thread whose PC sits in code we are moving has to be moved
+// along with it.  Each operation covers one address range: the original
+// target bytes for an attach and the trampoline copy for a detach.  The
+// ranges are sorted once per commit so each thread is a binary search.
+//
+struct DetourFixup
+{
+    ULONG_PTR           nBeg;       // First address covered.
+    ULONG_PTR           nEnd;       // One past the last address covered.
+    DetourOperation *   pOperation;
+};
+
+static BOOL detour_relocate_pc(DetourOperation *o, ULONG_PTR *pnPc)
+{
+    ULONG_PTR nPc = *pnPc;
+
+    if (o->fIsRemove) {
+        ULONG_PTR nCode = (ULONG_PTR)o->pTrampoline->rbCode;
+        if (nPc >= nCode && nPc < nCode + o->pTrampoline->cbCode) {
+            *pnPc = (ULONG_PTR)o->pbTarget
+                + detour_align_from_trampoline(o->pTrampoline, (BYTE)(nPc - nCode));
+            return TRUE;
+        }
+    }
+    else {
+        ULONG_PTR nTarget = (ULONG_PTR)o->pbTarget;
+        if (nPc >= nTarget && nPc < nTarget + o->pTrampoline->cbRestore) {
+            *pnPc = (ULONG_PTR)o->pTrampoline->rbCode
+                + detour_align_from_target(o->pTrampoline, (LONG)(nPc - nTarget));
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static void detour_sift_fixups(DetourFixup *pFixups, ULONG nRoot, ULONG nFixups)
+{
+    for (;;) {
+        ULONG nChild = 2 * nRoot + 1;
+        if (nChild >= nFixups) {
+            return;
+        }
+        if (nChild + 1 < nFixups && pFixups[nChild].nBeg < pFixups[nChild + 1].nBeg) {
+            nChild++;
+        }
+        if (pFixups[nRoot].nBeg >= pFixups[nChild].nBeg) {
+            return;
+        }
+
+        DetourFixup fixup = pFixups[nRoot];
+        pFixups[nRoot] = pFixups[nChild];
+        pFixups[nChild] = fixup;
+        nRoot = nChild;
+    }
+}
+
+// Heap sort by start address: in place, no recursion, no CRT.
+static void detour_sort_fixups(DetourFixup *pFixups, ULONG nFixups)
+{
+    for (ULONG n = nFixups / 2; n-- > 0;) {
+        detour_sift_fixups(pFixups, n, nFixups);
+    }
+    for (ULONG n = nFixups; n-- > 1;) {
+        DetourFixup fixup = pFixups[0];
+        pFixups[0] = pFixups[n];
+        pFixups[n] = fixup;
+        detour_sift_fixups(pFixups, 0, n);
+    }
+}
+
+// The fixup array is built while threads are suspended, so it must not come
+// from the heap then.  DetourAttachEx and DetourDetach grow it, through
+// detour_reserve_operation, as each operation is queued, and, like the
+// arena, it is kept for the next transaction.
+static DetourFixup *        s_pFixups               = nullptr;
+static ULONG                s_nFixupsMax            = 0;
+
+static BOOL detour_reserve_fixups(ULONG nFixups)
+{
+    if (nFixups <= s_nFixupsMax) {
+        return TRUE;
+    }
+
+    ULONG nMax = s_nFixupsMax ? s_nFixupsMax * 2 : 64;
+    if (nMax < nFixups) {
+        nMax = nFixups;
+    }
+    DetourFixup *pFixups = new NOTHROW DetourFixup [nMax];
+    if (pFixups == nullptr) {
+        return FALSE;
+    }
+    s_PendingStatistics.nHeapAllocations++;
+
+    // Nothing lives in the array between commits, so there is nothing to copy.
+    delete [] s_pFixups;
+    s_pFixups = pFixups;
+    s_nFixupsMax = nMax;
+    return TRUE;
+}
+
+// Sizes everything commit needs for one more operation, as it is queued.
+// rbRestore is smaller than a page, so an operation spans at most two pages.
+static BOOL detour_reserve_operation()
+{
+    return detour_reserve_fixups(s_PendingStatistics.nOperations + 1) &&
+        detour_reserve_writable_pages(s_nWritablePages + 2);
+}
+
+static DetourFixup * detour_build_fixups(ULONG *pnFixups)
+{
+    ULONG nFixups = 0;
+    for (DetourOperation *o = s_pPendingOperations; o != nullptr; o = o->pNext) {
+        nFixups++;
+    }
+
+    // Only use space reserved when the operations were queued.
+    if (nFixups > s_nFixupsMax) {
+        return nullptr;
+    }
+
+    DetourFixup *pFixups = s_pFixups;
+    DetourFixup *pFixup = pFixups;
+    for (DetourOperation *o = s_pPendingOperations; o != nullptr; o = o->pNext, pFixup++) {
+        if (o->fIsRemove) {
+            pFixup->nBeg = (ULONG_PTR)o->pTrampoline->rbCode;
+            pFixup->nEnd = pFixup->nBeg + o->pTrampoline->cbCode;
+        }
+        else {
+            pFixup->nBeg = (ULONG_PTR)o->pbTarget;
+            pFixup->nEnd = pFixup->nBeg + o->pTrampoline->cbRestore;
+        }
+        pFixup->pOperation = o;
+    }
+
+    detour_sort_fixups(pFixups, nFixups);
+
+    *pnFixups = nFixups;
+    return pFixups;
+}
+
+static DetourOperation * detour_find_fixup(DetourFixup *pFixups, ULONG nFixups, ULONG_PTR nPc)
+{
+    // Find the last range starting at or below nPc.
+    ULONG nLo = 0;
+    ULONG nHi = nFixups;
+    while (nLo < nHi) {
+        ULONG nMid = nLo + (nHi - nLo) / 2;
+        if (pFixups[nMid].nBeg <= nPc) {
+            nLo = nMid + 1;
+        }
+        else {
+            nHi = nMid;
+        }
+    }
+
+    if (nLo > 0 && nPc < pFixups[nLo - 1].nEnd) {
+        return pFixups[nLo - 1].pOperation;
+    }
+    return nullptr;
+}
+
 LONG DETOURS_API DetourTransactionCommitEx(_Out_opt_ PVOID **pppFailedPointer)
 {
     if (pppFailedPointer != nullptr) {
@@ -1690,9 +2598,13 @@ LONG DETOURS_API DetourTransactionCommitEx(_Out_opt_ PVOID **pppFailedPointer)
     }
 
     // Update any suspended threads.
-    for (t = s_pPendingThreads; t != nullptr; t = t->pNext) {
-        CONTEXT cxt;
-        cxt.ContextFlags = CONTEXT_CONTROL;
+    if (s_pPendingThreads != nullptr) {
+        ULONG nFixups = 0;
+        DetourFixup *pFixups = detour_build_fixups(&nFixups);
+
+        for (t = s_pPendingThreads; t != nullptr; t = t->pNext) {
+            CONTEXT cxt;
+            cxt.ContextFlags = CONTEXT_CONTROL;
 
 #undef DETOURS_EIP
 
@@ -1718,62 +2630,47 @@ LONG DETOURS_API DetourTransactionCommitEx(_Out_opt_ PVOID **pppFailedPointer)
 
 typedef ULONG_PTR DETOURS_EIP_TYPE;
 
-        if (GetThreadContext(t->hThread, &cxt)) {
-            for (o = s_pPendingOperations; o != nullptr; o = o->pNext) {
-                if (o->fIsRemove) {
-                    if (cxt.DETOURS_EIP >= (DETOURS_EIP_TYPE)(ULONG_PTR)o->pTrampoline &&
-                        cxt.DETOURS_EIP < (DETOURS_EIP_TYPE)((ULONG_PTR)o->pTrampoline
-                                                             + sizeof(o->pTrampoline))
-                       ) {
-
-                        cxt.DETOURS_EIP = (DETOURS_EIP_TYPE)
-                            ((ULONG_PTR)o->pbTarget
-                             + detour_align_from_trampoline(o->pTrampoline,
-                                                            (BYTE)(cxt.DETOURS_EIP
-                                                                   - (DETOURS_EIP_TYPE)(ULONG_PTR)
-                                                                   o->pTrampoline)));
+            if (GetThreadContext(t->hThread, &cxt)) {
+                ULONG_PTR nPc = (ULONG_PTR)cxt.DETOURS_EIP;
 
+                if (pFixups != nullptr) {
+                    o = detour_find_fixup(pFixups, nFixups, nPc);
+                    if (o != nullptr && detour_relocate_pc(o, &nPc)) {
+                        cxt.DETOURS_EIP = (DETOURS_EIP_TYPE)nPc;
                         SetThreadContext(t->hThread, &cxt);
                     }
                 }
                 else {
-                    if (cxt.DETOURS_EIP >= (DETOURS_EIP_TYPE)(ULONG_PTR)o->pbTarget &&
-                        cxt.DETOURS_EIP < (DETOURS_EIP_TYPE)((ULONG_PTR)o->pbTarget
-                                                             + o->pTrampoline->cbRestore)
-                       ) {
-
-                        cxt.DETOURS_EIP = (DETOURS_EIP_TYPE)
-                            ((ULONG_PTR)o->pTrampoline
-                             + detour_align_from_target(o->pTrampoline,
-                                                        (BYTE)(cxt.DETOURS_EIP
-                                                               - (DETOURS_EIP_TYPE)(ULONG_PTR)
-                                                               o->pbTarget)));
-
-                        SetThreadContext(t->hThread, &cxt);
+                    // No room for the index, so check each operation.
+                    for (o = s_pPendingOperations; o != nullptr; o = o->pNext) {
+                        if (detour_relocate_pc(o, &nPc)) {
+                            cxt.DETOURS_EIP = (DETOURS_EIP_TYPE)nPc;
+                            SetThreadContext(t->hThread, &cxt);
+                            break;
+                        }
                     }
                 }
             }
-        }
 #undef DETOURS_EIP
+        }
     }
 
     // Restore all of the page permissions and flush the icache.
-    HANDLE hProcess = DetoursCurrentProcess();
-    for (o = s_pPendingOperations; o != nullptr;) {
-        // We don't care if this fails, because the code is still accessible.
-        DWORD dwOld;
-        VirtualProtect(o->pbTarget, o->pTrampoline->cbRestore, o->dwPerm, &dwOld);
-        FlushInstructionCache(hProcess, o->pbTarget, o->pTrampoline->cbRestore);
+    detour_restore_target_pages(TRUE);
 
+    for (o = s_pPendingOperations; o != nullptr;) {
         if (o->fIsRemove && o->pTrampoline) {
-            detour_free_trampoline(o->pTrampoline);
+            if (detour_free_trampoline(o->pTrampoline)) {
+                freed = true;
+            }
+            else if (s_nPendingError == DETOURS_STATUS_SUCCESS) {
+                s_nPendingError = DetoursGetLastError();
+                s_ppPendingError = (PVOID *)o->ppbPointer;
+            }
             o->pTrampoline = nullptr;
-            freed = true;
         }
 
-        DetourOperation *n = o->pNext;
-        delete o;
-        o = n;
+        o = o->pNext;
     }
     s_pPendingOperations = nullptr;
 
@@ -1786,17 +2683,19 @@ typedef ULONG_PTR DETOURS_EIP_TYPE;
     detour_runnable_trampoline_regions();
 
     // Resume any suspended threads.
-    for (t = s_pPendingThreads; t != nullptr;) {
-        // There is nothing we can do if this fails.
-        ResumeThread(t->hThread);
-
-        DetourThread *n = t->pNext;
-        delete t;
-        t = n;
-    }
-    s_pPendingThreads = nullptr;
+    detour_resume_threads();
+    detour_arena_reset();
+    s_LastStatistics = s_PendingStatistics;
     s_nPendingThreadId = 0;
 
+    DETOUR_TRACE(("detours: commit %d operations, %d protects, %d flushes,"
+                  " %d arena allocations, %d heap allocations\n",
+                  s_LastStatistics.nOperations,
+                  s_LastStatistics.nProtectCalls,
+                  s_LastStatistics.nFlushCalls,
+                  s_LastStatistics.nArenaAllocations,
+                  s_LastStatistics.nHeapAllocations));
+
     if (pppFailedPointer != nullptr) {
         *pppFailedPointer = s_ppPendingError;
     }
@@ -1818,31 +2717,93 @@ LONG DETOURS_API DetourUpdateThread(_In_ HANDLE hThread)
         return DETOURS_STATUS_SUCCESS;
     }
 
-    DetourThread *t = new NOTHROW DetourThread;
-    if (t == nullptr) {
-        error = DETOURS_STATUS_INSUFFICIENT_RESOURCES;
-      fail:
-        if (t != nullptr) {
-            delete t;
-            t = nullptr;
-        }
+    error = detour_update_thread(hThread, FALSE);
+    if (error != DETOURS_STATUS_SUCCESS) {
         s_nPendingError = error;
         s_ppPendingError = nullptr;
         DETOUR_BREAK();
         return error;
     }
 
-    if (SuspendThread(hThread) == (DWORD)-1) {
+    return DETOURS_STATUS_SUCCESS;
+}
+
+LONG DETOURS_API DetourUpdateAllThreads()
+{
+    LONG error;
+
+    if (s_nPendingThreadId != (LONG)DetoursCurrentThreadId()) {
+        return DETOURS_STATUS_INVALID_OPERATION;
+    }
+
+    // If any of the pending operations failed, then we don't need to do this.
+    if (s_nPendingError != DETOURS_STATUS_SUCCESS) {
+        return s_nPendingError;
+    }
+
+    const DWORD dwProcessId = GetCurrentProcessId();
+    const DWORD dwThreadId = GetCurrentThreadId();
+
+    HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (hSnapshot == INVALID_HANDLE_VALUE) {
         error = DetoursGetLastError();
-        DETOUR_BREAK();
         goto fail;
     }
 
-    t->hThread = hThread;
-    t->pNext = s_pPendingThreads;
-    s_pPendingThreads = t;
+    THREADENTRY32 te;
+    DWORD cThreads;
+
+    // Count first, so the thread records never come from the heap while
+    // another thread (which may hold the heap lock) is suspended.
+    cThreads = 0;
+    te.dwSize = sizeof(te);
+    for (BOOL fMore = Thread32First(hSnapshot, &te); fMore; fMore = Thread32Next(hSnapshot, &te)) {
+        if (te.th32OwnerProcessID == dwProcessId && te.th32ThreadID != dwThreadId) {
+            cThreads++;
+        }
+    }
+    if (!detour_arena_reserve(cThreads * detour_arena_align(sizeof(DetourThread)))) {
+        CloseHandle(hSnapshot);
+        error = DETOURS_STATUS_INSUFFICIENT_RESOURCES;
+        goto fail;
+    }
+
+    te.dwSize = sizeof(te);
+    for (BOOL fMore = Thread32First(hSnapshot, &te); fMore; fMore = Thread32Next(hSnapshot, &te)) {
+        if (te.th32OwnerProcessID != dwProcessId || te.th32ThreadID == dwThreadId) {
+            continue;
+        }
+
+        HANDLE hThread = OpenThread(THREAD_SUSPEND_RESUME |
+                                    THREAD_GET_CONTEXT |
+                                    THREAD_SET_CONTEXT,
+                                    FALSE, te.th32ThreadID);
+        if (hThread == nullptr) {
+            // The thread exited after the snapshot was taken.
+            continue;
+        }
 
+        error = detour_update_thread(hThread, TRUE);
+        if (error != DETOURS_STATUS_SUCCESS) {
+            CloseHandle(hThread);
+            if (error == ERROR_ACCESS_DENIED) {
+                // The thread is exiting, it will never run the target code.
+                continue;
+            }
+            CloseHandle(hSnapshot);
+            goto fail;
+        }
+    }
+    CloseHandle(hSnapshot);
+
+    DETOUR_TRACE(("detours: suspended %d threads\n", s_PendingStatistics.nThreads));
     return DETOURS_STATUS_SUCCESS;
+
+  fail:
+    s_nPendingError = error;
+    s_ppPendingError = nullptr;
+    DETOUR_BREAK();
+    return error;
 }
 
 ///////////////////////////////////////////////////////////// Transacted APIs.
@@ -1939,7 +2900,9 @@ LONG DETOURS_API DetourAttachEx(_Inout_ PVOID *ppPointer,
         *ppRealDetour = pDetour;
     }
 
-    o = new NOTHROW DetourOperation;
+    if (detour_reserve_operation()) {
+        o = (DetourOperation *)detour_arena_alloc(sizeof(DetourOperation));
+    }
     if (o == nullptr) {
         error = DETOURS_STATUS_INSUFFICIENT_RESOURCES;
       fail:
@@ -1954,7 +2917,7 @@ LONG DETOURS_API DetourAttachEx(_Inout_ PVOID *ppPointer,
             }
         }
         if (o != nullptr) {
-            delete o;
+            detour_arena_free(o, sizeof(DetourOperation));
             o = nullptr;
         }
         s_ppPendingError = ppPointer;
@@ -2018,6 +2981,21 @@ LONG DETOURS_API DetourAttachEx(_Inout_ PVOID *ppPointer,
     }
 #endif
 
+#ifdef DETOUR_DECODE_CACHE
+    BOOL fVerbatim = TRUE;
+    DETOUR_DECODE_ENTRY *pEntry = detour_decode_lookup(pbTarget);
+    if (pEntry != nullptr) {
+        memcpy(pbTrampoline, pbTarget, pEntry->cbCode);
+        memcpy(pTrampoline->rAlign, pEntry->rAlign, sizeof(pTrampoline->rAlign));
+        pbTrampoline += pEntry->cbCode;
+        pbSrc = pbTarget + pEntry->cbTarget;
+        cbTarget = pEntry->cbTarget;
+        nAlign = pEntry->nAlign;
+        fVerbatim = FALSE;
+        // We will fall through both "while" loops because cbTarget is now >= cbJump.
+    }
+#endif
+
     while (cbTarget < cbJump) {
         PBYTE pbOp = pbSrc;
         LONG lExtra = 0;
@@ -2028,6 +3006,11 @@ LONG DETOURS_API DetourAttachEx(_Inout_ PVOID *ppPointer,
             DetourCopyInstruction(pbTrampoline, (PVOID*)&pbPool, pbSrc, nullptr, &lExtra);
         DETOUR_TRACE((" DetourCopyInstruction() = %p (%d bytes)\n",
                       pbSrc, (int)(pbSrc - pbOp)));
+#ifdef DETOUR_DECODE_CACHE
+        if (lExtra != 0 || memcmp(pbTrampoline, pbOp, pbSrc - pbOp) != 0) {
+            fVerbatim = FALSE;
+        }
+#endif
         pbTrampoline += (pbSrc - pbOp) + lExtra;
         cbTarget = (LONG)(pbSrc - pbTarget);
         pTrampoline->rAlign[nAlign].obTarget = cbTarget;
@@ -2103,6 +3086,12 @@ LONG DETOURS_API DetourAttachEx(_Inout_ PVOID *ppPointer,
     }
 #endif // !DETOURS_IA64
 
+#ifdef DETOUR_DECODE_CACHE
+    if (fVerbatim && pbPool == pTrampoline->rbCode + sizeof(pTrampoline->rbCode)) {
+        detour_decode_insert(pTrampoline, pbTarget, nAlign);
+    }
+#endif
+
     pTrampoline->pbRemain = pbTarget + cbTarget;
     pTrampoline->pbDetour = (PBYTE)pDetour;
 
@@ -2170,7 +3159,7 @@ LONG DETOURS_API DetourAttachEx(_Inout_ PVOID *ppPointer,
     (void)pbTrampoline;
 
     DWORD dwOld = 0;
-    if (!VirtualProtect(pbTarget, cbTarget, PAGE_EXECUTE_READWRITE, &dwOld)) {
+    if (!detour_writable_target(pbTarget, cbTarget, &dwOld)) {
         error = DetoursGetLastError();
         DETOUR_BREAK();
         goto fail;
@@ -2203,6 +3192,8 @@ LONG DETOURS_API DetourAttachEx(_Inout_ PVOID *ppPointer,
     o->dwPerm = dwOld;
     o->pNext = s_pPendingOperations;
     s_pPendingOperations = o;
+    s_PendingStatistics.nOperations++;
+    detour_add_writable_pages(o);
 
     return DETOURS_STATUS_SUCCESS;
 }
@@ -2235,7 +3226,10 @@ LONG DETOURS_API DetourDetach(_Inout_ PVOID *ppPointer,
         return error;
     }
 
-    DetourOperation *o = new NOTHROW DetourOperation;
+    DetourOperation *o = nullptr;
+    if (detour_reserve_operation()) {
+        o = (DetourOperation *)detour_arena_alloc(sizeof(DetourOperation));
+    }
     if (o == nullptr) {
         error = DETOURS_STATUS_INSUFFICIENT_RESOURCES;
       fail:
@@ -2243,7 +3237,7 @@ LONG DETOURS_API DetourDetach(_Inout_ PVOID *ppPointer,
         DETOUR_BREAK();
       stop:
         if (o != nullptr) {
-            delete o;
+            detour_arena_free(o, sizeof(DetourOperation));
             o = nullptr;
         }
         s_ppPendingError = ppPointer;
@@ -2328,8 +3322,7 @@ LONG DETOURS_API DetourDetach(_Inout_ PVOID *ppPointer,
     }
 
     DWORD dwOld = 0;
-    if (!VirtualProtect(pbTarget, cbTarget,
-                        PAGE_EXECUTE_READWRITE, &dwOld)) {
+    if (!detour_writable_target(pbTarget, cbTarget, &dwOld)) {
         error = DetoursGetLastError();
         DETOUR_BREAK();
         goto fail;
@@ -2342,6 +3335,8 @@ LONG DETOURS_API DetourDetach(_Inout_ PVOID *ppPointer,
     o->dwPerm = dwOld;
     o->pNext = s_pPendingOperations;
     s_pPendingOperations = o;
+    s_PendingStatistics.nOperations++;
+    detour_add_writable_pages(o);
 
     return DETOURS_STATUS_SUCCESS;
 }
@@ -1256,6 +1256,7 @@ inline ULONG detour_is_code_filler(PBYTE pbCode)
 typedef struct DETOUR_REGION
 {
     ULONG               dwSignature;
+    ULONG               cLive;  // Number of trampolines handed out.
     PMDL                pMdl;   // Trampoline regions's mdl
     DETOUR_REGION *     pNext;  // Next region in list of regions.
     DETOUR_TRAMPOLINE * pFree;  // List of free trampolines in this region.
@@ -1269,6 +1270,9 @@ const ULONG DETOUR_TRAMPOLINES_PER_REGION = (DETOUR_REGION_SIZE / sizeof(DETOUR_
 static PDETOUR_REGION s_pRegions    = nullptr;      // List of all regions.
 static PDETOUR_REGION s_pRegion     = nullptr;      // Default region.
 
+static DETOUR_TRANSACTION_STATISTICS s_PendingStatistics;   // Pending transaction.
+static DETOUR_TRANSACTION_STATISTICS s_LastStatistics;      // Last finished transaction.
+
 static DWORD detour_writable_trampoline_regions()
 {
     DWORD Status = DETOURS_STATUS_SUCCESS;
@@ -1276,6 +1280,7 @@ static DWORD detour_writable_trampoline_regions()
     // Mark all of the regions as writable.
     for (PDETOUR_REGION pRegion = s_pRegions; pRegion != nullptr; pRegion = pRegion->pNext)
     {
+        s_PendingStatistics.nProtectCalls++;
         Status = MmProtectMdlSystemAddress(pRegion->pMdl, PAGE_EXECUTE_READWRITE);
         if (!NT_SUCCESS(Status))
         {
@@ -1291,6 +1296,7 @@ static void detour_runnable_trampoline_regions()
     // Mark all of the regions as executable.
     for (PDETOUR_REGION pRegion = s_pRegions; pRegion != nullptr; pRegion = pRegion->pNext)
     {
+        s_PendingStatistics.nProtectCalls++;
         MmProtectMdlSystemAddress(pRegion->pMdl, PAGE_EXECUTE_READ);
     }
 }
@@ -1327,6 +1333,7 @@ static PDETOUR_TRAMPOLINE detour_alloc_trampoline(PBYTE pbTarget)
         }
 #endif
         s_pRegion->pFree = (PDETOUR_TRAMPOLINE)pTrampoline->pbRemain;
+        s_pRegion->cLive++;
         memset(pTrampoline, 0xcc, sizeof(*pTrampoline));
         return pTrampoline;
     }
@@ -1372,6 +1379,7 @@ static PDETOUR_TRAMPOLINE detour_alloc_trampoline(PBYTE pbTarget)
     {
         s_pRegion = (DETOUR_REGION*)pbTry;
         s_pRegion->dwSignature = DETOUR_REGION_SIGNATURE;
+        s_pRegion->cLive = 0;
         s_pRegion->pMdl  = pMdl;
         s_pRegion->pFree = nullptr;
         s_pRegion->pNext = s_pRegions;
@@ -1403,6 +1411,7 @@ static void detour_free_trampoline(PDETOUR_TRAMPOLINE pTrampoline)
     memset(pTrampoline, 0, sizeof(*pTrampoline));
     pTrampoline->pbRemain = (PBYTE)pRegion->pFree;
     pRegion->pFree = pTrampoline;
+    pRegion->cLive--;
 }
 
 static BOOL detour_is_region_empty(PDETOUR_REGION pRegion)
@@ -1413,23 +1422,7 @@ static BOOL detour_is_region_empty(PDETOUR_REGION pRegion)
         return FALSE;
     }
 
-    PBYTE pbRegionBeg = (PBYTE)pRegion;
-    PBYTE pbRegionLim = pbRegionBeg + DETOUR_REGION_SIZE;
-
-    // Stop if any of the trampolines aren't free.
-    PDETOUR_TRAMPOLINE pTrampoline = ((PDETOUR_TRAMPOLINE)pRegion) + 1;
-    for (int i = 0; i < DETOUR_TRAMPOLINES_PER_REGION; i++)
-    {
-        if (pTrampoline[i].pbRemain != nullptr &&
-            (pTrampoline[i].pbRemain < pbRegionBeg ||
-                pTrampoline[i].pbRemain >= pbRegionLim))
-        {
-            return FALSE;
-        }
-    }
-
-    // OK, the region is empty.
-    return TRUE;
+    return pRegion->cLive == 0;
 }
 
 static void detour_free_unused_trampoline_regions()
@@ -1573,6 +1566,99 @@ static PVOID *              s_ppPendingError        = nullptr;
 static DetourThread *       s_pPendingThreads       = nullptr;
 static DetourOperation *    s_pPendingOperations    = nullptr;
 
+/////////////////////////////////////////////////////////// Transaction Arena.
+//
+// Operation records only live as long as the transaction, so they are carved
+// out of a bump arena that is reset once at commit or abort.  The largest
+// block is kept for the next transaction, so a steady stream of transactions
+// makes no pool calls.
+//
+struct DetourArenaBlock
+{
+    DetourArenaBlock *  pNext;      // Older (smaller) blocks.
+    SIZE_T              cbSize;     // Usable bytes after the header.
+    SIZE_T              cbUsed;
+};
+
+const SIZE_T DETOUR_ARENA_ALIGN     = 16;
+const SIZE_T DETOUR_ARENA_HEADER    = (sizeof(DetourArenaBlock) + DETOUR_ARENA_ALIGN - 1)
+                                      & ~(DETOUR_ARENA_ALIGN - 1);
+const SIZE_T DETOUR_ARENA_BLOCK_SIZE= PAGE_SIZE;
+
+static DetourArenaBlock *   s_pArena                = nullptr;
+
+inline SIZE_T detour_arena_align(SIZE_T cb)
+{
+    return (cb + DETOUR_ARENA_ALIGN - 1) & ~(DETOUR_ARENA_ALIGN - 1);
+}
+
+static PVOID detour_arena_alloc(SIZE_T cb)
+{
+    cb = detour_arena_align(cb);
+
+    if (s_pArena == nullptr || s_pArena->cbUsed + cb > s_pArena->cbSize)
+    {
+        // Grow geometrically so a large transaction needs few blocks.
+        SIZE_T cbBlock = DETOUR_ARENA_BLOCK_SIZE;
+        if (s_pArena != nullptr)
+        {
+            cbBlock = (DETOUR_ARENA_HEADER + s_pArena->cbSize) * 2;
+        }
+        if (cbBlock < DETOUR_ARENA_HEADER + cb)
+        {
+            cbBlock = DETOUR_ARENA_HEADER + cb;
+        }
+
+        DetourArenaBlock *pBlock = (DetourArenaBlock*)ExAllocatePoolWithTag(
+            NonPagedPool, cbBlock, DETOURS_TAG);
+        if (pBlock == nullptr)
+        {
+            return nullptr;
+        }
+        s_PendingStatistics.nHeapAllocations++;
+
+        pBlock->pNext   = s_pArena;
+        pBlock->cbSize  = cbBlock - DETOUR_ARENA_HEADER;
+        pBlock->cbUsed  = 0;
+        s_pArena        = pBlock;
+    }
+
+    PVOID pv = (PBYTE)s_pArena + DETOUR_ARENA_HEADER + s_pArena->cbUsed;
+    s_pArena->cbUsed += cb;
+    s_PendingStatistics.nArenaAllocations++;
+    return pv;
+}
+
+// Give back the most recent allocation, used on the failure paths.
+static void detour_arena_free(PVOID pv, SIZE_T cb)
+{
+    cb = detour_arena_align(cb);
+
+    if (s_pArena != nullptr && s_pArena->cbUsed >= cb &&
+        (PBYTE)pv == (PBYTE)s_pArena + DETOUR_ARENA_HEADER + s_pArena->cbUsed - cb)
+    {
+        s_pArena->cbUsed -= cb;
+    }
+}
+
+static void detour_arena_reset()
+{
+    if (s_pArena == nullptr)
+    {
+        return;
+    }
+
+    // Keep the newest block, it is the largest.
+    for (DetourArenaBlock *pBlock = s_pArena->pNext; pBlock != nullptr;)
+    {
+        DetourArenaBlock *pNext = pBlock->pNext;
+        ExFreePoolWithTag(pBlock, DETOURS_TAG);
+        pBlock = pNext;
+    }
+    s_pArena->pNext  = nullptr;
+    s_pArena->cbUsed = 0;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 PVOID DETOURS_API DetourCodeFromPointer(_In_ PVOID pPointer,
@@ -1597,6 +1683,13 @@ BOOL DETOURS_API DetourSetRetainRegions(_In_ BOOL fRetain)
     return fPrevious;
 }
 
+BOOL DETOURS_API DetourSetDecodeCache(_In_ BOOL fEnable)
+{
+    // Kernel targets are always decoded.
+    UNREFERENCED_PARAMETER(fEnable);
+    return FALSE;
+}
+
 PVOID DETOURS_API DetourSetSystemRegionLowerBound(_In_ PVOID pSystemRegionLowerBound)
 {
     PVOID pPrevious = s_pSystemRegionLowerBound;
@@ -1611,6 +1704,19 @@ PVOID DETOURS_API DetourSetSystemRegionUpperBound(_In_ PVOID pSystemRegionUpperB
     return pPrevious;
 }
 
+BOOL DETOURS_API DetourGetTransactionStatistics(_Out_ PDETOUR_TRANSACTION_STATISTICS pStatistics)
+{
+    if (pStatistics == nullptr)
+    {
+        DetoursSetLastError(DETOURS_STATUS_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    *pStatistics = s_LastStatistics;
+    pStatistics->cb = sizeof(*pStatistics);
+    return TRUE;
+}
+
 LONG DETOURS_API DetourTransactionBegin()
 {
     // Only one transaction is allowed at a time.
@@ -1632,6 +1738,7 @@ LONG DETOURS_API DetourTransactionBegin()
     s_ppPendingError        = nullptr;
 
     // Make sure the trampoline pages are writable.
+    RtlSecureZeroMemory(&s_PendingStatistics, sizeof(s_PendingStatistics));
     s_nPendingError = detour_writable_trampoline_regions();
 
     return s_nPendingError;
@@ -1660,16 +1767,16 @@ LONG DETOURS_API DetourTransactionAbort()
             }
         }
 
-        DetourOperation *n = o->pNext;
-        ExFreePoolWithTag(o, DETOURS_TAG);
-        o = n;
+        o = o->pNext;
     }
     s_pPendingOperations = nullptr;
+    detour_arena_reset();
 
     // Make sure the trampoline pages are no longer writable.
     detour_runnable_trampoline_regions();
 
     s_pPendingThreads = nullptr;
+    s_LastStatistics = s_PendingStatistics;
     s_nPendingThreadId = 0;
 
     return DETOURS_STATUS_SUCCESS;
@@ -1871,11 +1978,10 @@ LONG DETOURS_API DetourTransactionCommitEx(_Out_opt_ PVOID **pppFailedPointer)
             freed = true;
         }
 
-        DetourOperation *n = o->pNext;
-        ExFreePoolWithTag(o, DETOURS_TAG);
-        o = n;
+        o = o->pNext;
     }
     s_pPendingOperations = nullptr;
+    detour_arena_reset();
 
     // Free any trampoline regions that are now unused.
     if (freed && !s_fRetainRegions)
@@ -1887,6 +1993,7 @@ LONG DETOURS_API DetourTransactionCommitEx(_Out_opt_ PVOID **pppFailedPointer)
     detour_runnable_trampoline_regions();
 
     s_pPendingThreads  = nullptr;
+    s_LastStatistics   = s_PendingStatistics;
     s_nPendingThreadId = 0;
 
     if (pppFailedPointer != nullptr)
@@ -1914,6 +2021,23 @@ LONG DETOURS_API DetourUpdateThread(_In_ HANDLE hThread)
     return DETOURS_STATUS_SUCCESS;
 }
 
+LONG DETOURS_API DetourUpdateAllThreads()
+{
+    if (s_nPendingThreadId != (LONG)DetoursCurrentThreadId())
+    {
+        return DETOURS_STATUS_INVALID_OPERATION;
+    }
+
+    // If any of the pending operations failed, then we don't need to do this.
+    if (s_nPendingError != DETOURS_STATUS_SUCCESS)
+    {
+        return s_nPendingError;
+    }
+
+    // The commit already stops every other processor, there is nothing to suspend.
+    return DETOURS_STATUS_SUCCESS;
+}
+
 ///////////////////////////////////////////////////////////// Transacted APIs.
 //
 LONG DETOURS_API DetourAttach(_Inout_ PVOID *ppPointer,
@@ -2021,7 +2145,7 @@ LONG DETOURS_API DetourAttachEx(_Inout_ PVOID *ppPointer,
         *ppRealDetour = pDetour;
     }
 
-    o = (DetourOperation*)ExAllocatePoolWithTag(NonPagedPool, sizeof(DetourOperation), DETOURS_TAG);
+    o = (DetourOperation*)detour_arena_alloc(sizeof(DetourOperation));
     if (o == nullptr)
     {
         error = DETOURS_STATUS_INSUFFICIENT_RESOURCES;
@@ -2040,7 +2164,7 @@ LONG DETOURS_API DetourAttachEx(_Inout_ PVOID *ppPointer,
         }
         if (o != nullptr)
         {
-            ExFreePoolWithTag(o, DETOURS_TAG);
+            detour_arena_free(o, sizeof(DetourOperation));
             o = nullptr;
         }
         s_ppPendingError = ppPointer;
@@ -2321,6 +2445,7 @@ LONG DETOURS_API DetourAttachEx(_Inout_ PVOID *ppPointer,
     o->pbTargetMdl      = pbTargetMdl;
     o->pNext            = s_pPendingOperations;
     s_pPendingOperations= o;
+    s_PendingStatistics.nOperations++;
 
     return DETOURS_STATUS_SUCCESS;
 }
@@ -2358,7 +2483,7 @@ LONG DETOURS_API DetourDetach(_Inout_ PVOID *ppPointer,
         return error;
     }
 
-    DetourOperation *o = (DetourOperation*)ExAllocatePoolWithTag(NonPagedPool, sizeof(DetourOperation), DETOURS_TAG);
+    DetourOperation *o = (DetourOperation*)detour_arena_alloc(sizeof(DetourOperation));
     if (o == nullptr)
     {
         error = DETOURS_STATUS_INSUFFICIENT_RESOURCES;
@@ -2368,7 +2493,7 @@ LONG DETOURS_API DetourDetach(_Inout_ PVOID *ppPointer,
     stop:
         if (o != nullptr)
         {
-            ExFreePoolWithTag(o, DETOURS_TAG);
+            detour_arena_free(o, sizeof(DetourOperation));
             o = nullptr;
         }
         s_ppPendingError = ppPointer;
@@ -2478,6 +2603,7 @@ LONG DETOURS_API DetourDetach(_Inout_ PVOID *ppPointer,
     o->pbTargetMdl      = pbTargetMdl;
     o->pNext            = s_pPendingOperations;
     s_pPendingOperations= o;
+    s_PendingStatistics.nOperations++;
 
     return DETOURS_STATUS_SUCCESS;
 }
@@ -7,7 +7,11 @@
 //  Copyright (c) Microsoft Corporation.  All rights reserved.
 //
 
+#ifdef DETOURS_OFFLINE_HOST
+#include "disolhost.h"
+#else
 #include "internal.h"
+#endif
 
 
 #undef ASSERT
@@ -36,6 +40,7 @@
 
 #define DetourCopyInstruction   DetourCopyInstructionX86
 #define DetourSetCodeModule     DetourSetCodeModuleX86
+#define DetourSetCodeRange      DetourSetCodeRangeX86
 #define CDetourDis              CDetourDisX86
 #define DETOURS_X86
 
@@ -48,6 +53,7 @@
 
 #define DetourCopyInstruction   DetourCopyInstructionX64
 #define DetourSetCodeModule     DetourSetCodeModuleX64
+#define DetourSetCodeRange      DetourSetCodeRangeX64
 #define CDetourDis              CDetourDisX64
 #define DETOURS_X64
 
@@ -55,6 +61,7 @@
 
 #define DetourCopyInstruction   DetourCopyInstructionARM
 #define DetourSetCodeModule     DetourSetCodeModuleARM
+#define DetourSetCodeRange      DetourSetCodeRangeARM
 #define CDetourDis              CDetourDisARM
 #define DETOURS_ARM
 
@@ -62,6 +69,7 @@
 
 #define DetourCopyInstruction   DetourCopyInstructionARM64
 #define DetourSetCodeModule     DetourSetCodeModuleARM64
+#define DetourSetCodeRange      DetourSetCodeRangeARM64
 #define CDetourDis              CDetourDisARM64
 #define DETOURS_ARM64
 
@@ -69,6 +77,7 @@
 
 #define DetourCopyInstruction   DetourCopyInstructionIA64
 #define DetourSetCodeModule     DetourSetCodeModuleIA64
+#define DetourSetCodeRange      DetourSetCodeRangeIA64
 #define DETOURS_IA64
 
 #else
@@ -138,8 +147,10 @@
 //      offsets.
 //
 
+#ifndef DETOURS_OFFLINE_HOST
 #pragma data_seg(".detourd")
 #pragma const_seg(".detourc")
+#endif
 
 //////////////////////////////////////////////////// X86 and X64 Disassembler.
 //
@@ -154,6 +165,7 @@ class CDetourDis
                _Out_opt_ LONG *plExtra);
 
     PBYTE   CopyInstruction(PBYTE pbDst, PBYTE pbSrc);
+    PBYTE   MeasureInstruction(PBYTE pbSrc);
     static BOOL SanityCheckSystem();
     static BOOL SetCodeModule(PBYTE pbBeg, PBYTE pbEnd, BOOL fLimitReferencesToModule);
 
@@ -271,10 +283,44 @@ class CDetourDis
     PBYTE CopyVex3(REFCOPYENTRY pEntry, PBYTE pbDst, PBYTE pbSrc);
     PBYTE CopyVexCommon(BYTE m, PBYTE pbDst, PBYTE pbSrc);
 
+  protected:
+    // Length-only decoding, one kind per opcode byte.
+    enum {
+        MEASURE_BYTES       = 0,
+        MEASURE_PREFIX,
+        MEASURE_SEGMENT,
+        MEASURE_RAX,
+        MEASURE_66,
+        MEASURE_67,
+        MEASURE_F2,
+        MEASURE_F3,
+        MEASURE_0F,
+        MEASURE_0F00,
+        MEASURE_0F78,
+        MEASURE_0FB8,
+        MEASURE_JUMP,
+        MEASURE_F6,
+        MEASURE_F7,
+        MEASURE_FF,
+        MEASURE_VEX2,
+        MEASURE_VEX3,
+        MEASURE_INVALID,
+    };
+
+    static BYTE MeasureKind(REFCOPYENTRY pEntry);
+    static void BuildMeasureTables();
+
+    PBYTE MeasureOpcode(const BYTE *prbKind, const COPYENTRY *prceTable, PBYTE pbSrc);
+    PBYTE MeasureBytes(REFCOPYENTRY pEntry, PBYTE pbSrc);
+    PBYTE MeasureVex(BYTE m, PBYTE pbSrc);
+
   protected:
     static const COPYENTRY  s_rceCopyTable[257];
     static const COPYENTRY  s_rceCopyTable0F[257];
     static const BYTE       s_rbModRm[256];
+    static BYTE             s_rbMeasure[256];
+    static BYTE             s_rbMeasure0F[256];
+    static volatile LONG    s_nMeasureReady;
     static PBYTE            s_pbModuleBeg;
     static PBYTE            s_pbModuleEnd;
     static BOOL             s_fLimitReferencesToModule;
@@ -305,6 +351,25 @@ PVOID DETOURS_API DetourCopyInstruction(_In_opt_ PVOID pDst,
     UNREFERENCED_PARAMETER(ppDstPool);  // x86 & x64 don't use a constant pool.
 
     CDetourDis oDetourDisasm((PBYTE*)ppTarget, plExtra);
+    if (pDst == nullptr) {
+        // Only measuring, skip the copy and the relocation.
+        PBYTE pbNext = oDetourDisasm.MeasureInstruction((PBYTE)pSrc);
+
+#if DETOUR_DEBUG
+        // Keep the length-only decoder honest against the copying one.
+        PBYTE pbCheckTarget = nullptr;
+        CDetourDis oCheckDisasm(&pbCheckTarget, nullptr);
+        PBYTE pbCheck = oCheckDisasm.CopyInstruction(nullptr, (PBYTE)pSrc);
+        if (pbCheck != pbNext ||
+            (ppTarget != nullptr && pbCheckTarget != (PBYTE)*ppTarget)) {
+            DETOUR_TRACE(("detours: measure mismatch at %p: %p/%p != %p/%p\n",
+                          pSrc, pbNext, ppTarget ? *ppTarget : nullptr,
+                          pbCheck, pbCheckTarget));
+            DETOUR_BREAK();
+        }
+#endif
+        return pbNext;
+    }
     return oDetourDisasm.CopyInstruction((PBYTE)pDst, (PBYTE)pSrc);
 }
 
@@ -816,6 +881,315 @@ PBYTE CDetourDis::CopyVex2(REFCOPYENTRY, PBYTE pbDst, PBYTE pbSrc)
     return CopyVexCommon(1, pbDst + 2, pbSrc + 2);
 }
 
+/////////////////////////////////////////////////////// Length-Only Decoding.
+//
+//  Mirrors the Copy* functions above, but nothing is written and the
+//  dispatch is a switch over a byte per opcode instead of a call through
+//  pfCopy.  The byte tables are derived once from s_rceCopyTable and
+//  s_rceCopyTable0F so the two decoders cannot drift apart.
+//
+BYTE CDetourDis::s_rbMeasure[256];
+BYTE CDetourDis::s_rbMeasure0F[256];
+volatile LONG CDetourDis::s_nMeasureReady = 0;
+
+BYTE CDetourDis::MeasureKind(REFCOPYENTRY pEntry)
+{
+    COPYFUNC const pfCopy = pEntry->pfCopy;
+
+    if (pfCopy == &CDetourDis::CopyBytes)        return MEASURE_BYTES;
+    if (pfCopy == &CDetourDis::CopyBytesPrefix)  return MEASURE_PREFIX;
+    if (pfCopy == &CDetourDis::CopyBytesSegment) return MEASURE_SEGMENT;
+    if (pfCopy == &CDetourDis::CopyBytesRax)     return MEASURE_RAX;
+    if (pfCopy == &CDetourDis::Copy66)           return MEASURE_66;
+    if (pfCopy == &CDetourDis::Copy67)           return MEASURE_67;
+    if (pfCopy == &CDetourDis::CopyF2)           return MEASURE_F2;
+    if (pfCopy == &CDetourDis::CopyF3)           return MEASURE_F3;
+    if (pfCopy == &CDetourDis::Copy0F)           return MEASURE_0F;
+    if (pfCopy == &CDetourDis::Copy0F00)         return MEASURE_0F00;
+    if (pfCopy == &CDetourDis::Copy0F78)         return MEASURE_0F78;
+    if (pfCopy == &CDetourDis::Copy0FB8)         return MEASURE_0FB8;
+    if (pfCopy == &CDetourDis::CopyBytesJump)    return MEASURE_JUMP;
+    if (pfCopy == &CDetourDis::CopyF6)           return MEASURE_F6;
+    if (pfCopy == &CDetourDis::CopyF7)           return MEASURE_F7;
+    if (pfCopy == &CDetourDis::CopyFF)           return MEASURE_FF;
+    if (pfCopy == &CDetourDis::CopyVex2)         return MEASURE_VEX2;
+    if (pfCopy == &CDetourDis::CopyVex3)         return MEASURE_VEX3;
+    return MEASURE_INVALID;
+}
+
+void CDetourDis::BuildMeasureTables()
+{
+    // Racing threads compute identical bytes, so no lock is needed.  The
+    // interlocked store publishes the tables; readers pair it with
+    // ReadAcquire so they never see the flag before the bytes.
+    for (UINT n = 0; n < 256; n++) {
+        s_rbMeasure[n] = MeasureKind(&s_rceCopyTable[n]);
+        s_rbMeasure0F[n] = MeasureKind(&s_rceCopyTable0F[n]);
+    }
+    InterlockedExchange(&s_nMeasureReady, 1);
+}
+
+PBYTE CDetourDis::MeasureInstruction(PBYTE pbSrc)
+{
+    if (nullptr == pbSrc) {
+        // We can't measure a non-existent instruction.
+        DetoursSetLastError(DETOURS_STATUS_INVALID_ADDRESS);
+        return nullptr;
+    }
+
+    if (ReadAcquire(&s_nMeasureReady) == 0) {
+        BuildMeasureTables();
+    }
+    return MeasureOpcode(s_rbMeasure, s_rceCopyTable, pbSrc);
+}
+
+PBYTE CDetourDis::MeasureOpcode(const BYTE *prbKind, const COPYENTRY *prceTable, PBYTE pbSrc)
+{
+    static const COPYENTRY ce2Mod = { 0x00, ENTRY_CopyBytes2Mod };
+    static const COPYENTRY ce2Mod1 = { 0x00, ENTRY_CopyBytes2Mod1 };
+    static const COPYENTRY ce2ModDynamic = { 0x00, ENTRY_CopyBytes2ModDynamic };
+    static const COPYENTRY ce2ModOperand = { 0x00, ENTRY_CopyBytes2ModOperand };
+    static const COPYENTRY ce3Or5Dynamic = { 0x00, ENTRY_CopyBytes3Or5Dynamic };
+    static const COPYENTRY ce4 = { 0x00, ENTRY_CopyBytes4 };
+
+    for (;;) {
+        BYTE const b = pbSrc[0];
+
+        switch (prbKind[b]) {
+          case MEASURE_BYTES:
+            return MeasureBytes(&prceTable[b], pbSrc);
+
+          case MEASURE_SEGMENT:
+            m_nSegmentOverride = b;
+            pbSrc++;
+            continue;
+          case MEASURE_RAX: // AMD64 only
+            if (b & 0x8) {
+                m_bRaxOverride = TRUE;
+            }
+            pbSrc++;
+            continue;
+          case MEASURE_66:
+            m_bOperandOverride = TRUE;
+            pbSrc++;
+            continue;
+          case MEASURE_67:
+            m_bAddressOverride = TRUE;
+            pbSrc++;
+            continue;
+          case MEASURE_F2:
+            m_bF2 = TRUE;
+            pbSrc++;
+            continue;
+          case MEASURE_F3: // x86 only
+            m_bF3 = TRUE;
+            pbSrc++;
+            continue;
+          case MEASURE_PREFIX:
+            pbSrc++;
+            continue;
+
+          case MEASURE_0F:
+            prbKind = s_rbMeasure0F;
+            prceTable = s_rceCopyTable0F;
+            pbSrc++;
+            continue;
+          case MEASURE_0F00:
+            return MeasureBytes(((6 << 3) == ((7 << 3) & pbSrc[1])) ? &ce2ModDynamic : &ce2Mod,
+                                pbSrc);
+          case MEASURE_0F78:
+            return MeasureBytes((m_bF2 || m_bOperandOverride) ? &ce4 : &ce2Mod, pbSrc);
+          case MEASURE_0FB8:
+            return MeasureBytes(m_bF3 ? &ce2Mod : &ce3Or5Dynamic, pbSrc);
+
+          case MEASURE_JUMP:
+            *m_ppbTarget = pbSrc + 2 + (LONG_PTR)(signed char)pbSrc[1];
+            *m_plExtra = (b == 0xeb) ? 3 : 4;
+            return pbSrc + 2;
+
+          case MEASURE_F6:
+            return MeasureBytes((0x00 == (0x38 & pbSrc[1])) ? &ce2Mod1 : &ce2Mod, pbSrc);
+          case MEASURE_F7:
+            return MeasureBytes((0x00 == (0x38 & pbSrc[1])) ? &ce2ModOperand : &ce2Mod, pbSrc);
+
+          case MEASURE_FF:
+            {
+                PBYTE pbOut = MeasureBytes(&ce2Mod, pbSrc);
+                BYTE const b1 = pbSrc[1];
+
+                if (0x15 == b1 || 0x25 == b1) {         // CALL [], JMP []
+#ifdef DETOURS_X64
+                    if (m_nSegmentOverride != 0x64 && m_nSegmentOverride != 0x65)
+#else
+                    if (m_nSegmentOverride == 0 || m_nSegmentOverride == 0x2E)
+#endif
+                    {
+#ifdef DETOURS_X64
+                        INT32 offset = *(UNALIGNED INT32*)&pbSrc[2];
+                        PBYTE *ppbTarget = (PBYTE *)(pbSrc + 6 + offset);
+#else
+                        PBYTE *ppbTarget = (PBYTE *)(SIZE_T)*(UNALIGNED ULONG*)&pbSrc[2];
+#endif
+                        if (s_fLimitReferencesToModule &&
+                            (ppbTarget < (PVOID)s_pbModuleBeg || ppbTarget >= (PVOID)s_pbModuleEnd)) {
+
+                            *m_ppbTarget = (PBYTE)DETOUR_INSTRUCTION_TARGET_DYNAMIC;
+                        }
+                        else {
+                            // This can access violate on random bytes. Use DetourSetCodeModule.
+                            *m_ppbTarget = *ppbTarget;
+                        }
+                    }
+                    else {
+                        *m_ppbTarget = (PBYTE)DETOUR_INSTRUCTION_TARGET_DYNAMIC;
+                    }
+                }
+                else if (0x10 == (0x30 & b1) || 0x20 == (0x30 & b1)) {
+                    *m_ppbTarget = (PBYTE)DETOUR_INSTRUCTION_TARGET_DYNAMIC;
+                }
+                return pbOut;
+            }
+
+          case MEASURE_VEX3:
+#ifdef DETOURS_X86
+            if ((pbSrc[1] & 0xC0) != 0xC0) {
+                return MeasureBytes(&ce2Mod, pbSrc);    // LES
+            }
+#endif
+#ifdef DETOURS_X64
+            m_bRaxOverride |= !!(pbSrc[2] & 0x80);
+#endif
+            return MeasureVex(pbSrc[1] & 0x1F, pbSrc + 3);
+          case MEASURE_VEX2:
+#ifdef DETOURS_X86
+            if ((pbSrc[1] & 0xC0) != 0xC0) {
+                return MeasureBytes(&ce2Mod, pbSrc);    // LDS
+            }
+#endif
+            return MeasureVex(1, pbSrc + 2);
+
+          default:
+            return pbSrc + 1;
+        }
+    }
+}
+
+PBYTE CDetourDis::MeasureVex(BYTE m, PBYTE pbSrc)
+{
+    static const COPYENTRY ceF38 = { 0x38, ENTRY_CopyBytes2Mod };
+    static const COPYENTRY ceF3A = { 0x3A, ENTRY_CopyBytes2Mod1 };
+
+    m_bVex = TRUE;
+    switch (pbSrc[-1] & 3) { // p in last byte
+    case 0: break;
+    case 1: m_bOperandOverride = TRUE; break;
+    case 2: m_bF3 = TRUE; break;
+    case 3: m_bF2 = TRUE; break;
+    }
+
+    switch (m) {
+    case 1:  return MeasureOpcode(s_rbMeasure0F, s_rceCopyTable0F, pbSrc);
+    case 2:  return MeasureBytes(&ceF38, pbSrc);
+    case 3:  return MeasureBytes(&ceF3A, pbSrc);
+    default: return pbSrc + 1;
+    }
+}
+
+PBYTE CDetourDis::MeasureBytes(REFCOPYENTRY pEntry, PBYTE pbSrc)
+{
+    UINT nBytesFixed;
+
+    UINT const nModOffset = pEntry->nModOffset;
+    UINT const nFlagBits = pEntry->nFlagBits;
+    UINT const nFixedSize = pEntry->nFixedSize;
+    UINT const nFixedSize16 = pEntry->nFixedSize16;
+
+    if (nFlagBits & ADDRESS) {
+        nBytesFixed = m_bAddressOverride ? nFixedSize16 : nFixedSize;
+    }
+#ifdef DETOURS_X64
+    // REX.W trumps 66
+    else if (m_bRaxOverride) {
+        nBytesFixed = nFixedSize + ((nFlagBits & RAX) ? 4 : 0);
+    }
+#endif
+    else {
+        nBytesFixed = m_bOperandOverride ? nFixedSize16 : nFixedSize;
+    }
+
+    UINT nBytes = nBytesFixed;
+    UINT nRelOffset = pEntry->nRelOffset;
+    UINT cbTarget = nBytes - nRelOffset;
+    if (nModOffset > 0) {
+        BYTE const bModRm = pbSrc[nModOffset];
+        BYTE const bFlags = s_rbModRm[bModRm];
+
+        nBytes += bFlags & NOTSIB;
+
+        if (bFlags & SIB) {
+            BYTE const bSib = pbSrc[nModOffset + 1];
+
+            if ((bSib & 0x07) == 0x05) {
+                if ((bModRm & 0xc0) == 0x00) {
+                    nBytes += 4;
+                }
+                else if ((bModRm & 0xc0) == 0x40) {
+                    nBytes += 1;
+                }
+                else if ((bModRm & 0xc0) == 0x80) {
+                    nBytes += 4;
+                }
+            }
+            cbTarget = nBytes - nRelOffset;
+        }
+#ifdef DETOURS_X64
+        else if (bFlags & RIP) {
+            nRelOffset = nModOffset + 1;
+            cbTarget = 4;
+        }
+#endif
+    }
+
+    if (nRelOffset) {
+        // Report lExtra as AdjustTarget does for a copy out of short range.
+        PVOID pvTargetAddr = &pbSrc[nRelOffset];
+        LONG_PTR nOffset = 0;
+
+        switch (cbTarget) {
+          case 1:
+            nOffset = *(signed char*&)pvTargetAddr;
+            *m_plExtra = sizeof(ULONG) - 1;
+            break;
+          case 2:
+            nOffset = *(UNALIGNED SHORT*&)pvTargetAddr;
+            *m_plExtra = sizeof(ULONG) - 2;
+            break;
+          case 4:
+            nOffset = *(UNALIGNED LONG*&)pvTargetAddr;
+            break;
+#if defined(DETOURS_X64)
+          case 8:
+            nOffset = (LONG_PTR)*(UNALIGNED LONGLONG*&)pvTargetAddr;
+            break;
+#endif
+        }
+        *m_ppbTarget = pbSrc + nBytes + nOffset;
+#ifdef DETOURS_X64
+        if (pEntry->nRelOffset == 0) {
+            // This is a data target, not a code target, so we shouldn't return it.
+            *m_ppbTarget = nullptr;
+        }
+#endif
+    }
+    if (nFlagBits & NOENLARGE) {
+        *m_plExtra = -*m_plExtra;
+    }
+    if (nFlagBits & DYNAMIC) {
+        *m_ppbTarget = (PBYTE)DETOUR_INSTRUCTION_TARGET_DYNAMIC;
+    }
+    return pbSrc + nBytes;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 PBYTE CDetourDis::s_pbModuleBeg = nullptr;
@@ -3241,7 +3615,7 @@ BYTE CDetourDis::CopyLoadAndStoreSingle(BYTE* pSource, BYTE* pDest)
         return CopyLiteralLoad32(pSource, pDest);
     }
 
-    if ((instruction & 0xFE70F000) == 0xF81FF000) {
+    if ((instruction & 0xFE70F000) == 0xF810F000) {
         // 1111100xx001xxxx1111xxxxxxxxxxxx : PLD, PLI
         // Convert PC-Relative PLD/PLI instructions to noops (1111100Xx00111111111xxxxxxxxxxxx)
         if ((instruction & 0xFE7FF000) == 0xF81FF000) {
@@ -3462,8 +3836,6 @@ CDetourDis::CDetourDis()
     m_pbTarget  = (PBYTE)DETOUR_INSTRUCTION_TARGET_NONE;
     m_pbPool    = nullptr;
     m_lExtra    = 0;
-
-    m_rbScratchDst;
 }
 
 PBYTE CDetourDis::CopyInstruction(PBYTE pDst,
@@ -3867,8 +4239,6 @@ BYTE CDetourDis::PureCopy32(BYTE* pSource, BYTE* pDest)
 CDetourDis::CDetourDis()
 {
     m_pbTarget = (PBYTE)DETOUR_INSTRUCTION_TARGET_NONE;
-
-    m_rbScratchDst;
 }
 
 PBYTE CDetourDis::CopyInstruction(PBYTE pDst,
@@ -4233,6 +4603,26 @@ BOOL DETOURS_API DetourSetCodeModule(_In_ HMODULE hModule,
 }
 #endif
 
+#ifdef DETOURS_OFFLINE_HOST
+// There are no modules on the host, the caller names the mapped code range.
+BOOL DETOURS_API DetourSetCodeRange(_In_opt_ PVOID pvBeg,
+                               _In_opt_ PVOID pvEnd,
+                               _In_ BOOL fLimitReferencesToModule)
+{
+#if defined(DETOURS_X64) || defined(DETOURS_X86)
+    PBYTE pbBeg = pvBeg ? (PBYTE)pvBeg : nullptr;
+    PBYTE pbEnd = pvEnd ? (PBYTE)pvEnd : (PBYTE)~(ULONG_PTR)0;
+
+    return CDetourDis::SetCodeModule(pbBeg, pbEnd, fLimitReferencesToModule);
+#else
+    (void)pvBeg;
+    (void)pvEnd;
+    (void)fLimitReferencesToModule;
+    return TRUE;
+#endif
+}
+#endif
+
 //
 ///////////////////////////////////////////////////////////////// End of File.
 
@@ -0,0 +1,126 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Host Build of the Offline Disassemblers (disolhost.h of detours.lib)
+//
+//  Microsoft Research Detours Package, Version 4.0.1
+//
+//  Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//  Stands in for internal.h when disasm.cpp is compiled with
+//  DETOURS_OFFLINE_HOST, so the offline X86, X64, ARM and ARM64 decoders
+//  build with GCC or Clang without the Windows headers.  See Makefile.host.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <stdio.h>
+
+//////////////////////////////////////////////////////////////// Basic Types.
+//
+// Sizes follow the Windows LLP64 model on every host.
+//
+typedef void                VOID;
+typedef void *              PVOID;
+typedef int                 BOOL;
+typedef char                CHAR;
+typedef uint8_t             BYTE, *PBYTE;
+typedef int16_t             SHORT;
+typedef uint16_t            USHORT, *PUSHORT;
+typedef int32_t             LONG, *PLONG;
+typedef uint32_t            ULONG, *PULONG;
+typedef uint32_t            DWORD, *PDWORD;
+typedef uint32_t            UINT;
+typedef int32_t             INT32;
+typedef int64_t             LONG64, LONGLONG;
+typedef uint64_t            ULONG64, ULONGLONG, UINT64;
+typedef intptr_t            LONG_PTR;
+typedef uintptr_t           ULONG_PTR, SIZE_T;
+
+#ifndef TRUE
+#define TRUE                1
+#endif
+#ifndef FALSE
+#define FALSE               0
+#endif
+
+#define UNALIGNED
+#define DETOURS_API
+#define UNREFERENCED_PARAMETER(P)   (void)(P)
+#define C_ASSERT(e)         static_assert(e, #e)
+#define ARRAYSIZE(x)        (sizeof(x) / sizeof(x[0]))
+#define RtlSecureZeroMemory(p, cb)  memset((p), 0, (cb))
+
+#if defined(__x86_64__) || defined(__aarch64__) || defined(_WIN64)
+#define DETOURS_64BIT       1
+#else
+#define DETOURS_32BIT       1
+#endif
+
+/////////////////////////////////////////////////////// SAL Annotations (none).
+//
+#define _In_
+#define _In_opt_
+#define _Inout_opt_
+#define _Out_
+#define _Out_opt_
+
+////////////////////////////////////////////////////////// Errors and Tracing.
+//
+#define DETOURS_STATUS_INVALID_ADDRESS  EFAULT
+#define DetoursSetLastError(e)          (errno = (e))
+
+#ifndef DETOUR_DEBUG
+#define DETOUR_DEBUG 0
+#endif
+
+#if DETOUR_DEBUG
+#define DETOUR_TRACE(x)     printf x
+#define DETOUR_BREAK()      __builtin_trap()
+#else
+#define DETOUR_TRACE(x)
+#define DETOUR_BREAK()
+#endif
+
+///////////////////////////////////////////////////////////// Interlocked.
+//
+#define InterlockedExchange(p, v)       __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define ReadAcquire(p)                  __atomic_load_n((p), __ATOMIC_ACQUIRE)
+
+#define DETOUR_INSTRUCTION_TARGET_NONE          ((PVOID)0)
+#define DETOUR_INSTRUCTION_TARGET_DYNAMIC       ((PVOID)(LONG_PTR)-1)
+
+//////////////////////////////////////////////////////// Offline Disassemblers.
+//
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#define DETOUR_OFFLINE_LIBRARY(x)                                       \
+PVOID DETOURS_API DetourCopyInstruction##x(_In_opt_ PVOID pDst,              \
+                                      _Inout_opt_ PVOID *ppDstPool,     \
+                                      _In_ PVOID pSrc,                  \
+                                      _Out_opt_ PVOID *ppTarget,        \
+                                      _Out_opt_ LONG *plExtra);         \
+                                                                        \
+BOOL DETOURS_API DetourSetCodeRange##x(_In_opt_ PVOID pvBeg,                 \
+                                  _In_opt_ PVOID pvEnd,                 \
+                                  _In_ BOOL fLimitReferencesToModule);  \
+
+DETOUR_OFFLINE_LIBRARY(X86)
+DETOUR_OFFLINE_LIBRARY(X64)
+DETOUR_OFFLINE_LIBRARY(ARM)
+DETOUR_OFFLINE_LIBRARY(ARM64)
+
+#undef DETOUR_OFFLINE_LIBRARY
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+//
+///////////////////////////////////////////////////////////////// End of File.
@@ -126,12 +126,15 @@ public:
 
     BOOL                    Delete(REFGUID rguid);
     BOOL                    Purge();
+    BOOL                    Index();
 
     BOOL                    IsEmpty()           { return m_cbData == 0; }
     BOOL                    IsValid();
 
 protected:
     BOOL                    SizeTo(DWORD cbData);
+    BOOL                    IsIndex(PDETOUR_SECTION_RECORD pRecord);
+    VOID                    Unindex();
 
 protected:
     _Field_size_(m_cbAlloc)
@@ -160,6 +163,11 @@ public:
     DWORD                   m_rvaOriginalFirstThunk = 0;
     DWORD                   m_rvaFirstThunk         = 0;
 
+    // Lookup table and name from the original sections, zero if either
+    // lived in a .detour section that will be dropped on Write.
+    DWORD                   m_rvaReuseLookup        = 0;
+    DWORD                   m_rvaReuseName          = 0;
+
     DWORD                   m_nForwarderChain   = 0;
     LPCSTR                  m_pszOrig           = nullptr;
     LPCSTR                  m_pszName           = nullptr;
@@ -199,6 +207,7 @@ public:                                                 // File Functions
     BOOL                    Read(HANDLE hFile);
     BOOL                    Write(HANDLE hFile);
     BOOL                    Close();
+    DWORD                   ImportBytesReused();
 
 public:                                                 // Manipulation Functions
     PBYTE                   DataEnum(GUID *pGuid, DWORD *pcbData, DWORD *pnIterator);
@@ -219,6 +228,7 @@ protected:
                                       DWORD nNumberOfBytesToWrite,
                                       LPDWORD lpNumberOfBytesWritten);
     BOOL                    CopyFileData(HANDLE hFile, DWORD nOldPos, DWORD cbData);
+    BOOL                    CopyFileRange(HANDLE hFile, DWORD nPos, DWORD cbData);
     BOOL                    ZeroFileData(HANDLE hFile, DWORD cbData);
     BOOL                    AlignFileData(HANDLE hFile);
 
@@ -236,6 +246,7 @@ protected:
                                                DWORD *pnChars);
 
     CImageImportFile *      NewByway(_In_ LPCSTR pszName);
+    BOOL                    CanReuseImports(CImageImportFile *pImportFile);
 
 private:
     DWORD                   m_dwValidSignature  = 0;
@@ -272,6 +283,7 @@ private:
     DWORD                   m_nImportFiles      = 0;
 
     BOOL                    m_fHadDetourSection = FALSE;
+    DWORD                   m_cbImportsReused   = 0;        // Write
 
 private:
     enum {
@@ -286,6 +298,8 @@ static BYTE s_rbDosCode[0x10] = {
     0x21,0xB8,0x01,0x4C,0xCD,0x21,'*','*'
 };
 
+static const BYTE s_rbZeros[4096] = { 0 };
+
 static inline DWORD Max(DWORD a, DWORD b)
 {
     return a > b ? a : b;
@@ -349,6 +363,8 @@ CImageImportFile::CImageImportFile()
 
     m_rvaOriginalFirstThunk = 0;
     m_rvaFirstThunk = 0;
+    m_rvaReuseLookup = 0;
+    m_rvaReuseName = 0;
 
     m_nForwarderChain = (UINT)0;
     m_pszName = nullptr;
@@ -483,10 +499,117 @@ BOOL CImageData::IsValid()
     return TRUE;
 }
 
+BOOL CImageData::IsIndex(PDETOUR_SECTION_RECORD pRecord)
+{
+    return memcmp(&pRecord->guid, &DETOUR_PAYLOAD_INDEX_GUID, sizeof(GUID)) == 0;
+}
+
+// Any edit invalidates the index record; drop it until the next Index().
+VOID CImageData::Unindex()
+{
+    if (m_cbData < sizeof(DETOUR_SECTION_RECORD)) {
+        return;
+    }
+
+    PDETOUR_SECTION_RECORD pRecord = (PDETOUR_SECTION_RECORD)m_pbData;
+    if (!IsIndex(pRecord) ||
+        pRecord->cbBytes < sizeof(DETOUR_SECTION_RECORD) ||
+        pRecord->cbBytes > m_cbData) {
+        return;
+    }
+
+    if (!SizeTo(m_cbData)) {                // Take a private copy of mapped data.
+        return;
+    }
+    pRecord = (PDETOUR_SECTION_RECORD)m_pbData;
+
+    DWORD cbIndex = pRecord->cbBytes;
+    memmove(m_pbData, m_pbData + cbIndex, m_cbData - cbIndex);
+    m_cbData -= cbIndex;
+}
+
+// Puts a record sorted by GUID, with the offset of each payload, at the
+// front of the data so that detour_find_payload_record can binary search.
+BOOL CImageData::Index()
+{
+    IsValid();
+    Unindex();
+
+    DWORD cEntries = 0;
+    DWORD cbBytes;
+    for (DWORD nOffset = 0; nOffset < m_cbData; nOffset += cbBytes) {
+        cbBytes = ((PDETOUR_SECTION_RECORD)(m_pbData + nOffset))->cbBytes;
+        if (cbBytes < sizeof(DETOUR_SECTION_RECORD) || cbBytes > m_cbData - nOffset) {
+            return TRUE;                    // Malformed, leave it to the walkers.
+        }
+        cEntries++;
+    }
+
+    if (cEntries < 2) {
+        return TRUE;
+    }
+
+    DWORD cbIndex = sizeof(DETOUR_SECTION_RECORD)
+        + sizeof(DETOUR_SECTION_INDEX)
+        + cEntries * sizeof(DETOUR_SECTION_INDEX_ENTRY);
+
+    PBYTE pbNew = new NOTHROW BYTE [cbIndex + m_cbData];
+    if (pbNew == nullptr) {
+        DetoursSetLastError(DETOURS_STATUS_OUTOFMEMORY);
+        return FALSE;
+    }
+
+    PDETOUR_SECTION_RECORD pRecord = (PDETOUR_SECTION_RECORD)pbNew;
+    pRecord->cbBytes = cbIndex;
+    pRecord->nReserved = 0;
+    pRecord->guid = DETOUR_PAYLOAD_INDEX_GUID;
+
+    PDETOUR_SECTION_INDEX pIndex = (PDETOUR_SECTION_INDEX)(pRecord + 1);
+    pIndex->cbData = cbIndex + m_cbData;
+    pIndex->cEntries = cEntries;
+
+    // Insertion sort; a section rarely holds more than a few hundred payloads.
+    PDETOUR_SECTION_INDEX_ENTRY pEntries = (PDETOUR_SECTION_INDEX_ENTRY)(pIndex + 1);
+    DWORD n = 0;
+    for (DWORD nOffset = 0; nOffset < m_cbData; nOffset += cbBytes) {
+        PDETOUR_SECTION_RECORD pSource = (PDETOUR_SECTION_RECORD)(m_pbData + nOffset);
+        cbBytes = pSource->cbBytes;
+
+        DWORD m = n++;
+        while (m > 0 && memcmp(&pEntries[m - 1].guid, &pSource->guid, sizeof(GUID)) > 0) {
+            pEntries[m] = pEntries[m - 1];
+            m--;
+        }
+        pEntries[m].guid = pSource->guid;
+        pEntries[m].nOffset = cbIndex + nOffset;
+        pEntries[m].cbBytes = cbBytes;
+    }
+
+    memcpy(pbNew + cbIndex, m_pbData, m_cbData);
+    if (m_cbAlloc > 0) {
+        delete[] m_pbData;
+    }
+    m_pbData = pbNew;
+    m_cbData += cbIndex;
+    m_cbAlloc = m_cbData;
+
+    IsValid();
+    return TRUE;
+}
+
 PBYTE CImageData::Enumerate(GUID *pGuid, DWORD *pcbData, DWORD *pnIterator)
 {
     IsValid();
 
+    // The index record is layout, not a payload.
+    if (pnIterator != nullptr && *pnIterator == 0 &&
+        m_cbData >= sizeof(DETOUR_SECTION_RECORD) &&
+        IsIndex((PDETOUR_SECTION_RECORD)m_pbData) &&
+        ((PDETOUR_SECTION_RECORD)m_pbData)->cbBytes >= sizeof(DETOUR_SECTION_RECORD)) {
+
+        *pnIterator = ((PDETOUR_SECTION_RECORD)m_pbData)->cbBytes;
+    }
+
     if (pnIterator == nullptr ||
         m_cbData < *pnIterator + sizeof(DETOUR_SECTION_RECORD)) {
 
@@ -516,33 +639,12 @@ PBYTE CImageData::Find(REFGUID rguid, DWORD *pcbData)
 {
     IsValid();
 
-    DWORD cbBytes = sizeof(DETOUR_SECTION_RECORD);
-    for (DWORD nOffset = 0; nOffset < m_cbData; nOffset += cbBytes) {
-        PDETOUR_SECTION_RECORD pRecord = (PDETOUR_SECTION_RECORD)(m_pbData + nOffset);
-
-        cbBytes = pRecord->cbBytes;
-        if (cbBytes > m_cbData) {
-            break;
-        }
-        if (cbBytes < sizeof(DETOUR_SECTION_RECORD)) {
-            continue;
-        }
-
-        if (pRecord->guid.Data1 == rguid.Data1 &&
-            pRecord->guid.Data2 == rguid.Data2 &&
-            pRecord->guid.Data3 == rguid.Data3 &&
-            pRecord->guid.Data4[0] == rguid.Data4[0] &&
-            pRecord->guid.Data4[1] == rguid.Data4[1] &&
-            pRecord->guid.Data4[2] == rguid.Data4[2] &&
-            pRecord->guid.Data4[3] == rguid.Data4[3] &&
-            pRecord->guid.Data4[4] == rguid.Data4[4] &&
-            pRecord->guid.Data4[5] == rguid.Data4[5] &&
-            pRecord->guid.Data4[6] == rguid.Data4[6] &&
-            pRecord->guid.Data4[7] == rguid.Data4[7]) {
-
-            *pcbData = cbBytes - sizeof(DETOUR_SECTION_RECORD);
-            return (PBYTE)(pRecord + 1);
+    PDETOUR_SECTION_RECORD pRecord = detour_find_payload_record(m_pbData, m_cbData, rguid);
+    if (pRecord != nullptr) {
+        if (pcbData) {
+            *pcbData = pRecord->cbBytes - sizeof(DETOUR_SECTION_RECORD);
         }
+        return (PBYTE)(pRecord + 1);
     }
 
     if (pcbData) {
@@ -554,6 +656,11 @@ PBYTE CImageData::Find(REFGUID rguid, DWORD *pcbData)
 BOOL CImageData::Delete(REFGUID rguid)
 {
     IsValid();
+    Unindex();
+
+    if (!SizeTo(m_cbData)) {                // Take a private copy of mapped data.
+        return FALSE;
+    }
 
     PBYTE pbFound = nullptr;
     DWORD cbFound = 0;
@@ -582,20 +689,35 @@ BOOL CImageData::Delete(REFGUID rguid)
 PBYTE CImageData::Set(REFGUID rguid, PBYTE pbData, DWORD cbData)
 {
     IsValid();
-    Delete(rguid);
+    Unindex();
+
+    if (!SizeTo(m_cbData)) {                // Take a private copy of mapped data.
+        return nullptr;
+    }
 
     DWORD cbAlloc = QuadAlign(cbData);
+    DWORD cbFound = 0;
+    PBYTE pbDest = Find(rguid, &cbFound);
 
-    if (!SizeTo(m_cbData + cbAlloc + sizeof(DETOUR_SECTION_RECORD))) {
-        return nullptr;
+    if (pbDest != nullptr && cbFound == cbAlloc) {
+        // Same size, so overwrite the payload where it is.
     }
+    else {
+        Delete(rguid);
 
-    PDETOUR_SECTION_RECORD pRecord = (PDETOUR_SECTION_RECORD)(m_pbData + m_cbData);
-    pRecord->cbBytes = cbAlloc + sizeof(DETOUR_SECTION_RECORD);
-    pRecord->nReserved = 0;
-    pRecord->guid = rguid;
+        if (!SizeTo(m_cbData + cbAlloc + sizeof(DETOUR_SECTION_RECORD))) {
+            return nullptr;
+        }
+
+        PDETOUR_SECTION_RECORD pRecord = (PDETOUR_SECTION_RECORD)(m_pbData + m_cbData);
+        pRecord->cbBytes = cbAlloc + sizeof(DETOUR_SECTION_RECORD);
+        pRecord->nReserved = 0;
+        pRecord->guid = rguid;
+
+        pbDest = (PBYTE)(pRecord + 1);
+        m_cbData += cbAlloc + sizeof(DETOUR_SECTION_RECORD);
+    }
 
-    PBYTE pbDest = (PBYTE)(pRecord + 1);
     if (pbData) {
         memcpy(pbDest, pbData, cbData);
         if (cbData < cbAlloc) {
@@ -608,8 +730,6 @@ PBYTE CImageData::Set(REFGUID rguid, PBYTE pbData, DWORD cbData)
         }
     }
 
-    m_cbData += cbAlloc + sizeof(DETOUR_SECTION_RECORD);
-
     IsValid();
     return pbDest;
 }
@@ -781,6 +901,7 @@ CImage::CImage()
     m_nImportFiles = 0;
 
     m_fHadDetourSection = FALSE;
+    m_cbImportsReused = 0;
 }
 
 CImage::~CImage()
@@ -979,20 +1100,23 @@ BOOL CImage::CopyFileData(HANDLE hFile, DWORD nOldPos, DWORD cbData)
     return WriteFile(hFile, m_pMap + nOldPos, cbData, &cbDone);
 }
 
-BOOL CImage::ZeroFileData(HANDLE hFile, DWORD cbData)
+// Copies input bytes to the same offset in the output.
+BOOL CImage::CopyFileRange(HANDLE hFile, DWORD nPos, DWORD cbData)
 {
-    if (!SizeOutputBuffer(4096)) {
+    if (SetFilePointer(hFile, nPos, nullptr, FILE_BEGIN) == ~0u) {
         return FALSE;
     }
+    return CopyFileData(hFile, nPos, cbData);
+}
 
-    RtlSecureZeroMemory(m_pbOutputBuffer, 4096);
-
+BOOL CImage::ZeroFileData(HANDLE hFile, DWORD cbData)
+{
+    // Don't use m_pbOutputBuffer here, it may hold the .detour section.
     for (DWORD cbLeft = cbData; cbLeft > 0;) {
-        DWORD cbStep = cbLeft > sizeof(m_pbOutputBuffer)
-            ? sizeof(m_pbOutputBuffer) : cbLeft;
+        DWORD cbStep = cbLeft > sizeof(s_rbZeros) ? sizeof(s_rbZeros) : cbLeft;
         DWORD cbDone = 0;
 
-        if (!WriteFile(hFile, m_pbOutputBuffer, cbStep, &cbDone)) {
+        if (!WriteFile(hFile, s_rbZeros, cbStep, &cbDone)) {
             return FALSE;
         }
         if (cbDone == 0) {
@@ -1053,17 +1177,16 @@ BOOL CImage::Read(HANDLE hFile)
     ////////////////////////////////////////////////////// Process DOS Header.
     //
     PIMAGE_DOS_HEADER pDosHeader = (PIMAGE_DOS_HEADER)m_pMap;
-    if (pDosHeader->e_magic != IMAGE_DOS_SIGNATURE) {
-        DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
+    PIMAGE_NT_HEADERS pNtHeader = detour_image_headers(pDosHeader, m_nFileSize);
+    if (pNtHeader == nullptr) {
+        // Error set by detour_image_headers.
         return FALSE;
     }
     m_nPeOffset = pDosHeader->e_lfanew;
     m_nPrePE = 0;
     m_cbPrePE = QuadAlign(pDosHeader->e_lfanew);
 
-    if (m_nPeOffset > m_nFileSize ||
-        m_nPeOffset + sizeof(m_NtHeader) > m_nFileSize) {
-
+    if (m_nPeOffset + sizeof(m_NtHeader) > m_nFileSize) {
         DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
         return FALSE;
     }
@@ -1072,19 +1195,8 @@ BOOL CImage::Read(HANDLE hFile)
 
     /////////////////////////////////////////////////////// Process PE Header.
     //
-    memcpy(&m_NtHeader, m_pMap + m_nPeOffset, sizeof(m_NtHeader));
-    if (m_NtHeader.Signature != IMAGE_NT_SIGNATURE) {
-        DetoursSetLastError(DETOURS_STATUS_INVALID_EXE_SIGNATURE);
-        return FALSE;
-    }
-    if (m_NtHeader.FileHeader.SizeOfOptionalHeader == 0) {
-        DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
-        return FALSE;
-    }
-    m_nSectionsOffset = m_nPeOffset
-        + sizeof(m_NtHeader.Signature)
-        + sizeof(m_NtHeader.FileHeader)
-        + m_NtHeader.FileHeader.SizeOfOptionalHeader;
+    memcpy(&m_NtHeader, pNtHeader, sizeof(m_NtHeader));
+    m_nSectionsOffset = (DWORD)((PBYTE)detour_image_sections(pNtHeader) - m_pMap);
 
     ///////////////////////////////////////////////// Process Section Headers.
     //
@@ -1123,8 +1235,9 @@ BOOL CImage::Read(HANDLE hFile)
 
     //////////////////////////////////////////////////////// Get Import Table.
     //
-    DWORD rvaImageDirectory = m_NtHeader.OptionalHeader
-        .DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT].VirtualAddress;
+    PIMAGE_DATA_DIRECTORY pImportDir
+        = detour_image_data_directory(pNtHeader, IMAGE_DIRECTORY_ENTRY_IMPORT);
+    DWORD rvaImageDirectory = pImportDir ? pImportDir->VirtualAddress : 0;
     PIMAGE_IMPORT_DESCRIPTOR iidp
         = (PIMAGE_IMPORT_DESCRIPTOR)RvaToVa(rvaImageDirectory);
     PIMAGE_IMPORT_DESCRIPTOR oidp
@@ -1194,6 +1307,16 @@ BOOL CImage::Read(HANDLE hFile)
             goto fail;
         }
 
+        if (iidp->OriginalFirstThunk != 0 &&
+            ((ULONG)iidp->OriginalFirstThunk < rvaDetourBeg ||
+             (ULONG)iidp->OriginalFirstThunk >= rvaDetourEnd) &&
+            ((ULONG)iidp->Name < rvaDetourBeg ||
+             (ULONG)iidp->Name >= rvaDetourEnd)) {
+
+            pImportFile->m_rvaReuseLookup = iidp->OriginalFirstThunk;
+            pImportFile->m_rvaReuseName = iidp->Name;
+        }
+
         DWORD rvaThunk = iidp->OriginalFirstThunk;
         if( !rvaThunk ) {
             rvaThunk = iidp->FirstThunk;
@@ -1344,22 +1467,50 @@ static inline BOOL strneq(_In_ LPCSTR pszOne, _In_ LPCSTR pszTwo)
     return (strcmp(pszOne, pszTwo) != 0);
 }
 
+// An import file whose name and symbols are unchanged keeps its original
+// lookup table and name string; only its descriptor is rewritten.
+//
+BOOL CImage::CanReuseImports(CImageImportFile *pImportFile)
+{
+    if (pImportFile->m_fByway ||
+        pImportFile->m_rvaReuseLookup == 0 ||
+        pImportFile->m_rvaReuseName == 0 ||
+        strneq(pImportFile->m_pszName, pImportFile->m_pszOrig)) {
+        return FALSE;
+    }
+    for (DWORD n = 0; n < pImportFile->m_nImportNames; n++) {
+        CImageImportName *pImportName = &pImportFile->m_pImportNames[n];
+
+        if (strneq(pImportName->m_pszName, pImportName->m_pszOrig) ||
+            pImportName->m_nOrdinal != pImportName->m_nOrig) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
 BOOL CImage::CheckImportsNeeded(DWORD *pnTables, DWORD *pnThunks, DWORD *pnChars)
 {
     DWORD nTables = 0;
     DWORD nThunks = 0;
     DWORD nChars = 0;
+    DWORD nReusedThunks = 0;
+    DWORD nReusedChars = 0;
     BOOL fNeedDetourSection = FALSE;
 
     for (CImageImportFile *pImportFile = m_pImportFiles;
          pImportFile != nullptr; pImportFile = pImportFile->m_pNextFile) {
 
-        nChars += (int)strlen(pImportFile->m_pszName) + 1;
-        nChars += nChars & 1;
+        BOOL fReuse = CanReuseImports(pImportFile);
+        DWORD nFileThunks = 0;
+        DWORD nFileChars = 0;
+
+        nFileChars += (int)strlen(pImportFile->m_pszName) + 1;
+        nFileChars += nFileChars & 1;
 
         if (pImportFile->m_fByway) {
             fNeedDetourSection = TRUE;
-            nThunks++;
+            nFileThunks++;
         }
         else {
             if (!fNeedDetourSection &&
@@ -1377,18 +1528,35 @@ BOOL CImage::CheckImportsNeeded(DWORD *pnTables, DWORD *pnThunks, DWORD *pnChars
                 }
 
                 if (pImportName->m_pszName) {
-                    nChars += sizeof(WORD);             // Hint
-                    nChars += (int)strlen(pImportName->m_pszName) + 1;
-                    nChars += nChars & 1;
+                    nFileChars += sizeof(WORD);         // Hint
+                    nFileChars += (int)strlen(pImportName->m_pszName) + 1;
+                    nFileChars += nFileChars & 1;
                 }
-                nThunks++;
+                nFileThunks++;
             }
         }
-        nThunks++;
+        nFileThunks++;
         nTables++;
+
+        if (fReuse) {
+            nReusedThunks += nFileThunks;
+            nReusedChars += nFileChars;
+        }
+        else {
+            nThunks += nFileThunks;
+            nChars += nFileChars;
+        }
     }
     nTables++;
 
+    DWORD cbReused = (DWORD)(2 * sizeof(IMAGE_THUNK_DATA) * nReusedThunks + nReusedChars);
+    DETOUR_TRACE(("CheckImportsNeeded: %u thunks, %u chars rebuilt;"
+                  " %u thunks, %u chars (%u bytes) reused.\n",
+                  nThunks, nChars, nReusedThunks, nReusedChars, cbReused));
+
+    // Nothing is reused unless Write builds a new import table.
+    m_cbImportsReused = fNeedDetourSection ? cbReused : 0;
+
     *pnTables = nTables;
     *pnThunks = nThunks;
     *pnChars = nChars;
@@ -1416,6 +1584,8 @@ CImageImportFile * CImage::NewByway(_In_ LPCSTR pszName)
 
     pImportFile->m_rvaOriginalFirstThunk = 0;
     pImportFile->m_rvaFirstThunk = 0;
+    pImportFile->m_rvaReuseLookup = 0;
+    pImportFile->m_rvaReuseName = 0;
     pImportFile->m_nForwarderChain = (UINT)0;
     pImportFile->m_pImportNames = nullptr;
     pImportFile->m_nImportNames = 0;
@@ -1597,6 +1767,14 @@ BOOL CImage::EditImports(PVOID pContext,
     return FALSE;
 }
 
+// Bytes of lookup thunks and names that the last Write pointed back at in
+// the original image instead of copying into the .detour section.
+//
+DWORD CImage::ImportBytesReused()
+{
+    return m_cbImportsReused;
+}
+
 BOOL CImage::Write(HANDLE hFile)
 {
     DWORD cbDone;
@@ -1614,6 +1792,10 @@ BOOL CImage::Write(HANDLE hFile)
     DWORD nChars = 0;
     BOOL fNeedDetourSection = CheckImportsNeeded(&nTables, &nThunks, &nChars);
 
+    if (!m_pImageData->Index()) {
+        return FALSE;
+    }
+
     //////////////////////////////////////////////////////////// Copy Headers.
     //
     if (SetFilePointer(hFile, 0, nullptr, FILE_BEGIN) == ~0u) {
@@ -1670,19 +1852,24 @@ BOOL CImage::Write(HANDLE hFile)
 
     /////////////////////////////////////////////////////////// Copy Sections.
     //
+    // Sections that abut in the file are copied from the mapping in one
+    // write.  The pending run is flushed before anything else is written.
+    //
+    DWORD nRunPos = 0;
+    DWORD cbRun = 0;
     DWORD n = 0;
     for (; n < m_NtHeader.FileHeader.NumberOfSections; n++) {
         if (m_SectionHeaders[n].SizeOfRawData) {
-            if (SetFilePointer(hFile,
-                               m_SectionHeaders[n].PointerToRawData,
-                               nullptr, FILE_BEGIN) == ~0u) {
-                return FALSE;
+            if (cbRun != 0 && m_SectionHeaders[n].PointerToRawData != nRunPos + cbRun) {
+                if (!CopyFileRange(hFile, nRunPos, cbRun)) {
+                    return FALSE;
+                }
+                cbRun = 0;
             }
-            if (!CopyFileData(hFile,
-                              m_SectionHeaders[n].PointerToRawData,
-                              m_SectionHeaders[n].SizeOfRawData)) {
-                return FALSE;
+            if (cbRun == 0) {
+                nRunPos = m_SectionHeaders[n].PointerToRawData;
             }
+            cbRun += m_SectionHeaders[n].SizeOfRawData;
         }
         m_nNextFileAddr = Max(m_SectionHeaders[n].PointerToRawData +
                               m_SectionHeaders[n].SizeOfRawData,
@@ -1701,10 +1888,21 @@ BOOL CImage::Write(HANDLE hFile)
 
         m_nExtraOffset = Max(m_nNextFileAddr, m_nExtraOffset);
 
+        if (cbRun != 0 && FileAlign(m_nNextFileAddr) != m_nNextFileAddr) {
+            if (!CopyFileRange(hFile, nRunPos, cbRun)) {
+                return FALSE;
+            }
+            cbRun = 0;
+        }
         if (!AlignFileData(hFile)) {
             return FALSE;
         }
     }
+    if (cbRun != 0) {
+        if (!CopyFileRange(hFile, nRunPos, cbRun)) {
+            return FALSE;
+        }
+    }
 
     if (fNeedDetourSection || !m_pImageData->IsEmpty()) {
 
@@ -1831,10 +2029,19 @@ BOOL CImage::Write(HANDLE hFile)
              pImportFile != nullptr; pImportFile = pImportFile->m_pNextFile) {
 
             RtlSecureZeroMemory(piidDst, sizeof(piidDst));
-            nameTable.Allocate(pImportFile->m_pszName, (DWORD *)&piidDst->Name);
             piidDst->TimeDateStamp = 0;
             piidDst->ForwarderChain = pImportFile->m_nForwarderChain;
 
+            if (CanReuseImports(pImportFile)) {
+                piidDst->Name = pImportFile->m_rvaReuseName;
+                piidDst->OriginalFirstThunk = pImportFile->m_rvaReuseLookup;
+                piidDst->FirstThunk = (ULONG)pImportFile->m_rvaFirstThunk;
+                piidDst++;
+                continue;
+            }
+
+            nameTable.Allocate(pImportFile->m_pszName, (DWORD *)&piidDst->Name);
+
             if (pImportFile->m_fByway) {
                 ULONG rvaIgnored;
 
@@ -1953,16 +2160,23 @@ BOOL CImage::Write(HANDLE hFile)
         }
 
         DWORD nEntries = debugSize / sizeof(*pDir);
+        PIMAGE_DEBUG_DIRECTORY pDirs = new NOTHROW IMAGE_DEBUG_DIRECTORY [nEntries ? nEntries : 1];
+        if (pDirs == nullptr) {
+            DetoursSetLastError(DETOURS_STATUS_OUTOFMEMORY);
+            return FALSE;
+        }
         for (n = 0; n < nEntries; n++) {
-            IMAGE_DEBUG_DIRECTORY dir = pDir[n];
+            pDirs[n] = pDir[n];
 
-            if (dir.PointerToRawData > m_nExtraOffset) {
-                dir.PointerToRawData += nExtraAdjust;
-            }
-            if (!WriteFile(hFile, &dir, sizeof(dir), &cbDone)) {
-                return FALSE;
+            if (pDirs[n].PointerToRawData > m_nExtraOffset) {
+                pDirs[n].PointerToRawData += nExtraAdjust;
             }
         }
+        BOOL fWrote = WriteFile(hFile, pDirs, nEntries * sizeof(*pDirs), &cbDone);
+        delete[] pDirs;
+        if (!fWrote) {
+            return FALSE;
+        }
     }
 
     /////////////////////////////////////////////////////// Adjust CLR Header.
@@ -2064,6 +2278,16 @@ BOOL DETOURS_API DetourBinaryWrite(_In_ PDETOUR_BINARY pdi,
     return pImage->Write(hFile);
 }
 
+DWORD DETOURS_API DetourBinaryGetImportBytesReused(_In_ PDETOUR_BINARY pBinary)
+{
+    Detour::CImage *pImage = Detour::CImage::IsValid(pBinary);
+    if (pImage == nullptr) {
+        return 0;
+    }
+
+    return pImage->ImportBytesReused();
+}
+
 _Writable_bytes_(*pcbData)
 _Readable_bytes_(*pcbData)
 _Success_(return != nullptr)
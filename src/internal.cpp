@@ -153,3 +153,44 @@ DetoursQueryModuleMemoryBaseInformationForAddress(
 #endif
 }
 
+//////////////////////////////////////////////////////////////////////////
+// Detours Virtual Memory impl
+//
+// The trampoline region allocator only needs to walk, reserve and release
+// ranges of the current address space.  Keep those primitives here so the
+// region search in detours.cpp has a single place to go to the OS.  Only
+// the user-mode detours.cpp uses them; detours_kernel.cpp manages its own
+// trampoline memory.
+
+#ifdef DetoursUserMode
+
+SIZE_T DETOURS_API
+DetoursQueryVirtualMemory(
+    _In_opt_ LPVOID lpAddress,
+    _Out_writes_bytes_to_(dwLength, return) PMEMORY_BASIC_INFORMATION lpBuffer,
+    _In_ SIZE_T dwLength
+)
+{
+    return ::VirtualQuery(lpAddress, lpBuffer, dwLength);
+}
+
+LPVOID DETOURS_API
+DetoursAllocateVirtualMemory(
+    _In_opt_ LPVOID lpAddress,
+    _In_ SIZE_T dwSize,
+    _In_ DWORD flAllocationType,
+    _In_ DWORD flProtect
+)
+{
+    return ::VirtualAlloc(lpAddress, dwSize, flAllocationType, flProtect);
+}
+
+BOOL DETOURS_API
+DetoursFreeVirtualMemory(
+    _In_ LPVOID lpAddress
+)
+{
+    return ::VirtualFree(lpAddress, 0, MEM_RELEASE);
+}
+
+#endif // DetoursUserMode
@@ -37,6 +37,7 @@
 #ifdef DetoursUserMode
 #   define _ARM_WINAPI_PARTITION_DESKTOP_SDK_AVAILABLE 1
 #   include <windows.h>
+#   include <tlhelp32.h>
 #   include <strsafe.h>
 #else
 #   include <ntddk.h>
@@ -83,6 +84,7 @@
 #define DETOURS_STATUS_INVALID_BLOCK            ERROR_INVALID_BLOCK
 #define DETOURS_STATUS_OUTOFMEMORY              ERROR_OUTOFMEMORY
 #define DETOURS_STATUS_MOD_NOT_FOUND            ERROR_MOD_NOT_FOUND
+#define DETOURS_STATUS_PROC_NOT_FOUND           ERROR_PROC_NOT_FOUND
 #define DETOURS_STATUS_BAD_EXE_FORMAT           ERROR_BAD_EXE_FORMAT
 #define DETOURS_STATUS_INVALID_EXE_SIGNATURE    ERROR_INVALID_EXE_SIGNATURE
 #define DETOURS_STATUS_CALL_NOT_IMPLEMENTED     ERROR_CALL_NOT_IMPLEMENTED
@@ -96,6 +98,7 @@
 #define DETOURS_STATUS_INVALID_BLOCK            STATUS_INVALID_ADDRESS
 #define DETOURS_STATUS_OUTOFMEMORY              STATUS_BUFFER_OVERFLOW
 #define DETOURS_STATUS_MOD_NOT_FOUND            STATUS_DLL_NOT_FOUND
+#define DETOURS_STATUS_PROC_NOT_FOUND           STATUS_PROCEDURE_NOT_FOUND
 #define DETOURS_STATUS_BAD_EXE_FORMAT           STATUS_INVALID_IMAGE_WIN_32
 #define DETOURS_STATUS_INVALID_EXE_SIGNATURE    STATUS_INVALID_IMAGE_NOT_MZ
 #define DETOURS_STATUS_CALL_NOT_IMPLEMENTED     STATUS_NOT_IMPLEMENTED
@@ -129,3 +132,69 @@ DetoursQueryModuleMemoryBaseInformationForAddress(
     _Out_writes_bytes_to_(dwLength, return) PMEMORY_BASIC_INFORMATION lpBuffer, 
     _In_ SIZE_T dwLength
 );
+
+#ifdef DetoursUserMode
+
+SIZE_T DETOURS_API
+DetoursQueryVirtualMemory(
+    _In_opt_ LPVOID lpAddress,
+    _Out_writes_bytes_to_(dwLength, return) PMEMORY_BASIC_INFORMATION lpBuffer,
+    _In_ SIZE_T dwLength
+);
+
+LPVOID DETOURS_API
+DetoursAllocateVirtualMemory(
+    _In_opt_ LPVOID lpAddress,
+    _In_ SIZE_T dwSize,
+    _In_ DWORD flAllocationType,
+    _In_ DWORD flProtect
+);
+
+BOOL DETOURS_API
+DetoursFreeVirtualMemory(
+    _In_ LPVOID lpAddress
+);
+
+#endif // DetoursUserMode
+
+#ifdef DetoursUserMode
+//////////////////////////////////////////////////////////////////////////
+// Checked PE view (modules.cpp)
+//
+// Used for loaded modules and for mapped files in CImage::Read.  cbView
+// bounds the header reads: the file size for a file view, or MAXDWORD for
+// a loaded image, where the caller's __try catches a truncated image.
+// Errors are reported through DetoursSetLastError.
+
+PIMAGE_NT_HEADERS
+detour_image_headers(
+    _In_ PIMAGE_DOS_HEADER pDosHeader,
+    _In_ DWORD cbView
+);
+
+PIMAGE_SECTION_HEADER
+detour_image_sections(
+    _In_ PIMAGE_NT_HEADERS pNtHeader
+);
+
+PIMAGE_DATA_DIRECTORY
+detour_image_data_directory(
+    _In_ PIMAGE_NT_HEADERS pNtHeader,
+    _In_ DWORD nEntry
+);
+
+PBYTE
+detour_image_directory(
+    _In_ PIMAGE_DOS_HEADER pDosHeader,
+    _In_ PIMAGE_NT_HEADERS pNtHeader,
+    _In_ DWORD nEntry,
+    _Out_ DWORD *pcbSize
+);
+
+PDETOUR_SECTION_RECORD
+detour_find_payload_record(
+    _In_reads_bytes_(cbData) PBYTE pbData,
+    _In_ DWORD cbData,
+    _In_ REFGUID rguid
+);
+#endif
@@ -25,6 +25,10 @@ const GUID DETOUR_EXE_RESTORE_GUID = {
     0x2ed7a3ff, 0x3339, 0x4a8d,
     { 0x80, 0x5c, 0xd4, 0x98, 0x15, 0x3f, 0xc2, 0x8f }};
 
+const GUID DETOUR_PAYLOAD_INDEX_GUID = { /* 5c3b8e41-7d2a-4f6e-a1b9-0e4d6c8f2a73 */
+    0x5c3b8e41, 0x7d2a, 0x4f6e,
+    { 0xa1, 0xb9, 0x0e, 0x4d, 0x6c, 0x8f, 0x2a, 0x73 }};
+
 //////////////////////////////////////////////////////////////////////////////
 //
 
@@ -242,7 +246,9 @@ PVOID DETOURS_API DetourFindFunction(_In_ LPCSTR pszModule,
 //////////////////////////////////////////////////// Module Image Functions.
 //
 
-HMODULE DETOURS_API DetourEnumerateModules(_In_opt_ HMODULE hModuleLast)
+static PDETOUR_LOADED_BINARY DETOURS_API GetPayloadSectionFromModule(HMODULE hModule);
+
+static HMODULE detour_next_module(HMODULE hModuleLast)
 {
     PBYTE pbLast = (PBYTE)hModuleLast + MM_ALLOCATION_GRANULARITY;
 
@@ -289,6 +295,358 @@ HMODULE DETOURS_API DetourEnumerateModules(_In_opt_ HMODULE hModuleLast)
     return nullptr;
 }
 
+/////////////////////////////////////////////////////////// Module Map Cache.
+//
+// An opt-in snapshot of the mapped images, sorted by base address, so that
+// module enumeration, address lookup and payload search don't walk the
+// whole address space each time.  The loader bumps the generation on every
+// load and unload (where LdrRegisterDllNotification exists); callers can
+// also bump it with DetourInvalidateModuleMap.
+//
+struct DETOUR_MODULE_ENTRY
+{
+    PBYTE                   pbBase;
+    PBYTE                   pbEnd;
+    PDETOUR_LOADED_BINARY   pPayloads;      // .detour section, if any.
+};
+
+// The loader's LDR_DLL_NOTIFICATION_DATA; loads and unloads share a layout.
+struct DETOUR_LDR_DLL_NOTIFICATION_DATA
+{
+    ULONG                   Flags;
+    PVOID                   FullDllName;
+    PVOID                   BaseDllName;
+    PVOID                   DllBase;
+    ULONG                   SizeOfImage;
+};
+
+#define DETOUR_LDR_DLL_NOTIFICATION_REASON_LOADED       1
+#define DETOUR_LDR_DLL_NOTIFICATION_REASON_UNLOADED     2
+
+typedef VOID (NTAPI * PF_LDR_DLL_NOTIFICATION)(ULONG nReason,
+                                               PVOID pData,
+                                               PVOID pContext);
+typedef LONG (NTAPI * PF_LDR_REGISTER_DLL_NOTIFICATION)(ULONG nFlags,
+                                                        PF_LDR_DLL_NOTIFICATION pfNotify,
+                                                        PVOID pContext,
+                                                        PVOID *ppCookie);
+typedef LONG (NTAPI * PF_LDR_UNREGISTER_DLL_NOTIFICATION)(PVOID pCookie);
+
+static CRITICAL_SECTION         s_csModuleMap;
+static CRITICAL_SECTION         s_csModuleMapEnable;    // Serializes DetourSetModuleMapCache.
+static volatile LONG            s_nModuleMapLock        = 0;    // 1 = initializing, 2 = ready.
+static BOOL                     s_fModuleMapEnabled     = FALSE;
+static BOOL                     s_fModuleMapValid       = FALSE;
+static volatile LONG            s_nModuleMapGeneration  = 0;
+static LONG                     s_nModuleMapBuilt       = 0;
+static DETOUR_MODULE_ENTRY *    s_pModuleMap            = nullptr;
+static ULONG                    s_cModuleMap            = 0;
+static ULONG                    s_cModuleMapMax         = 0;
+static PVOID                    s_pvLoaderCookie        = nullptr;
+
+// Images the loader has announced it is unloading.  The notification comes
+// before the unmap, so a rebuild in between would still find the image and
+// keep it in a map marked current.  The rebuild skips these bases; a later
+// load at the same base clears the entry.  Only the notification, which the
+// loader serializes, writes the table.
+static PVOID volatile           s_rpvModuleMapUnloading[8] = { 0 };
+static ULONG                    s_nModuleMapUnloadingNext = 0;
+
+// InitOnceExecuteOnce needs Vista and the library still targets XP, so the
+// critical sections are published with an interlocked state instead.
+static VOID detour_module_map_lock_init()
+{
+    if (InterlockedCompareExchange(&s_nModuleMapLock, 1, 0) == 0) {
+        InitializeCriticalSection(&s_csModuleMap);
+        InitializeCriticalSection(&s_csModuleMapEnable);
+        InterlockedExchange(&s_nModuleMapLock, 2);
+        return;
+    }
+    while (InterlockedCompareExchange(&s_nModuleMapLock, 2, 2) != 2) {
+        SwitchToThread();
+    }
+}
+
+static VOID NTAPI detour_module_map_notify(ULONG nReason, PVOID pData, PVOID pContext)
+{
+    // Called under the loader lock, so only note the base and bump the
+    // generation.
+    (void)pContext;
+
+    PVOID pvBase = ((DETOUR_LDR_DLL_NOTIFICATION_DATA *)pData)->DllBase;
+    if (nReason == DETOUR_LDR_DLL_NOTIFICATION_REASON_UNLOADED) {
+        s_rpvModuleMapUnloading[s_nModuleMapUnloadingNext] = pvBase;
+        s_nModuleMapUnloadingNext = (s_nModuleMapUnloadingNext + 1)
+            % (ULONG)ARRAYSIZE(s_rpvModuleMapUnloading);
+    }
+    else if (nReason == DETOUR_LDR_DLL_NOTIFICATION_REASON_LOADED) {
+        for (ULONG n = 0; n < ARRAYSIZE(s_rpvModuleMapUnloading); n++) {
+            if (s_rpvModuleMapUnloading[n] == pvBase) {
+                s_rpvModuleMapUnloading[n] = nullptr;
+            }
+        }
+    }
+    InterlockedIncrement(&s_nModuleMapGeneration);
+}
+
+static BOOL detour_module_map_unloading(HMODULE hModule)
+{
+    for (ULONG n = 0; n < ARRAYSIZE(s_rpvModuleMapUnloading); n++) {
+        if (s_rpvModuleMapUnloading[n] == (PVOID)hModule) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// Called with s_csModuleMap held.
+static BOOL detour_module_map_refresh()
+{
+    LONG nGeneration = s_nModuleMapGeneration;
+    if (s_fModuleMapValid && s_nModuleMapBuilt == nGeneration) {
+        return TRUE;
+    }
+
+    s_fModuleMapValid = FALSE;
+    ULONG c = 0;
+    for (HMODULE hModule = nullptr; (hModule = detour_next_module(hModule)) != nullptr;) {
+        if (detour_module_map_unloading(hModule)) {
+            continue;
+        }
+        if (c == s_cModuleMapMax) {
+            ULONG cMax = s_cModuleMapMax ? s_cModuleMapMax * 2 : 64;
+            DETOUR_MODULE_ENTRY *pMap = new NOTHROW DETOUR_MODULE_ENTRY [cMax];
+            if (pMap == nullptr) {
+                s_cModuleMap = 0;
+                return FALSE;
+            }
+            if (s_pModuleMap != nullptr) {
+                memcpy(pMap, s_pModuleMap, c * sizeof(DETOUR_MODULE_ENTRY));
+                delete [] s_pModuleMap;
+            }
+            s_pModuleMap = pMap;
+            s_cModuleMapMax = cMax;
+        }
+
+        // detour_next_module walks upward, so the map comes out sorted.
+        PIMAGE_DOS_HEADER pDosHeader = (PIMAGE_DOS_HEADER)hModule;
+        DETOUR_MODULE_ENTRY *pEntry = &s_pModuleMap[c++];
+        pEntry->pbBase = (PBYTE)pDosHeader;
+        pEntry->pbEnd = (PBYTE)pDosHeader + DetourGetModuleSize(hModule);
+        pEntry->pPayloads = GetPayloadSectionFromModule(hModule);
+    }
+
+    s_cModuleMap = c;
+    s_nModuleMapBuilt = nGeneration;
+    s_fModuleMapValid = TRUE;
+    return TRUE;
+}
+
+// Returns TRUE, holding s_csModuleMap, if the map is enabled and current.
+static BOOL detour_module_map_enter()
+{
+    if (!s_fModuleMapEnabled) {
+        return FALSE;
+    }
+
+    detour_module_map_lock_init();
+    EnterCriticalSection(&s_csModuleMap);
+    if (s_fModuleMapEnabled && detour_module_map_refresh()) {
+        return TRUE;
+    }
+    LeaveCriticalSection(&s_csModuleMap);
+    return FALSE;
+}
+
+static void detour_module_map_leave()
+{
+    LeaveCriticalSection(&s_csModuleMap);
+}
+
+// Index of the first module whose base is above pb.
+static ULONG detour_module_map_upper_bound(PBYTE pb)
+{
+    ULONG nLo = 0;
+    ULONG nHi = s_cModuleMap;
+    while (nLo < nHi) {
+        ULONG nMid = nLo + (nHi - nLo) / 2;
+        if (s_pModuleMap[nMid].pbBase <= pb) {
+            nLo = nMid + 1;
+        }
+        else {
+            nHi = nMid;
+        }
+    }
+    return nLo;
+}
+
+BOOL DETOURS_API DetourSetModuleMapCache(_In_ BOOL fEnable)
+{
+    detour_module_map_lock_init();
+
+    // s_csModuleMapEnable makes the check and the loader registration one
+    // step, so racing callers can't both register.  The loader calls are
+    // made outside s_csModuleMap; a DllMain may be waiting on it while
+    // holding the loader lock.
+    EnterCriticalSection(&s_csModuleMapEnable);
+
+    BOOL fPrevious = s_fModuleMapEnabled;
+    HMODULE hNtdll = GetModuleHandleW(L"ntdll.dll");
+
+    if (fEnable && !fPrevious) {
+        PF_LDR_REGISTER_DLL_NOTIFICATION pfRegister = nullptr;
+        if (hNtdll != nullptr) {
+            pfRegister = (PF_LDR_REGISTER_DLL_NOTIFICATION)
+                GetProcAddress(hNtdll, "LdrRegisterDllNotification");
+        }
+        if (pfRegister == nullptr ||
+            pfRegister(0, detour_module_map_notify, nullptr, &s_pvLoaderCookie) < 0) {
+            // Older systems: only DetourInvalidateModuleMap refreshes the map.
+            s_pvLoaderCookie = nullptr;
+        }
+
+        EnterCriticalSection(&s_csModuleMap);
+        s_fModuleMapValid = FALSE;
+        s_fModuleMapEnabled = TRUE;
+        LeaveCriticalSection(&s_csModuleMap);
+    }
+    else if (!fEnable && fPrevious) {
+        EnterCriticalSection(&s_csModuleMap);
+        s_fModuleMapEnabled = FALSE;
+        s_fModuleMapValid = FALSE;
+        delete [] s_pModuleMap;
+        s_pModuleMap = nullptr;
+        s_cModuleMap = 0;
+        s_cModuleMapMax = 0;
+        LeaveCriticalSection(&s_csModuleMap);
+
+        if (s_pvLoaderCookie != nullptr) {
+            PF_LDR_UNREGISTER_DLL_NOTIFICATION pfUnregister = nullptr;
+            if (hNtdll != nullptr) {
+                pfUnregister = (PF_LDR_UNREGISTER_DLL_NOTIFICATION)
+                    GetProcAddress(hNtdll, "LdrUnregisterDllNotification");
+            }
+            if (pfUnregister != nullptr) {
+                pfUnregister(s_pvLoaderCookie);
+            }
+            s_pvLoaderCookie = nullptr;
+        }
+    }
+
+    LeaveCriticalSection(&s_csModuleMapEnable);
+    return fPrevious;
+}
+
+VOID DETOURS_API DetourInvalidateModuleMap(VOID)
+{
+    InterlockedIncrement(&s_nModuleMapGeneration);
+}
+
+HMODULE DETOURS_API DetourEnumerateModules(_In_opt_ HMODULE hModuleLast)
+{
+    if (detour_module_map_enter()) {
+        ULONG n = detour_module_map_upper_bound((PBYTE)hModuleLast);
+        HMODULE hModule = (n < s_cModuleMap) ? (HMODULE)s_pModuleMap[n].pbBase : nullptr;
+        detour_module_map_leave();
+        return hModule;
+    }
+    return detour_next_module(hModuleLast);
+}
+
+///////////////////////////////////////////////////////////// Image Headers.
+//
+// The checked PE view declared in internal.h, shared with CImage::Read.
+//
+PIMAGE_NT_HEADERS detour_image_headers(PIMAGE_DOS_HEADER pDosHeader, DWORD cbView)
+{
+    if (cbView < sizeof(*pDosHeader) || pDosHeader->e_magic != IMAGE_DOS_SIGNATURE) {
+        DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
+        return nullptr;
+    }
+
+    DWORD nPeOffset = (DWORD)pDosHeader->e_lfanew;
+    DWORD cbNtFixed = (DWORD)FIELD_OFFSET(IMAGE_NT_HEADERS, OptionalHeader);
+    if (nPeOffset > cbView || cbView - nPeOffset < cbNtFixed) {
+        DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
+        return nullptr;
+    }
+
+    PIMAGE_NT_HEADERS pNtHeader = (PIMAGE_NT_HEADERS)((PBYTE)pDosHeader + nPeOffset);
+    if (pNtHeader->Signature != IMAGE_NT_SIGNATURE) {
+        DetoursSetLastError(DETOURS_STATUS_INVALID_EXE_SIGNATURE);
+        return nullptr;
+    }
+    if (pNtHeader->FileHeader.SizeOfOptionalHeader == 0) {
+        DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
+        return nullptr;
+    }
+
+    // The optional header and the section table must lie inside the view.
+    DWORD cbHeaders = (DWORD)pNtHeader->FileHeader.SizeOfOptionalHeader
+        + (DWORD)pNtHeader->FileHeader.NumberOfSections * (DWORD)sizeof(IMAGE_SECTION_HEADER);
+    if (cbView - nPeOffset - cbNtFixed < cbHeaders) {
+        DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
+        return nullptr;
+    }
+    return pNtHeader;
+}
+
+PIMAGE_SECTION_HEADER detour_image_sections(PIMAGE_NT_HEADERS pNtHeader)
+{
+    return (PIMAGE_SECTION_HEADER)((PBYTE)pNtHeader
+                                   + sizeof(pNtHeader->Signature)
+                                   + sizeof(pNtHeader->FileHeader)
+                                   + pNtHeader->FileHeader.SizeOfOptionalHeader);
+}
+
+// Returns data directory nEntry, reading either optional header layout so a
+// 32-bit image viewed from a 64-bit process (or the reverse) works.  Returns
+// nullptr if the directory is absent or does not fit within SizeOfImage.
+PIMAGE_DATA_DIRECTORY detour_image_data_directory(PIMAGE_NT_HEADERS pNtHeader, DWORD nEntry)
+{
+    PIMAGE_DATA_DIRECTORY pDir = nullptr;
+    DWORD cbImage = 0;
+
+    if (pNtHeader->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC) {
+        PIMAGE_OPTIONAL_HEADER32 pOpt = &((PIMAGE_NT_HEADERS32)pNtHeader)->OptionalHeader;
+        cbImage = pOpt->SizeOfImage;
+        if (nEntry < pOpt->NumberOfRvaAndSizes) {
+            pDir = &pOpt->DataDirectory[nEntry];
+        }
+    }
+    else if (pNtHeader->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC) {
+        PIMAGE_OPTIONAL_HEADER64 pOpt = &((PIMAGE_NT_HEADERS64)pNtHeader)->OptionalHeader;
+        cbImage = pOpt->SizeOfImage;
+        if (nEntry < pOpt->NumberOfRvaAndSizes) {
+            pDir = &pOpt->DataDirectory[nEntry];
+        }
+    }
+
+    if (pDir == nullptr ||
+        pDir->VirtualAddress == 0 ||
+        pDir->VirtualAddress >= cbImage ||
+        pDir->Size > cbImage - pDir->VirtualAddress) {
+        return nullptr;
+    }
+    return pDir;
+}
+
+// Returns the start of data directory nEntry in a loaded image.
+PBYTE detour_image_directory(PIMAGE_DOS_HEADER pDosHeader,
+                             PIMAGE_NT_HEADERS pNtHeader,
+                             DWORD nEntry,
+                             DWORD *pcbSize)
+{
+    PIMAGE_DATA_DIRECTORY pDir = detour_image_data_directory(pNtHeader, nEntry);
+
+    *pcbSize = 0;
+    if (pDir == nullptr) {
+        return nullptr;
+    }
+    *pcbSize = pDir->Size;
+    return (PBYTE)pDosHeader + pDir->VirtualAddress;
+}
+
 PVOID DETOURS_API DetourGetEntryPoint(_In_opt_ HMODULE hModule)
 {
     PIMAGE_DOS_HEADER pDosHeader = (PIMAGE_DOS_HEADER)hModule;
@@ -298,41 +656,18 @@ PVOID DETOURS_API DetourGetEntryPoint(_In_opt_ HMODULE hModule)
 
     __try {
 #pragma warning(suppress:6011) // GetModuleHandleW(nullptr) never returns nullptr.
-        if (pDosHeader->e_magic != IMAGE_DOS_SIGNATURE) {
-            DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
+        PIMAGE_NT_HEADERS pNtHeader = detour_image_headers(pDosHeader, MAXDWORD);
+        if (pNtHeader == nullptr) {
+            // Error set by detour_image_headers.
             return nullptr;
         }
 
-        PIMAGE_NT_HEADERS pNtHeader = (PIMAGE_NT_HEADERS)((PBYTE)pDosHeader +
-                                                          pDosHeader->e_lfanew);
-        if (pNtHeader->Signature != IMAGE_NT_SIGNATURE) {
-            DetoursSetLastError(DETOURS_STATUS_INVALID_EXE_SIGNATURE);
-            return nullptr;
-        }
-        if (pNtHeader->FileHeader.SizeOfOptionalHeader == 0) {
-            DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
-            return nullptr;
-        }
+        DWORD cbClrHeader = 0;
+        PDETOUR_CLR_HEADER pClrHeader = (PDETOUR_CLR_HEADER)
+            detour_image_directory(pDosHeader, pNtHeader,
+                                   IMAGE_DIRECTORY_ENTRY_COM_DESCRIPTOR, &cbClrHeader);
 
-        PDETOUR_CLR_HEADER pClrHeader = nullptr;
-        if (pNtHeader->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC) {
-            if (((PIMAGE_NT_HEADERS32)pNtHeader)->CLR_DIRECTORY.VirtualAddress != 0 &&
-                ((PIMAGE_NT_HEADERS32)pNtHeader)->CLR_DIRECTORY.Size != 0) {
-                pClrHeader = (PDETOUR_CLR_HEADER)
-                    (((PBYTE)pDosHeader)
-                     + ((PIMAGE_NT_HEADERS32)pNtHeader)->CLR_DIRECTORY.VirtualAddress);
-            }
-        }
-        else if (pNtHeader->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC) {
-            if (((PIMAGE_NT_HEADERS64)pNtHeader)->CLR_DIRECTORY.VirtualAddress != 0 &&
-                ((PIMAGE_NT_HEADERS64)pNtHeader)->CLR_DIRECTORY.Size != 0) {
-                pClrHeader = (PDETOUR_CLR_HEADER)
-                    (((PBYTE)pDosHeader)
-                     + ((PIMAGE_NT_HEADERS64)pNtHeader)->CLR_DIRECTORY.VirtualAddress);
-            }
-        }
-
-        if (pClrHeader != nullptr) {
+        if (pClrHeader != nullptr && cbClrHeader != 0) {
             // For MSIL assemblies, we want to use the _Cor entry points.
 
             HMODULE hClr = GetModuleHandleW(L"MSCOREE.DLL");
@@ -371,19 +706,9 @@ ULONG DETOURS_API DetourGetModuleSize(_In_opt_ HMODULE hModule)
 
     __try {
 #pragma warning(suppress:6011) // GetModuleHandleW(nullptr) never returns nullptr.
-        if (pDosHeader->e_magic != IMAGE_DOS_SIGNATURE) {
-            DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
-            return 0;
-        }
-
-        PIMAGE_NT_HEADERS pNtHeader = (PIMAGE_NT_HEADERS)((PBYTE)pDosHeader +
-                                                          pDosHeader->e_lfanew);
-        if (pNtHeader->Signature != IMAGE_NT_SIGNATURE) {
-            DetoursSetLastError(DETOURS_STATUS_INVALID_EXE_SIGNATURE);
-            return 0;
-        }
-        if (pNtHeader->FileHeader.SizeOfOptionalHeader == 0) {
-            DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
+        PIMAGE_NT_HEADERS pNtHeader = detour_image_headers(pDosHeader, MAXDWORD);
+        if (pNtHeader == nullptr) {
+            // Error set by detour_image_headers.
             return 0;
         }
         DetoursSetLastError(DETOURS_STATUS_SUCCESS);
@@ -399,6 +724,21 @@ ULONG DETOURS_API DetourGetModuleSize(_In_opt_ HMODULE hModule)
 
 HMODULE DETOURS_API DetourGetContainingModule(_In_ PVOID pvAddr)
 {
+    if (detour_module_map_enter()) {
+        ULONG n = detour_module_map_upper_bound((PBYTE)pvAddr);
+        HMODULE hModule = nullptr;
+        if (n > 0 && (PBYTE)pvAddr < s_pModuleMap[n - 1].pbEnd) {
+            hModule = (HMODULE)s_pModuleMap[n - 1].pbBase;
+        }
+        detour_module_map_leave();
+
+        if (hModule != nullptr) {
+            DetoursSetLastError(DETOURS_STATUS_SUCCESS);
+            return hModule;
+        }
+        // Not an image the map knows about, ask the memory manager.
+    }
+
     MEMORY_BASIC_INFORMATION mbi;
     RtlSecureZeroMemory(&mbi, sizeof(mbi));
 
@@ -418,19 +758,9 @@ HMODULE DETOURS_API DetourGetContainingModule(_In_ PVOID pvAddr)
         }
 
         PIMAGE_DOS_HEADER pDosHeader = (PIMAGE_DOS_HEADER)mbi.AllocationBase;
-        if (pDosHeader->e_magic != IMAGE_DOS_SIGNATURE) {
-            DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
-            return nullptr;
-        }
-
-        PIMAGE_NT_HEADERS pNtHeader = (PIMAGE_NT_HEADERS)((PBYTE)pDosHeader +
-                                                          pDosHeader->e_lfanew);
-        if (pNtHeader->Signature != IMAGE_NT_SIGNATURE) {
-            DetoursSetLastError(DETOURS_STATUS_INVALID_EXE_SIGNATURE);
-            return nullptr;
-        }
-        if (pNtHeader->FileHeader.SizeOfOptionalHeader == 0) {
-            DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
+        PIMAGE_NT_HEADERS pNtHeader = detour_image_headers(pDosHeader, MAXDWORD);
+        if (pNtHeader == nullptr) {
+            // Error set by detour_image_headers.
             return nullptr;
         }
         DetoursSetLastError(DETOURS_STATUS_SUCCESS);
@@ -462,42 +792,58 @@ BOOL DETOURS_API DetourEnumerateExports(_In_ HMODULE hModule,
         pDosHeader = (PIMAGE_DOS_HEADER)GetModuleHandleW(nullptr);
     }
 
+    // Name index (plus one) of each function, zero if it has no name.
+    DWORD rnStackNames[512];
+    PDWORD pnNames = nullptr;
+
     __try {
 #pragma warning(suppress:6011) // GetModuleHandleW(nullptr) never returns nullptr.
-        if (pDosHeader->e_magic != IMAGE_DOS_SIGNATURE) {
-            DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
-            return FALSE;
-        }
-
-        PIMAGE_NT_HEADERS pNtHeader = (PIMAGE_NT_HEADERS)((PBYTE)pDosHeader +
-                                                          pDosHeader->e_lfanew);
-        if (pNtHeader->Signature != IMAGE_NT_SIGNATURE) {
-            DetoursSetLastError(DETOURS_STATUS_INVALID_EXE_SIGNATURE);
-            return FALSE;
-        }
-        if (pNtHeader->FileHeader.SizeOfOptionalHeader == 0) {
-            DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
+        PIMAGE_NT_HEADERS pNtHeader = detour_image_headers(pDosHeader, MAXDWORD);
+        if (pNtHeader == nullptr) {
+            // Error set by detour_image_headers.
             return FALSE;
         }
 
+        DWORD cbExportDir = 0;
         PIMAGE_EXPORT_DIRECTORY pExportDir
             = (PIMAGE_EXPORT_DIRECTORY)
-            RvaAdjust(pDosHeader,
-                      pNtHeader->OptionalHeader
-                      .DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].VirtualAddress);
+            detour_image_directory(pDosHeader, pNtHeader,
+                                   IMAGE_DIRECTORY_ENTRY_EXPORT, &cbExportDir);
 
         if (pExportDir == nullptr) {
             DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
             return FALSE;
         }
 
-        PBYTE pExportDirEnd = (PBYTE)pExportDir + pNtHeader->OptionalHeader
-            .DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].Size;
+        PBYTE pExportDirEnd = (PBYTE)pExportDir + cbExportDir;
         PDWORD pdwFunctions = (PDWORD)RvaAdjust(pDosHeader, pExportDir->AddressOfFunctions);
         PDWORD pdwNames = (PDWORD)RvaAdjust(pDosHeader, pExportDir->AddressOfNames);
         PWORD pwOrdinals = (PWORD)RvaAdjust(pDosHeader, pExportDir->AddressOfNameOrdinals);
+        DWORD const cFunctions = pExportDir->NumberOfFunctions;
+        DWORD const cNames = pExportDir->NumberOfNames;
+
+        // Invert the name ordinals in one pass instead of searching them per function.
+        if (cFunctions <= ARRAYSIZE(rnStackNames)) {
+            pnNames = rnStackNames;
+        }
+        else {
+            pnNames = new NOTHROW DWORD [cFunctions];
+            if (pnNames == nullptr) {
+                DetoursSetLastError(DETOURS_STATUS_INSUFFICIENT_RESOURCES);
+                return FALSE;
+            }
+        }
+        RtlSecureZeroMemory(pnNames, cFunctions * sizeof(DWORD));
 
-        for (DWORD nFunc = 0; nFunc < pExportDir->NumberOfFunctions; nFunc++) {
+        for (DWORD n = 0; n < cNames; n++) {
+            WORD const nFunc = pwOrdinals[n];
+            // Keep the first name, as the search did.
+            if (nFunc < cFunctions && pnNames[nFunc] == 0) {
+                pnNames[nFunc] = n + 1;
+            }
+        }
+
+        for (DWORD nFunc = 0; nFunc < cFunctions; nFunc++) {
             PBYTE pbCode = (pdwFunctions != nullptr)
                 ? (PBYTE)RvaAdjust(pDosHeader, pdwFunctions[nFunc]) : nullptr;
             PCHAR pszName = nullptr;
@@ -507,12 +853,9 @@ BOOL DETOURS_API DetourEnumerateExports(_In_ HMODULE hModule,
                 pbCode = nullptr;
             }
 
-            for (DWORD n = 0; n < pExportDir->NumberOfNames; n++) {
-                if (pwOrdinals[n] == nFunc) {
-                    pszName = (pdwNames != nullptr)
-                        ? (PCHAR)RvaAdjust(pDosHeader, pdwNames[n]) : nullptr;
-                    break;
-                }
+            if (pnNames[nFunc] != 0) {
+                pszName = (pdwNames != nullptr)
+                    ? (PCHAR)RvaAdjust(pDosHeader, pdwNames[pnNames[nFunc] - 1]) : nullptr;
             }
             ULONG nOrdinal = pExportDir->Base + nFunc;
 
@@ -520,16 +863,173 @@ BOOL DETOURS_API DetourEnumerateExports(_In_ HMODULE hModule,
                 break;
             }
         }
+
+        if (pnNames != rnStackNames) {
+            delete [] pnNames;
+        }
         DetoursSetLastError(DETOURS_STATUS_SUCCESS);
         return TRUE;
     }
     __except(GetExceptionCode() == EXCEPTION_ACCESS_VIOLATION ?
              EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+        if (pnNames != rnStackNames) {
+            delete [] pnNames;
+        }
         DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
         return FALSE;
     }
 }
 
+// Forwarder chains longer than this are treated as cycles.
+const ULONG DETOUR_MAX_FORWARDS = 16;
+
+static PVOID detour_find_export(PIMAGE_DOS_HEADER pDosHeader, LPCSTR pszName, ULONG nDepth);
+
+// Resolve "module.function" or "module.#ordinal" from a forwarder string.
+static PVOID detour_find_forward(PCSTR pszForward, ULONG nDepth)
+{
+    if (nDepth >= DETOUR_MAX_FORWARDS) {
+        DetoursSetLastError(DETOURS_STATUS_PROC_NOT_FOUND);
+        return nullptr;
+    }
+
+    PCSTR pszDot = nullptr;
+    for (PCSTR psz = pszForward; *psz != '\0'; psz++) {
+        if (*psz == '.') {
+            pszDot = psz;
+        }
+    }
+    if (pszDot == nullptr || pszDot == pszForward || pszDot[1] == '\0') {
+        DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
+        return nullptr;
+    }
+
+    CHAR szModule[MAX_PATH];
+    if (FAILED(StringCchCopyNA(szModule, ARRAYSIZE(szModule),
+                               pszForward, pszDot - pszForward))) {
+        DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
+        return nullptr;
+    }
+
+    // The loader normally has the target loaded already; ".dll" is implied.
+    HMODULE hModule = GetModuleHandleA(szModule);
+    if (hModule == nullptr) {
+#pragma prefast(suppress:28752, "We don't do the unicode conversion for LoadLibraryExA.")
+        hModule = LoadLibraryExA(szModule, nullptr, 0);
+        if (hModule == nullptr) {
+            DetoursSetLastError(DETOURS_STATUS_MOD_NOT_FOUND);
+            return nullptr;
+        }
+    }
+
+    LPCSTR pszName = pszDot + 1;
+    if (pszName[0] == '#') {
+        ULONG nOrdinal = 0;
+        for (PCSTR psz = pszName + 1; *psz >= '0' && *psz <= '9'; psz++) {
+            nOrdinal = nOrdinal * 10 + (*psz - '0');
+        }
+        if (nOrdinal == 0 || nOrdinal > 0xffff) {
+            DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
+            return nullptr;
+        }
+        pszName = (LPCSTR)(ULONG_PTR)nOrdinal;
+    }
+    return detour_find_export((PIMAGE_DOS_HEADER)hModule, pszName, nDepth + 1);
+}
+
+static PVOID detour_find_export(PIMAGE_DOS_HEADER pDosHeader, LPCSTR pszName, ULONG nDepth)
+{
+    PIMAGE_NT_HEADERS pNtHeader = detour_image_headers(pDosHeader, MAXDWORD);
+    if (pNtHeader == nullptr) {
+        // Error set by detour_image_headers.
+        return nullptr;
+    }
+
+    DWORD cbExportDir = 0;
+    PIMAGE_EXPORT_DIRECTORY pExportDir
+        = (PIMAGE_EXPORT_DIRECTORY)
+        detour_image_directory(pDosHeader, pNtHeader,
+                               IMAGE_DIRECTORY_ENTRY_EXPORT, &cbExportDir);
+
+    if (pExportDir == nullptr) {
+        DetoursSetLastError(DETOURS_STATUS_PROC_NOT_FOUND);
+        return nullptr;
+    }
+
+    PBYTE pExportDirEnd = (PBYTE)pExportDir + cbExportDir;
+    PDWORD pdwFunctions = (PDWORD)RvaAdjust(pDosHeader, pExportDir->AddressOfFunctions);
+    PDWORD pdwNames = (PDWORD)RvaAdjust(pDosHeader, pExportDir->AddressOfNames);
+    PWORD pwOrdinals = (PWORD)RvaAdjust(pDosHeader, pExportDir->AddressOfNameOrdinals);
+
+    DWORD nFunc = MAXDWORD;
+    if (((ULONG_PTR)pszName >> 16) == 0) {
+        // Import by ordinal, as with GetProcAddress.
+        nFunc = (DWORD)(ULONG_PTR)pszName - pExportDir->Base;
+    }
+    else if (pdwNames != nullptr && pwOrdinals != nullptr) {
+        // The name table is sorted, as the loader requires.
+        DWORD nLo = 0;
+        DWORD nHi = pExportDir->NumberOfNames;
+        while (nLo < nHi) {
+            DWORD nMid = nLo + (nHi - nLo) / 2;
+            int c = strcmp(pszName, (PCSTR)RvaAdjust(pDosHeader, pdwNames[nMid]));
+            if (c == 0) {
+                nFunc = pwOrdinals[nMid];
+                break;
+            }
+            if (c < 0) {
+                nHi = nMid;
+            }
+            else {
+                nLo = nMid + 1;
+            }
+        }
+    }
+
+    if (pdwFunctions == nullptr || nFunc >= pExportDir->NumberOfFunctions) {
+        DetoursSetLastError(DETOURS_STATUS_PROC_NOT_FOUND);
+        return nullptr;
+    }
+
+    PBYTE pbCode = (PBYTE)RvaAdjust(pDosHeader, pdwFunctions[nFunc]);
+    if (pbCode == nullptr) {
+        DetoursSetLastError(DETOURS_STATUS_PROC_NOT_FOUND);
+        return nullptr;
+    }
+
+    // if the pointer is in the export region, then it is a forwarder.
+    if (pbCode > (PBYTE)pExportDir && pbCode < pExportDirEnd) {
+        return detour_find_forward((PCSTR)pbCode, nDepth);
+    }
+
+    DetoursSetLastError(DETOURS_STATUS_SUCCESS);
+    return pbCode;
+}
+
+PVOID DETOURS_API DetourFindExport(_In_opt_ HMODULE hModule,
+                              _In_ LPCSTR pszName)
+{
+    PIMAGE_DOS_HEADER pDosHeader = (PIMAGE_DOS_HEADER)hModule;
+    if (hModule == nullptr) {
+        pDosHeader = (PIMAGE_DOS_HEADER)GetModuleHandleW(nullptr);
+    }
+
+    if (pszName == nullptr) {
+        DetoursSetLastError(DETOURS_STATUS_INVALID_PARAMETER);
+        return nullptr;
+    }
+
+    __try {
+#pragma warning(suppress:6011) // GetModuleHandleW(nullptr) never returns nullptr.
+        return detour_find_export(pDosHeader, pszName, 0);
+    }
+    __except(GetExceptionCode() == EXCEPTION_ACCESS_VIOLATION ?
+             EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+        DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
+        return nullptr;
+    }
+}
+
 BOOL DETOURS_API DetourEnumerateImportsEx(_In_opt_ HMODULE hModule,
                                      _In_opt_ PVOID pContext,
                                      _In_opt_ PF_DETOUR_IMPORT_FILE_CALLBACK pfImportFile,
@@ -542,27 +1042,17 @@ BOOL DETOURS_API DetourEnumerateImportsEx(_In_opt_ HMODULE hModule,
 
     __try {
 #pragma warning(suppress:6011) // GetModuleHandleW(nullptr) never returns nullptr.
-        if (pDosHeader->e_magic != IMAGE_DOS_SIGNATURE) {
-            DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
-            return FALSE;
-        }
-
-        PIMAGE_NT_HEADERS pNtHeader = (PIMAGE_NT_HEADERS)((PBYTE)pDosHeader +
-                                                          pDosHeader->e_lfanew);
-        if (pNtHeader->Signature != IMAGE_NT_SIGNATURE) {
-            DetoursSetLastError(DETOURS_STATUS_INVALID_EXE_SIGNATURE);
-            return FALSE;
-        }
-        if (pNtHeader->FileHeader.SizeOfOptionalHeader == 0) {
-            DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
+        PIMAGE_NT_HEADERS pNtHeader = detour_image_headers(pDosHeader, MAXDWORD);
+        if (pNtHeader == nullptr) {
+            // Error set by detour_image_headers.
             return FALSE;
         }
 
+        DWORD cbImportDir = 0;
         PIMAGE_IMPORT_DESCRIPTOR iidp
             = (PIMAGE_IMPORT_DESCRIPTOR)
-            RvaAdjust(pDosHeader,
-                      pNtHeader->OptionalHeader
-                      .DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT].VirtualAddress);
+            detour_image_directory(pDosHeader, pNtHeader,
+                                   IMAGE_DIRECTORY_ENTRY_IMPORT, &cbImportDir);
 
         if (iidp == nullptr) {
             DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
@@ -676,27 +1166,13 @@ static PDETOUR_LOADED_BINARY DETOURS_API GetPayloadSectionFromModule(HMODULE hMo
 
     __try {
 #pragma warning(suppress:6011) // GetModuleHandleW(nullptr) never returns nullptr.
-        if (pDosHeader->e_magic != IMAGE_DOS_SIGNATURE) {
-            DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
-            return nullptr;
-        }
-
-        PIMAGE_NT_HEADERS pNtHeader = (PIMAGE_NT_HEADERS)((PBYTE)pDosHeader +
-                                                          pDosHeader->e_lfanew);
-        if (pNtHeader->Signature != IMAGE_NT_SIGNATURE) {
-            DetoursSetLastError(DETOURS_STATUS_INVALID_EXE_SIGNATURE);
-            return nullptr;
-        }
-        if (pNtHeader->FileHeader.SizeOfOptionalHeader == 0) {
-            DetoursSetLastError(DETOURS_STATUS_BAD_EXE_FORMAT);
+        PIMAGE_NT_HEADERS pNtHeader = detour_image_headers(pDosHeader, MAXDWORD);
+        if (pNtHeader == nullptr) {
+            // Error set by detour_image_headers.
             return nullptr;
         }
 
-        PIMAGE_SECTION_HEADER pSectionHeaders
-            = (PIMAGE_SECTION_HEADER)((PBYTE)pNtHeader
-                                      + sizeof(pNtHeader->Signature)
-                                      + sizeof(pNtHeader->FileHeader)
-                                      + pNtHeader->FileHeader.SizeOfOptionalHeader);
+        PIMAGE_SECTION_HEADER pSectionHeaders = detour_image_sections(pNtHeader);
 
         for (DWORD n = 0; n < pNtHeader->FileHeader.NumberOfSections; n++) {
             if (strcmp((PCHAR)pSectionHeaders[n].Name, ".detour") == 0) {
@@ -757,24 +1233,94 @@ DWORD DETOURS_API DetourGetSizeOfPayloads(_In_opt_ HMODULE hModule)
     }
 }
 
-_Writable_bytes_(*pcbData)
-_Readable_bytes_(*pcbData)
-_Success_(return != nullptr)
-PVOID DETOURS_API DetourFindPayload(_In_opt_ HMODULE hModule,
-                               _In_ REFGUID rguid,
-                               _Out_ DWORD *pcbData)
+// Answers a lookup from the index record, if one leads the data and still
+// describes it.  Only a checked hit is trusted; a miss returns FALSE too, as
+// a writer that predates the index may have changed records without
+// changing cbData, so the records must then be walked.
+static BOOL detour_search_payload_index(PBYTE pbData,
+                                        DWORD cbData,
+                                        REFGUID rguid,
+                                        PDETOUR_SECTION_RECORD *ppRecord)
 {
-    PBYTE pbData = nullptr;
-    if (pcbData) {
-        *pcbData = 0;
+    const DWORD cbMinimum = sizeof(DETOUR_SECTION_RECORD) + sizeof(DETOUR_SECTION_INDEX);
+
+    *ppRecord = nullptr;
+
+    PDETOUR_SECTION_RECORD pHead = (PDETOUR_SECTION_RECORD)pbData;
+    if (cbData < cbMinimum ||
+        pHead->cbBytes < cbMinimum ||
+        pHead->cbBytes > cbData ||
+        memcmp(&pHead->guid, &DETOUR_PAYLOAD_INDEX_GUID, sizeof(GUID)) != 0) {
+        return FALSE;
     }
 
-    PDETOUR_LOADED_BINARY pBinary = GetPayloadSectionFromModule(hModule);
-    if (pBinary == nullptr) {
-        // Error set by GetPayloadSectionFromModule.
-        return nullptr;
+    PDETOUR_SECTION_INDEX pIndex = (PDETOUR_SECTION_INDEX)(pHead + 1);
+    PDETOUR_SECTION_INDEX_ENTRY pEntries = (PDETOUR_SECTION_INDEX_ENTRY)(pIndex + 1);
+    if (pIndex->cbData != cbData ||
+        pIndex->cEntries > (pHead->cbBytes - cbMinimum) / sizeof(DETOUR_SECTION_INDEX_ENTRY)) {
+        return FALSE;
+    }
+
+    DWORD nLo = 0;
+    DWORD nHi = pIndex->cEntries;
+    while (nLo < nHi) {
+        DWORD nMid = nLo + (nHi - nLo) / 2;
+        int nCmp = memcmp(&pEntries[nMid].guid, &rguid, sizeof(GUID));
+
+        if (nCmp < 0) {
+            nLo = nMid + 1;
+        }
+        else if (nCmp > 0) {
+            nHi = nMid;
+        }
+        else {
+            // Trust the entry only if the record it names is still there.
+            DWORD nOffset = pEntries[nMid].nOffset;
+            if (nOffset > cbData - sizeof(DETOUR_SECTION_RECORD)) {
+                return FALSE;
+            }
+            PDETOUR_SECTION_RECORD pRecord = (PDETOUR_SECTION_RECORD)(pbData + nOffset);
+            if (pRecord->cbBytes != pEntries[nMid].cbBytes ||
+                pRecord->cbBytes < sizeof(DETOUR_SECTION_RECORD) ||
+                pRecord->cbBytes > cbData - nOffset ||
+                memcmp(&pRecord->guid, &rguid, sizeof(GUID)) != 0) {
+                return FALSE;
+            }
+            *ppRecord = pRecord;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+PDETOUR_SECTION_RECORD detour_find_payload_record(_In_reads_bytes_(cbData) PBYTE pbData,
+                                                  _In_ DWORD cbData,
+                                                  _In_ REFGUID rguid)
+{
+    PDETOUR_SECTION_RECORD pRecord = nullptr;
+    if (detour_search_payload_index(pbData, cbData, rguid, &pRecord)) {
+        return pRecord;
+    }
+
+    DWORD cbBytes;
+    for (DWORD nOffset = 0; cbData - nOffset >= sizeof(DETOUR_SECTION_RECORD); nOffset += cbBytes) {
+        pRecord = (PDETOUR_SECTION_RECORD)(pbData + nOffset);
+
+        cbBytes = pRecord->cbBytes;
+        if (cbBytes < sizeof(DETOUR_SECTION_RECORD) || cbBytes > cbData - nOffset) {
+            break;
+        }
+        if (memcmp(&pRecord->guid, &rguid, sizeof(GUID)) == 0) {
+            return pRecord;
+        }
     }
+    return nullptr;
+}
 
+static PVOID detour_find_payload(PDETOUR_LOADED_BINARY pBinary,
+                                 REFGUID rguid,
+                                 DWORD *pcbData)
+{
     __try {
         DETOUR_SECTION_HEADER *pHeader = (DETOUR_SECTION_HEADER *)pBinary;
         if (pHeader->cbHeaderSize < sizeof(DETOUR_SECTION_HEADER) ||
@@ -784,32 +1330,17 @@ PVOID DETOURS_API DetourFindPayload(_In_opt_ HMODULE hModule,
             return nullptr;
         }
 
-        PBYTE pbBeg = ((PBYTE)pHeader) + pHeader->nDataOffset;
-        PBYTE pbEnd = ((PBYTE)pHeader) + pHeader->cbDataSize;
-
-        for (pbData = pbBeg; pbData < pbEnd;) {
-            DETOUR_SECTION_RECORD *pSection = (DETOUR_SECTION_RECORD *)pbData;
-
-            if (pSection->guid.Data1 == rguid.Data1 &&
-                pSection->guid.Data2 == rguid.Data2 &&
-                pSection->guid.Data3 == rguid.Data3 &&
-                pSection->guid.Data4[0] == rguid.Data4[0] &&
-                pSection->guid.Data4[1] == rguid.Data4[1] &&
-                pSection->guid.Data4[2] == rguid.Data4[2] &&
-                pSection->guid.Data4[3] == rguid.Data4[3] &&
-                pSection->guid.Data4[4] == rguid.Data4[4] &&
-                pSection->guid.Data4[5] == rguid.Data4[5] &&
-                pSection->guid.Data4[6] == rguid.Data4[6] &&
-                pSection->guid.Data4[7] == rguid.Data4[7]) {
-
-                if (pcbData) {
-                    *pcbData = pSection->cbBytes - sizeof(*pSection);
-                    DetoursSetLastError(DETOURS_STATUS_SUCCESS);
-                    return (PBYTE)(pSection + 1);
-                }
-            }
+        DWORD cbData = 0;
+        if (pHeader->cbDataSize > pHeader->nDataOffset) {
+            cbData = pHeader->cbDataSize - pHeader->nDataOffset;
+        }
 
-            pbData = (PBYTE)pSection + pSection->cbBytes;
+        PDETOUR_SECTION_RECORD pSection
+            = detour_find_payload_record(((PBYTE)pHeader) + pHeader->nDataOffset, cbData, rguid);
+        if (pSection != nullptr && pcbData) {
+            *pcbData = pSection->cbBytes - sizeof(*pSection);
+            DetoursSetLastError(DETOURS_STATUS_SUCCESS);
+            return (PBYTE)(pSection + 1);
         }
         DetoursSetLastError(DETOURS_STATUS_INVALID_HANDLE);
         return nullptr;
@@ -821,12 +1352,50 @@ PVOID DETOURS_API DetourFindPayload(_In_opt_ HMODULE hModule,
     }
 }
 
+_Writable_bytes_(*pcbData)
+_Readable_bytes_(*pcbData)
+_Success_(return != nullptr)
+PVOID DETOURS_API DetourFindPayload(_In_opt_ HMODULE hModule,
+                               _In_ REFGUID rguid,
+                               _Out_ DWORD *pcbData)
+{
+    if (pcbData) {
+        *pcbData = 0;
+    }
+
+    PDETOUR_LOADED_BINARY pBinary = GetPayloadSectionFromModule(hModule);
+    if (pBinary == nullptr) {
+        // Error set by GetPayloadSectionFromModule.
+        return nullptr;
+    }
+
+    return detour_find_payload(pBinary, rguid, pcbData);
+}
+
 _Writable_bytes_(*pcbData)
 _Readable_bytes_(*pcbData)
 _Success_(return != nullptr)
 PVOID DETOURS_API DetourFindPayloadEx(_In_ REFGUID rguid,
                                  _Out_ DWORD * pcbData)
 {
+    if (detour_module_map_enter()) {
+        PVOID pvData = nullptr;
+        for (ULONG n = 0; n < s_cModuleMap && pvData == nullptr; n++) {
+            if (s_pModuleMap[n].pPayloads != nullptr) {
+                if (pcbData) {
+                    *pcbData = 0;
+                }
+                pvData = detour_find_payload(s_pModuleMap[n].pPayloads, rguid, pcbData);
+            }
+        }
+        detour_module_map_leave();
+
+        if (pvData == nullptr) {
+            DetoursSetLastError(DETOURS_STATUS_MOD_NOT_FOUND);
+        }
+        return pvData;
+    }
+
     for (HMODULE hMod = nullptr; (hMod = DetourEnumerateModules(hMod)) != nullptr;) {
         PVOID pvData;
 